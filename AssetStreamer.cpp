@@ -0,0 +1,205 @@
+#include "AssetStreamer.h"
+#include "IrrManagers.h"
+#include "StaticMesh.h"
+#include "Texture.h"
+#include <fstream>
+
+AssetStreamer::AssetStreamer() {}
+
+void AssetStreamer::start(int workerCount) {
+	if (!workers.empty())
+		return;
+
+	if (workerCount <= 0)
+		workerCount = irr::core::clamp<int>((int)std::thread::hardware_concurrency() - 1, 1, 4);
+
+	finished = false;
+	for (int i = 0; i < workerCount; ++i)
+		workers.push_back(std::thread(&AssetStreamer::workerBody, this));
+}
+
+void AssetStreamer::shutdown() {
+	{
+		std::lock_guard<std::mutex> guard(jobLock);
+		finished = true;
+	}
+	jobSignal.notify_all();
+
+	for (std::thread& t : workers) {
+		if (t.joinable())
+			t.join();
+	}
+	workers.clear();
+
+	while (!pendingJobs.empty()) {
+		delete pendingJobs.front();
+		pendingJobs.pop();
+	}
+
+	while (!loadedJobs.empty()) {
+		delete loadedJobs.front();
+		loadedJobs.pop();
+	}
+
+	callbacks.clear();
+}
+
+int AssetStreamer::loadAsync(ASSET_TYPE type, const std::string& path, sol::function callback) {
+	if (workers.empty())
+		start();
+
+	int id = nextID++;
+	if (callback.valid())
+		callbacks[id] = callback;
+
+	AssetJob* job = new AssetJob(id, type, path);
+
+	// Already cached assets skip the workers entirely and complete on the next pump
+	bool cached = type == ASSET_TYPE::TEXTURE ?
+		driver->findTexture(path.c_str()) != nullptr :
+		smgr->getMeshCache()->getMeshByName(path.c_str()) != nullptr;
+
+	{
+		std::lock_guard<std::mutex> guard(jobLock);
+		if (cached)
+			loadedJobs.push(job);
+		else
+			pendingJobs.push(job);
+	}
+
+	if (!cached)
+		jobSignal.notify_one();
+
+	return id;
+}
+
+void AssetStreamer::workerBody() {
+	while (true) {
+		AssetJob* job = nullptr;
+
+		{
+			std::unique_lock<std::mutex> guard(jobLock);
+			jobSignal.wait(guard, [this] { return finished || !pendingJobs.empty(); });
+			if (finished)
+				return;
+
+			job = pendingJobs.front();
+			pendingJobs.pop();
+		}
+
+		std::ifstream file(job->path, std::ios::binary | std::ios::ate);
+		if (file.is_open()) {
+			std::streamsize size = file.tellg();
+			file.seekg(0, std::ios::beg);
+
+			job->bytes.resize((size_t)size);
+			if (size <= 0 || !file.read(job->bytes.data(), size)) {
+				job->bytes.clear();
+				job->readFailed = true;
+			}
+		}
+		else {
+			job->readFailed = true;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(jobLock);
+			loadedJobs.push(job);
+		}
+	}
+}
+
+void AssetStreamer::pump() {
+	irr::ITimer* timer = device->getTimer();
+	const irr::u32 start = timer->getRealTime();
+
+	// Always finish at least one asset per frame so large uploads cannot stall the queue
+	while (true) {
+		AssetJob* job = nullptr;
+
+		{
+			std::lock_guard<std::mutex> guard(jobLock);
+			if (loadedJobs.empty())
+				break;
+
+			job = loadedJobs.front();
+			loadedJobs.pop();
+		}
+
+		finish(job);
+		delete job;
+
+		if ((irr::f32)(timer->getRealTime() - start) >= uploadBudget)
+			break;
+	}
+}
+
+void AssetStreamer::finish(AssetJob* job) {
+	sol::object result; // Nil when the load failed
+
+	if (job->type == ASSET_TYPE::TEXTURE) {
+		irr::video::ITexture* tex = driver->findTexture(job->path.c_str());
+
+		if (!tex && !job->readFailed) {
+			// Irrlicht's image loaders keep static state (the JPEG loader for one) and every other texture load
+			// runs on the main thread, so decoding stays here too and counts against the upload budget
+			irr::io::IReadFile* memFile = device->getFileSystem()->createMemoryReadFile(job->bytes.data(), (irr::s32)job->bytes.size(), job->path.c_str(), false);
+			if (memFile) {
+				tex = driver->getTexture(memFile);
+				memFile->drop();
+			}
+		}
+		else if (!tex) {
+			tex = driver->getTexture(job->path.c_str()); // Not on disk, let Irrlicht search mounted archives
+		}
+
+		if (tex) {
+			Texture t = Texture(std::string());
+			t.texture = tex;
+			t.path = job->path;
+			result = sol::make_object(*lua, t);
+		}
+	}
+	else {
+		irr::scene::IAnimatedMesh* mesh = smgr->getMeshCache()->getMeshByName(job->path.c_str());
+
+		if (!mesh && !job->readFailed) {
+			// Mesh loaders resolve textures and register with the mesh cache, so parsing stays on the main thread
+			irr::io::IReadFile* memFile = device->getFileSystem()->createMemoryReadFile(job->bytes.data(), (irr::s32)job->bytes.size(), job->path.c_str(), false);
+			if (memFile) {
+				mesh = smgr->getMesh(memFile);
+				memFile->drop();
+			}
+		}
+		else if (!mesh) {
+			mesh = smgr->getMesh(job->path.c_str());
+		}
+
+		if (mesh) {
+			StaticMesh m = StaticMesh(job->path);
+			if (m.meshNode)
+				result = sol::make_object(*lua, m);
+		}
+	}
+
+	auto it = callbacks.find(job->id);
+	if (it != callbacks.end()) {
+		irrHandler->addLuaTask(it->second, result);
+		callbacks.erase(it);
+	}
+}
+
+int AssetStreamer::getPendingCount() {
+	std::lock_guard<std::mutex> guard(jobLock);
+	return (int)(pendingJobs.size() + loadedJobs.size());
+}
+
+void loadMeshAsync(const std::string& path, sol::function callback) {
+	if (assetStreamer)
+		assetStreamer->loadAsync(ASSET_TYPE::MESH, path, callback);
+}
+
+void loadTextureAsync(const std::string& path, sol::function callback) {
+	if (assetStreamer)
+		assetStreamer->loadAsync(ASSET_TYPE::TEXTURE, path, callback);
+}
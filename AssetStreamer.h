@@ -0,0 +1,63 @@
+#pragma once
+
+#include <irrlicht.h>
+#include <sol/sol.hpp>
+#include <string>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+enum struct ASSET_TYPE : int {
+	MESH = 0,
+	TEXTURE = 1
+};
+
+// Work item shared between the main thread and the loader threads. Workers only ever touch
+// the path/bytes members, the Lua callback stays on the main thread (see callbacks).
+struct AssetJob {
+	AssetJob(int i, ASSET_TYPE t, const std::string& p) : id(i), type(t), path(p) {}
+
+	int id = -1;
+	ASSET_TYPE type = ASSET_TYPE::MESH;
+	std::string path;
+
+	std::vector<char> bytes; // Raw file contents, read on a worker
+	bool readFailed = false; // File was not on disk (may still live in an archive)
+};
+
+class AssetStreamer
+{
+public:
+	AssetStreamer();
+
+	void start(int workerCount = 0); // Spawn loader threads, 0 picks a count from the hardware
+	void shutdown(); // Stop and join loader threads
+
+	int loadAsync(ASSET_TYPE type, const std::string& path, sol::function callback); // Returns request ID
+	void pump(); // Main thread only, finish loaded assets within uploadBudget milliseconds
+
+	int getPendingCount();
+
+	float uploadBudget = 4.0f; // Milliseconds of main thread time spent decoding and uploading per frame
+private:
+	void workerBody();
+	void finish(AssetJob* job);
+
+	int nextID = 0;
+	bool finished = false;
+
+	std::vector<std::thread> workers;
+
+	std::mutex jobLock;
+	std::condition_variable jobSignal;
+	std::queue<AssetJob*> pendingJobs; // Waiting for a worker
+	std::queue<AssetJob*> loadedJobs; // Waiting for the main thread
+
+	std::unordered_map<int, sol::function> callbacks; // Main thread only
+};
+
+void loadMeshAsync(const std::string& path, sol::function callback);
+void loadTextureAsync(const std::string& path, sol::function callback);
@@ -38,6 +38,7 @@ void Billboard::setSize(const Vector2D& size) {
 bool Billboard::loadMaterial(const Material& material) {
     myMaterial = material.mat;
     bb->getMaterial(0) = myMaterial;
+    effects->markShadowNodeMaterialsChanged(bb);
     return true;
 }
 
@@ -69,6 +70,7 @@ void Billboard::setVisible(bool visible) {
 
 void Billboard::destroy() {
     if (bb) {
+        transformStore->remove(bb);
         bb->remove();
     }
 }
@@ -2,6 +2,11 @@
 #include <iostream>
 #include <string>
 #include <fstream>
+#include <cstdio>
+#include <filesystem>
+#include <iterator>
+#include <unordered_map>
+#include <vector>
 
 using namespace irr;
 using namespace video;
@@ -9,151 +14,75 @@ using namespace core;
 using namespace scene;
 using namespace io;
 
-struct SDefineExp
+namespace
 {
-	SDefineExp() : IfPos(-1), ElsePos(-1), EndPos(-1), IfExp(""), Inverse(false) {};
-	s32 IfPos;
-	s32 ElsePos;
-	s32 EndPos;
-	core::stringc IfExp;
-	bool Inverse;
-};
-
-core::array<SDefineExp> grabDefineExpressions(core::stringc &shaderProgram)
-{
-	s32 CurrentSearchPos = 1;
-	s32 FindHelper = 1;
-	s32 FindHelper2 = 1;
-	
-	core::array<SDefineExp> DefineArray;
+	// Preprocessed sources by hash of source and defines, shared by every preprocessor.
+	std::unordered_map<unsigned long long, std::string> SourceCache;
+	std::string CacheDirectory;
 
-	// Dont bother stripping comments if theres no defines.
-	if(CurrentSearchPos = shaderProgram.find("##ifdef") == -1)
-		return DefineArray;
+	const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+	const unsigned long long FNV_PRIME = 1099511628211ULL;
 
-	// Strip all comments, they get in the way.
-	while((CurrentSearchPos = shaderProgram.find("//")) > -1)
+	unsigned long long fnv1a(const char* data, size_t size, unsigned long long hash = FNV_OFFSET)
 	{
-		FindHelper = shaderProgram.findNext('\n',CurrentSearchPos);
-		if(FindHelper != -1)
-			for(u32 i = CurrentSearchPos;i < (u32)FindHelper;++i)
-				shaderProgram[i] = ' ';
-		else
-			for(u32 i = CurrentSearchPos;i < shaderProgram.size();++i)
-				shaderProgram[i] = ' ';
+		for(size_t i = 0;i < size;++i)
+		{
+			hash ^= (unsigned char)data[i];
+			hash *= FNV_PRIME;
+		}
+
+		return hash;
 	}
 
-	while((CurrentSearchPos = shaderProgram.find("/*")) > -1)
+	bool isIdentifierStart(char c)
 	{
-		FindHelper = shaderProgram.find("*/");
-		if(FindHelper > CurrentSearchPos)
-			for(u32 i = CurrentSearchPos;i <= (u32)(FindHelper + 1);++i)
-				shaderProgram[i] = ' ';
-		else
-			for(u32 i = CurrentSearchPos;i < shaderProgram.size();++i)
-				shaderProgram[i] = ' ';
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
 	}
 
-	while((CurrentSearchPos = shaderProgram.find("##ifdef")) > -1)
+	bool isIdentifierChar(char c)
 	{
-		SDefineExp DExp;
-		
-		DExp.IfPos = CurrentSearchPos;
-		
-		// Comment out the ##ifdef so that we do not find it again, and so that the compiler ignores it.
-		shaderProgram[CurrentSearchPos] = '/';
-		shaderProgram[CurrentSearchPos + 1] = '/';
-
-		FindHelper = shaderProgram.findNext(' ',CurrentSearchPos);
-		FindHelper2 = shaderProgram.findNext('\n',FindHelper);
-
-		if(FindHelper == -1 || FindHelper2 == -1)
-		{
-			std::cerr << "Shader preprocessor encountered invalid if statement." << std::endl;
-			return DefineArray;
-		}
-
-		// Find the appropriate expression and trim all white space.
-		DExp.IfExp = shaderProgram.subString(FindHelper,FindHelper2 - FindHelper);
-		DExp.IfExp.trim();
-		
-		// Record if its inverse and remove ! sign from expression.
-		if(DExp.IfExp[0] == '!')
-		{
-			DExp.IfExp[0] = ' ';
-			DExp.IfExp.trim();
-			DExp.Inverse = true;
-		}
-
-		bool EndIfFound = false;
+		return isIdentifierStart(c) || (c >= '0' && c <= '9');
+	}
 
-		FindHelper2 = CurrentSearchPos;
-		s32 IfEndScope = 0;
+	std::string getCachePath(unsigned long long hash)
+	{
+		char name[24];
+		snprintf(name, sizeof(name), "%016llx.pp", hash);
+		return CacheDirectory + "/" + name;
+	}
 
-		while(!EndIfFound)
-		{
-			FindHelper = shaderProgram.findNext('#',FindHelper2);
+	// The first line of a cache file repeats its hash, so renamed or truncated files are not trusted.
+	bool readCacheFile(unsigned long long hash, std::string& source)
+	{
+		std::ifstream File(getCachePath(hash).c_str(), std::ios::in | std::ios::binary);
+		if(!File.is_open())
+			return false;
 
-			if(FindHelper == -1 || FindHelper >= (s32)(shaderProgram.size() - 3))
-			{
-				std::cerr << "Shader preprocessor encountered unmatched if statement." << std::endl;
-				return DefineArray;
-			}
+		std::string Header;
+		std::getline(File, Header);
 
-			if(IfEndScope < 0)
-			{
-				std::cerr << "Shader preprocessor encountered unmatched endif statement." << std::endl;
-				return DefineArray;
-			}
-			
-			if(shaderProgram[FindHelper + 1] != '#')
-			{
-				FindHelper2 = FindHelper + 1;
-				continue;
-			}
-			else if(shaderProgram[FindHelper + 2] == 'i')
-			{
-				IfEndScope++;
-			}
-			else if(shaderProgram[FindHelper + 2] == 'e' && shaderProgram[FindHelper + 3] == 'n')
-			{
-				if(IfEndScope == 0)
-					break;
+		char expected[24];
+		snprintf(expected, sizeof(expected), "%016llx", hash);
+		if(Header != expected)
+			return false;
 
-				IfEndScope--;
-			}
-			else if(shaderProgram[FindHelper + 2] == 'e' && shaderProgram[FindHelper + 3] == 'l')
-			{
-				if(IfEndScope == 0)
-				{
-					if(DExp.ElsePos != -1)
-					{
-						std::cerr << "Shader preprocessor encountered duplicate else statements per if statement." << std::endl;
-						return DefineArray;
-					}
-
-					// Comment out the ##else so that we do not find it again, and so that the compiler ignores it.
-					shaderProgram[FindHelper] = '/';
-					shaderProgram[FindHelper + 1] = '/';
+		source.assign(std::istreambuf_iterator<char>(File), std::istreambuf_iterator<char>());
+		return true;
+	}
 
-					DExp.ElsePos = FindHelper;
-				}
-			}
-			
-			FindHelper2 = FindHelper + 2;
-		}
+	void writeCacheFile(unsigned long long hash, const std::string& source)
+	{
+		std::error_code error;
+		std::filesystem::create_directories(CacheDirectory, error);
 
-		// Comment out the ##endif so that we do not find it again, and so that the compiler ignores it.
-		shaderProgram[FindHelper] = '/';
-		shaderProgram[FindHelper + 1] = '/';
+		std::ofstream File(getCachePath(hash).c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		if(!File.is_open())
+			return;
 
-		DExp.EndPos = FindHelper;
-		
-		// Add the define expression to the array.
-		DefineArray.push_back(DExp);
+		char header[24];
+		snprintf(header, sizeof(header), "%016llx", hash);
+		File << header << "\n" << source;
 	}
-
-	return DefineArray;
 }
 
 CShaderPreprocessor::CShaderPreprocessor(irr::video::IVideoDriver* driverIn) : driver(driverIn) 
@@ -203,76 +132,213 @@ void CShaderPreprocessor::removeShaderDefine(const core::stringc name)
 	DefineMap.remove(name);
 }
 
+void CShaderPreprocessor::setCacheDirectory(const core::stringc& directory)
+{
+	CacheDirectory = directory.c_str();
+}
+
+void CShaderPreprocessor::clearCache()
+{
+	SourceCache.clear();
+}
+
 //! PreProcesses a shader using Irrlicht's built-in shader preprocessor.
 core::stringc CShaderPreprocessor::ppShader(core::stringc shaderProgram)
 {
-	core::array<SDefineExp> DefineArray = grabDefineExpressions(shaderProgram);
+	// Names and values are hashed with their terminators so "AB" + "C" differs from "A" + "BC".
+	unsigned long long hash = fnv1a(shaderProgram.c_str(), shaderProgram.size());
 
-	// No need for this as its already inited at startup.
-	//// If DefineMap is empty then initialize it.
-	//if(DefineMap.isEmpty())
-	//	initDefineMap();
+	core::map<core::stringc, core::stringc>::Iterator DefIter = DefineMap.getIterator();
+	for(;!DefIter.atEnd();DefIter++)
+	{
+		hash = fnv1a(DefIter->getKey().c_str(), DefIter->getKey().size() + 1, hash);
+		hash = fnv1a(DefIter->getValue().c_str(), DefIter->getValue().size() + 1, hash);
+	}
+
+	std::unordered_map<unsigned long long, std::string>::const_iterator cached = SourceCache.find(hash);
+	if(cached != SourceCache.end())
+		return cached->second.c_str();
 
-	for(u32 i = 0; i < DefineArray.size();++i)
+	std::string source;
+	if(!CacheDirectory.empty() && readCacheFile(hash, source))
 	{
-		if(DefineArray[i].IfPos == -1)
-			break;
-	
-		// Either it is true and not inversed, or it is false, but inversed. 
-		// (Wish C++ had a built-in (logical) XOR operator sometimes. :P) 
-		if((DefineMap.find(DefineArray[i].IfExp) && !DefineArray[i].Inverse) 
-		|| (!DefineMap.find(DefineArray[i].IfExp) && DefineArray[i].Inverse))
+		SourceCache[hash] = source;
+		return source.c_str();
+	}
+
+	const core::stringc result = preprocess(shaderProgram);
+	SourceCache[hash] = result.c_str();
+
+	if(!CacheDirectory.empty())
+		writeCacheFile(hash, result.c_str());
+
+	return result;
+}
+
+core::stringc CShaderPreprocessor::preprocess(const core::stringc& shaderProgram) const
+{
+	// Only defines with a value are substituted, the rest just exist for ##ifdef.
+	std::unordered_map<std::string, std::string> Substitutions;
+
+	core::map<core::stringc, core::stringc>::ConstIterator DefIter = DefineMap.getConstIterator();
+	for(;!DefIter.atEnd();DefIter++)
+	{
+		if(DefIter->getValue().size())
+			Substitutions[DefIter->getKey().c_str()] = DefIter->getValue().c_str();
+	}
+
+	// One entry per open ##ifdef.
+	struct SBranch
+	{
+		bool ParentActive;
+		bool Condition;
+		bool InElse;
+	};
+
+	std::vector<SBranch> Branches;
+	bool Active = true;
+
+	const char* Source = shaderProgram.c_str();
+	const u32 Size = shaderProgram.size();
+
+	std::string Output;
+	Output.reserve(Size + Size / 8);
+
+	u32 i = 0;
+	while(i < Size)
+	{
+		const char c = Source[i];
+
+		// Comments are copied as they are, directives and defines inside them are ignored.
+		if(c == '/' && i + 1 < Size && (Source[i + 1] == '/' || Source[i + 1] == '*'))
 		{
-			if(DefineArray[i].ElsePos > -1)
+			const bool Block = Source[i + 1] == '*';
+			u32 End = i + 2;
+
+			if(Block)
 			{
-				// If there is an else statement then clear the else section.
-				if(DefineArray[i].EndPos != -1)
-				{
-					for(int z = DefineArray[i].ElsePos;z <= DefineArray[i].EndPos + 6;++z)
-						shaderProgram[z] = ' ';
-				}
+				while(End + 1 < Size && !(Source[End] == '*' && Source[End + 1] == '/'))
+					++End;
+				End = core::min_(End + 2, Size);
 			}
-		}
-		else if(DefineArray[i].ElsePos != -1)
-		{
-			// If there is an else statement then clear the if section.
-			for(int z = DefineArray[i].IfPos;z <= DefineArray[i].ElsePos + 5;++z)
-				shaderProgram[z] = ' ';
-		}
-		else
-		{
-			// Else just clear the whole block.
-			if(DefineArray[i].EndPos != -1)
+			else
 			{
-				for(int z = DefineArray[i].IfPos;z <= DefineArray[i].EndPos + 6;++z)
-					shaderProgram[z] = ' ';
+				while(End < Size && Source[End] != '\n')
+					++End;
 			}
+
+			if(Active)
+				Output.append(Source + i, End - i);
+			else
+				for(u32 z = i;z < End;++z)
+					if(Source[z] == '\n')
+						Output += '\n';
+
+			i = End;
+			continue;
 		}
-	}
 
-	core::map<core::stringc,core::stringc>::ParentFirstIterator DefIter;
-	s32 DefFinder = 1;
+		if(c == '#' && i + 1 < Size && Source[i + 1] == '#')
+		{
+			u32 WordEnd = i + 2;
+			while(WordEnd < Size && isIdentifierChar(Source[WordEnd]))
+				++WordEnd;
 
-	// Replace all shader defines.
-	for(DefIter = DefineMap.getParentFirstIterator();!DefIter.atEnd();DefIter++)
-	{
-		if(DefIter->getValue().size() == 0)
+			u32 LineEnd = WordEnd;
+			while(LineEnd < Size && Source[LineEnd] != '\n')
+				++LineEnd;
+
+			const std::string Word(Source + i + 2, WordEnd - i - 2);
+
+			if(Word == "ifdef")
+			{
+				core::stringc Expression(Source + WordEnd, LineEnd - WordEnd);
+				Expression.trim();
+
+				// Record if its inverse and remove ! sign from expression.
+				bool Inverse = false;
+				if(Expression.size() && Expression[0] == '!')
+				{
+					Expression[0] = ' ';
+					Expression.trim();
+					Inverse = true;
+				}
+
+				SBranch Branch;
+				Branch.ParentActive = Active;
+				Branch.Condition = (DefineMap.find(Expression) != 0) != Inverse;
+				Branch.InElse = false;
+				Branches.push_back(Branch);
+
+				Active = Branch.ParentActive && Branch.Condition;
+			}
+			else if(Word == "else")
+			{
+				if(Branches.empty())
+					std::cerr << "Shader preprocessor encountered else without if statement." << std::endl;
+				else if(Branches.back().InElse)
+					std::cerr << "Shader preprocessor encountered duplicate else statements per if statement." << std::endl;
+				else
+				{
+					Branches.back().InElse = true;
+					Active = Branches.back().ParentActive && !Branches.back().Condition;
+				}
+			}
+			else if(Word == "endif")
+			{
+				if(Branches.empty())
+					std::cerr << "Shader preprocessor encountered unmatched endif statement." << std::endl;
+				else
+				{
+					Active = Branches.back().ParentActive;
+					Branches.pop_back();
+				}
+			}
+			else
+			{
+				std::cerr << "Shader preprocessor encountered unknown directive ##" << Word << "." << std::endl;
+			}
+
+			// The directive line is dropped, its line break is kept.
+			i = LineEnd;
 			continue;
+		}
 
-		// Replace all occurances.
-		while((DefFinder = shaderProgram.find(DefIter->getKey().c_str())) > -1)
+		if(isIdentifierStart(c) || (c >= '0' && c <= '9'))
 		{
-			// Clear the define from the code.
-			for(u32 z = DefFinder;z < DefFinder + DefIter->getKey().size();++z)
-				shaderProgram[z] = ' ';
+			// Numbers are skipped whole so suffixes like the f in 1.0f are never looked up.
+			const bool Number = !isIdentifierStart(c);
+
+			u32 End = i + 1;
+			while(End < Size && (isIdentifierChar(Source[End]) || (Number && Source[End] == '.')))
+				++End;
+
+			if(Active)
+			{
+				std::unordered_map<std::string, std::string>::const_iterator Found = Number || Substitutions.empty()
+					? Substitutions.end() : Substitutions.find(std::string(Source + i, End - i));
 
-			// Stitch value and shader program together. (Is there a faster way?)
-			shaderProgram = shaderProgram.subString(0,DefFinder) + DefIter->getValue() 
-					+ shaderProgram.subString(DefFinder,shaderProgram.size() - 1);
+				if(Found != Substitutions.end())
+					Output += Found->second;
+				else
+					Output.append(Source + i, End - i);
+			}
+
+			i = End;
+			continue;
 		}
+
+		// Skipped blocks keep their line breaks so compiler errors point at the right lines.
+		if(Active || c == '\n')
+			Output += c;
+
+		++i;
 	}
 
-	return shaderProgram;
+	if(!Branches.empty())
+		std::cerr << "Shader preprocessor encountered unmatched if statement." << std::endl;
+
+	return Output.c_str();
 }
 
 std::string getFileContent(const std::string pFile)
@@ -12,9 +12,17 @@ public:
 	void addShaderDefine(const irr::core::stringc name, const irr::core::stringc value = "");
 	void removeShaderDefine(const irr::core::stringc name);
 
+	/// Preprocessed sources are kept by a hash of the source and the defines, in memory for every preprocessor
+	/// and in this directory between runs. An empty directory keeps them in memory only, which is the default.
+	static void setCacheDirectory(const irr::core::stringc& directory);
+	static void clearCache();
+
 private:
 	void initDefineMap();
 
+	/// Resolves ##ifdef/##else/##endif blocks and substitutes defines in a single pass over the source.
+	irr::core::stringc preprocess(const irr::core::stringc& shaderProgram) const;
+
 	irr::video::IVideoDriver* driver;
 	irr::core::map<irr::core::stringc , irr::core::stringc> DefineMap;
 };
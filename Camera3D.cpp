@@ -35,6 +35,8 @@ void Camera3D::destroy() {
     if (smgr->getActiveCamera() == camera) {
         smgr->setActiveCamera(nullptr);
     }
+    if (camera && renderTargetPool) renderTargetPool->releaseOwner(camera);
+    if (camera) transformStore->remove(camera);
     if (forwardChild) forwardChild->remove();
     if (leftChild) leftChild->remove();
     // if (d) d->remove();
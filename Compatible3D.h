@@ -2,6 +2,7 @@
 
 #include <irrlicht.h>
 #include <sol/sol.hpp>
+#include <tuple>
 
 class Compatible3D {
 public:
@@ -45,6 +46,55 @@ public:
 
         getNode()->updateAbsolutePosition();
     }
+
+    // Read paths that do not create a new Vector3D, for scripts polling many objects every frame. Types whose
+    // position property does not read getNode() override the position ones to match it
+    virtual void getPositionInto(Vector3D& out) {
+        irr::scene::ISceneNode* node = getNode();
+        if (!node) return;
+
+        copyInto(node->getPosition(), out);
+    }
+
+    void getRotationInto(Vector3D& out) {
+        irr::scene::ISceneNode* node = getNode();
+        if (!node) return;
+
+        copyInto(node->getRotation(), out);
+    }
+
+    void getScaleInto(Vector3D& out) {
+        irr::scene::ISceneNode* node = getNode();
+        if (!node) return;
+
+        copyInto(node->getScale(), out);
+    }
+
+    virtual std::tuple<float, float, float> getPositionXYZ() {
+        irr::scene::ISceneNode* node = getNode();
+        return node ? toTuple(node->getPosition()) : std::make_tuple(0.0f, 0.0f, 0.0f);
+    }
+
+    std::tuple<float, float, float> getRotationXYZ() {
+        irr::scene::ISceneNode* node = getNode();
+        return node ? toTuple(node->getRotation()) : std::make_tuple(0.0f, 0.0f, 0.0f);
+    }
+
+    std::tuple<float, float, float> getScaleXYZ() {
+        irr::scene::ISceneNode* node = getNode();
+        return node ? toTuple(node->getScale()) : std::make_tuple(1.0f, 1.0f, 1.0f);
+    }
+
+protected:
+    static void copyInto(const irr::core::vector3df& v, Vector3D& out) {
+        out.x = v.X;
+        out.y = v.Y;
+        out.z = v.Z;
+    }
+
+    static std::tuple<float, float, float> toTuple(const irr::core::vector3df& v) {
+        return std::make_tuple(v.X, v.Y, v.Z);
+    }
 };
 
 inline void bindCompatible3D() {
@@ -54,4 +104,10 @@ inline void bindCompatible3D() {
     bind_type["getAbsoluteRotation"] = &Compatible3D::getAbsRot;
     bind_type["getAbsoluteScale"] = &Compatible3D::getAbsScale;
     bind_type["updateAbsolutePosition"] = &Compatible3D::updateAbsPos;
+    bind_type["getPositionInto"] = &Compatible3D::getPositionInto;
+    bind_type["getRotationInto"] = &Compatible3D::getRotationInto;
+    bind_type["getScaleInto"] = &Compatible3D::getScaleInto;
+    bind_type["getPositionXYZ"] = &Compatible3D::getPositionXYZ;
+    bind_type["getRotationXYZ"] = &Compatible3D::getRotationXYZ;
+    bind_type["getScaleXYZ"] = &Compatible3D::getScaleXYZ;
 }
\ No newline at end of file
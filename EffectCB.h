@@ -3,6 +3,8 @@
 
 #include "EffectHandler.h"
 
+#include <cstring>
+
 using namespace irr;
 using namespace scene;
 using namespace video;
@@ -62,6 +64,9 @@ public:
 		services->setVertexShaderConstant("MAPRES", &MapRes, 1);
 
 		services->setPixelShaderConstant("LightColour", reinterpret_cast<f32*>(&LightColour.r), 4);
+
+		if (Tiled)
+			services->setPixelShaderConstant("TileRect", TileRect, 4);
 	}
 
 	EffectHandler* effect;
@@ -72,6 +77,80 @@ public:
 	core::matrix4 ViewLink;
 	core::vector3df LightLink;
 	f32 FarLink, MapRes;
+
+	// Only set while drawing with the tiled shadow materials.
+	bool Tiled = false;
+	f32 TileRect[4];
+};
+
+
+class MultiLightShaderCB : public video::IShaderConstantSetCallBack
+{
+public:
+	MultiLightShaderCB(EffectHandler* effectIn) : effect(effectIn) {};
+
+	virtual void OnSetConstants(video::IMaterialRendererServices* services, s32 userData)
+	{
+		IVideoDriver* driver = services->getVideoDriver();
+
+		const matrix4& world = driver->getTransform(video::ETS_WORLD);
+
+		matrix4 worldViewProj = driver->getTransform(video::ETS_PROJECTION);
+		worldViewProj *= driver->getTransform(video::ETS_VIEW);
+		worldViewProj *= world;
+		services->setVertexShaderConstant("mWorldViewProj", worldViewProj.pointer(), 16);
+
+		world.getInverse(invWorld);
+
+		f32 lightViewProj[16 * MAX_LIGHTS];
+		f32 lightPos[4 * MAX_LIGHTS];
+
+		for (u32 i = 0; i < MAX_LIGHTS; ++i)
+		{
+			matrix4 lightWorld = LightViewProj[i];
+			lightWorld *= world;
+			memcpy(lightViewProj + i * 16, lightWorld.pointer(), sizeof(f32) * 16);
+
+			vector3df lightPosOS = LightPos[i];
+			invWorld.transformVect(lightPosOS);
+			lightPos[i * 4] = lightPosOS.X;
+			lightPos[i * 4 + 1] = lightPosOS.Y;
+			lightPos[i * 4 + 2] = lightPosOS.Z;
+			lightPos[i * 4 + 3] = 1.0f;
+		}
+
+		services->setVertexShaderConstant("mLightViewProj", lightViewProj, 16 * MAX_LIGHTS);
+		services->setVertexShaderConstant("LightPos", lightPos, 4 * MAX_LIGHTS);
+
+		if (driver->getDriverType() == EDT_OPENGL)
+		{
+			s32 TexVar = 0;
+			services->setPixelShaderConstant("StaticAtlasSampler", &TexVar, 1);
+
+			TexVar = 1;
+			services->setPixelShaderConstant("DynamicAtlasSampler", &TexVar, 1);
+		}
+
+		services->setPixelShaderConstant("LightColour", reinterpret_cast<f32*>(LightColour), 4 * MAX_LIGHTS);
+		services->setPixelShaderConstant("TileRect", TileRect, 4 * MAX_LIGHTS);
+		services->setPixelShaderConstant("LightAtlas", LightAtlas, MAX_LIGHTS);
+		services->setPixelShaderConstant("LightFar", LightFar, MAX_LIGHTS);
+		services->setPixelShaderConstant("MapTexel", &MapTexel, 1);
+	}
+
+	/// Lights shaded per geometry pass, unused slots have a black colour.
+	static const u32 MAX_LIGHTS = 4;
+
+	EffectHandler* effect;
+	core::matrix4 invWorld;
+
+	core::matrix4 LightViewProj[MAX_LIGHTS]; // Atlas tile bias * projection * view
+	core::vector3df LightPos[MAX_LIGHTS];
+	video::SColorf LightColour[MAX_LIGHTS];
+	f32 TileRect[4 * MAX_LIGHTS];
+	f32 LightAtlas[MAX_LIGHTS]; // 0 for the static atlas, 1 for the dynamic one
+	f32 LightFar[MAX_LIGHTS];
+	f32 MapTexel;
 };
 
 
@@ -1,8 +1,10 @@
 #include "EffectHandler.h"
 #include "EffectCB.h"
 #include "EffectShaders.h"
+#include "FrameTimer.h"
 
 #include <string>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 
@@ -17,8 +19,13 @@ EffectHandler::EffectHandler(IrrlichtDevice* dev, const irr::core::dimension2du&
 	: device(dev), smgr(dev->getSceneManager()), driver(dev->getVideoDriver()),
 	ScreenRTTSize(screenRTTSize.getArea() == 0 ? dev->getVideoDriver()->getScreenSize() : screenRTTSize),
 	ClearColour(0x0), shadowsUnsupported(false), DepthRTT(0), DepthPass(false), depthMC(0), shadowMC(0),
-	AmbientColour(0x0), use32BitDepth(use32BitDepthBuffers), useVSM(useVSMShadows)
+	AmbientColour(0x0), use32BitDepth(use32BitDepthBuffers), useVSM(useVSMShadows), useRoundSpot(useRoundSpotLights),
+	ShadowMapSerial(0),
+	StaticAtlas(0), DynamicAtlas(0), ShadowAtlasSize(2048), StaticAtlasDirty(true), AtlasesRendered(false),
+	multiLightMC(0), MultiLightShading(true), ShadowMapsUpdated(false), PostChainDirty(true), PostFusion(true)
 {
+	memset(PostTargets, 0, sizeof(PostTargets));
+
 	bool tempTexFlagMipMaps = driver->getTextureCreationFlag(ETCF_CREATE_MIP_MAPS);
 	bool tempTexFlag32 = driver->getTextureCreationFlag(ETCF_ALWAYS_32_BIT);
 
@@ -71,29 +78,25 @@ EffectHandler::EffectHandler(IrrlichtDevice* dev, const irr::core::dimension2du&
 			sPP.ppShader(WHITE_WASH_P[shaderExt]).c_str(), "pixelMain", video::EPST_PS_2_0,
 			depthMC, video::EMT_TRANSPARENT_ALPHA_CHANNEL);
 
-		if (useRoundSpotLights)
-			sPP.addShaderDefine("ROUND_SPOTLIGHTS");
-
-		if (useVSMShadows)
-			sPP.addShaderDefine("VSM");
-
-		const u32 sampleCounts[EFT_COUNT] = { 1, 4, 8, 12, 16 };
-
 		const E_VERTEX_SHADER_TYPE vertexProfile =
 			driver->queryFeature(video::EVDF_VERTEX_SHADER_3_0) ? EVST_VS_3_0 : EVST_VS_2_0;
 
 		const E_PIXEL_SHADER_TYPE pixelProfile =
 			driver->queryFeature(video::EVDF_PIXEL_SHADER_3_0) ? EPST_PS_3_0 : EPST_PS_2_0;
 
+		// Receiver variants are compiled by getShadowMaterial and getMultiLightMaterial when a filter type
+		// is first drawn, most scenes only ever use one or two of them.
 		for (u32 i = 0; i < EFT_COUNT; i++)
 		{
-			sPP.addShaderDefine("SAMPLE_AMOUNT", core::stringc(sampleCounts[i]));
-			Shadow[i] = gpu->addHighLevelShaderMaterial(
-				sPP.ppShader(SHADOW_PASS_2V[shaderExt]).c_str(), "vertexMain", vertexProfile,
-				sPP.ppShader(SHADOW_PASS_2P[shaderExt]).c_str(), "pixelMain", pixelProfile,
-				shadowMC, video::EMT_SOLID);
+			Shadow[i] = SHADER_PENDING;
+			ShadowTiled[i] = SHADER_PENDING;
+			MultiLight[i] = SHADER_PENDING;
 		}
 
+		// Four atlas lights per pass, the sample loops need shader model 3 on Direct3D.
+		multiLightMC = new MultiLightShaderCB(this);
+		MultiLightSupported = shaderExt == ESE_GLSL || pixelProfile == EPST_PS_3_0;
+
 		// Set resolution preprocessor defines.
 		sPP.addShaderDefine("SCREENX", core::stringc(ScreenRTTSize.Width));
 		sPP.addShaderDefine("SCREENY", core::stringc(ScreenRTTSize.Height));
@@ -112,16 +115,19 @@ EffectHandler::EffectHandler(IrrlichtDevice* dev, const irr::core::dimension2du&
 			sPP.ppShader(SIMPLE_P[shaderExt]).c_str(), "pixelMain", pixelProfile, SQCB,
 			video::EMT_TRANSPARENT_ADD_COLOR);
 
-		// VSM blur.
-		VSMBlurH = gpu->addHighLevelShaderMaterial(
-			sPP.ppShader(SCREEN_QUAD_V[shaderExt]).c_str(), "vertexMain", vertexProfile,
-			sPP.ppShader(VSM_BLUR_P[shaderExt]).c_str(), "pixelMain", pixelProfile, SQCB);
+		// VSM blur, only used by VSM shadows.
+		if (useVSM)
+		{
+			VSMBlurH = gpu->addHighLevelShaderMaterial(
+				sPP.ppShader(SCREEN_QUAD_V[shaderExt]).c_str(), "vertexMain", vertexProfile,
+				sPP.ppShader(VSM_BLUR_P[shaderExt]).c_str(), "pixelMain", pixelProfile, SQCB);
 
-		sPP.addShaderDefine("VERTICAL_VSM_BLUR");
+			sPP.addShaderDefine("VERTICAL_VSM_BLUR");
 
-		VSMBlurV = gpu->addHighLevelShaderMaterial(
-			sPP.ppShader(SCREEN_QUAD_V[shaderExt]).c_str(), "vertexMain", vertexProfile,
-			sPP.ppShader(VSM_BLUR_P[shaderExt]).c_str(), "pixelMain", pixelProfile, SQCB);
+			VSMBlurV = gpu->addHighLevelShaderMaterial(
+				sPP.ppShader(SCREEN_QUAD_V[shaderExt]).c_str(), "vertexMain", vertexProfile,
+				sPP.ppShader(VSM_BLUR_P[shaderExt]).c_str(), "pixelMain", pixelProfile, SQCB);
+		}
 
 		// Drop the screen quad callback.
 		SQCB->drop();
@@ -137,7 +143,13 @@ EffectHandler::EffectHandler(IrrlichtDevice* dev, const irr::core::dimension2du&
 		Simple = EMT_SOLID;
 
 		for (u32 i = 0; i < EFT_COUNT; ++i)
+		{
 			Shadow[i] = EMT_SOLID;
+			ShadowTiled[i] = EMT_SOLID;
+			MultiLight[i] = -1;
+		}
+
+		MultiLightSupported = false;
 
 		device->getLogger()->log("XEffects: Shader effects not supported on this system.");
 		shadowsUnsupported = true;
@@ -158,6 +170,99 @@ EffectHandler::~EffectHandler()
 
 	if (DepthRTT)
 		driver->removeTexture(DepthRTT);
+
+	removePostProcessingTargets();
+
+	delete StaticAtlas;
+	delete DynamicAtlas;
+}
+
+
+irr::s32 EffectHandler::getShadowMaterial(E_FILTER_TYPE filterType, bool tiled)
+{
+	s32* variants = tiled ? ShadowTiled : Shadow;
+
+	if (variants[filterType] == SHADER_PENDING)
+	{
+		E_SHADER_EXTENSION shaderExt = (driver->getDriverType() == EDT_DIRECT3D9) ? ESE_HLSL : ESE_GLSL;
+		const s32 material = compileShadowVariant(SHADOW_PASS_2V[shaderExt], SHADOW_PASS_2P[shaderExt],
+			filterType, tiled, shadowMC);
+
+		// A failed compile is not retried every frame, the nodes fall back to plain solid rendering.
+		variants[filterType] = material < 0 ? (s32)EMT_SOLID : material;
+	}
+
+	return variants[filterType];
+}
+
+
+irr::s32 EffectHandler::getMultiLightMaterial(E_FILTER_TYPE filterType)
+{
+	if (MultiLight[filterType] == SHADER_PENDING)
+	{
+		E_SHADER_EXTENSION shaderExt = (driver->getDriverType() == EDT_DIRECT3D9) ? ESE_HLSL : ESE_GLSL;
+		MultiLight[filterType] = compileShadowVariant(MULTI_LIGHT_V[shaderExt], MULTI_LIGHT_P[shaderExt],
+			filterType, false, multiLightMC);
+
+		// Without it the atlas lights go back to one pass each.
+		if (MultiLight[filterType] < 0)
+		{
+			device->getLogger()->log("XEffects: Multi light shader failed to compile, shading lights one at a time.");
+			MultiLightSupported = false;
+		}
+	}
+
+	return MultiLight[filterType];
+}
+
+
+irr::s32 EffectHandler::compileShadowVariant(const char* vertexShader, const char* pixelShader,
+	E_FILTER_TYPE filterType, bool tiled, irr::video::IShaderConstantSetCallBack* callback)
+{
+	const u32 sampleCounts[EFT_COUNT] = { 1, 4, 8, 12, 16 };
+
+	CShaderPreprocessor sPP(driver);
+
+	if (useRoundSpot)
+		sPP.addShaderDefine("ROUND_SPOTLIGHTS");
+
+	if (useVSM)
+		sPP.addShaderDefine("VSM");
+
+	// Tiled variants sample one tile of a shadow atlas or cascade atlas.
+	if (tiled)
+		sPP.addShaderDefine("SHADOW_TILE");
+
+	sPP.addShaderDefine("SAMPLE_AMOUNT", core::stringc(sampleCounts[filterType]));
+
+	const E_VERTEX_SHADER_TYPE vertexProfile =
+		driver->queryFeature(video::EVDF_VERTEX_SHADER_3_0) ? EVST_VS_3_0 : EVST_VS_2_0;
+
+	const E_PIXEL_SHADER_TYPE pixelProfile =
+		driver->queryFeature(video::EVDF_PIXEL_SHADER_3_0) ? EPST_PS_3_0 : EPST_PS_2_0;
+
+	const s32 material = driver->getGPUProgrammingServices()->addHighLevelShaderMaterial(
+		sPP.ppShader(vertexShader).c_str(), "vertexMain", vertexProfile,
+		sPP.ppShader(pixelShader).c_str(), "pixelMain", pixelProfile,
+		callback, video::EMT_SOLID);
+
+	return material;
+}
+
+
+void EffectHandler::setShadowAtlasSize(irr::u32 size)
+{
+	if (size == ShadowAtlasSize)
+		return;
+
+	delete StaticAtlas;
+	delete DynamicAtlas;
+	StaticAtlas = 0;
+	DynamicAtlas = 0;
+
+	ShadowAtlasSize = size;
+	StaticAtlasDirty = true;
+	invalidateShadowMaps();
 }
 
 
@@ -191,6 +296,9 @@ void EffectHandler::setScreenRenderTargetResolution(const irr::core::dimension2d
 	driver->setTextureCreationFlag(ETCF_ALWAYS_32_BIT, tempTexFlag32);
 
 	ScreenRTTSize = resolution;
+
+	// Reduced targets follow the new size when next used.
+	removePostProcessingTargets();
 }
 
 
@@ -208,332 +316,1367 @@ void EffectHandler::addPostProcessingEffect(irr::s32 MaterialType, IPostProcessi
 	SPostProcessingPair pPair(MaterialType, 0);
 	pPair.renderCallback = callback;
 	PostProcessingRoutines.push_back(pPair);
+	PostChainDirty = true;
 }
 
 
-void EffectHandler::addShadowToNode(irr::scene::ISceneNode* node, E_FILTER_TYPE filterType, E_SHADOW_MODE shadowMode)
+void EffectHandler::setPostProcessingEffectScale(irr::s32 materialType, irr::u32 scale)
 {
-	SShadowNode snode = { node, shadowMode, filterType };
-	ShadowNodeArray.push_back(snode);
-}
+	scale = scale >= 4 ? 4 : (scale >= 2 ? 2 : 1);
 
-
-void EffectHandler::addNodeToDepthPass(irr::scene::ISceneNode* node)
-{
-	if (DepthPassArray.binary_search(node) == -1)
-		DepthPassArray.push_back(node);
+	for (u32 i = 0; i < PostProcessingRoutines.size(); ++i)
+	{
+		if (PostProcessingRoutines[i].materialType == materialType)
+		{
+			PostProcessingRoutines[i].scale = scale;
+			PostChainDirty = true;
+		}
+	}
 }
 
 
-void EffectHandler::removeNodeFromDepthPass(irr::scene::ISceneNode* node)
+void EffectHandler::setPostProcessingEffectInput(irr::s32 materialType, E_POST_PROCESSING_INPUT input)
 {
-	s32 i = DepthPassArray.binary_search(node);
-
-	if (i != -1)
-		DepthPassArray.erase(i);
+	for (u32 i = 0; i < PostProcessingRoutines.size(); ++i)
+	{
+		if (PostProcessingRoutines[i].materialType == materialType)
+		{
+			PostProcessingRoutines[i].input = input;
+			PostChainDirty = true;
+		}
+	}
 }
 
 
-void EffectHandler::update(irr::video::ITexture* outputTarget)
+void EffectHandler::buildPostProcessingChain()
 {
-	if (shadowsUnsupported || smgr->getActiveCamera() == 0)
-		return;
+	PostProcessingPasses.set_used(0);
 
-	if (!ShadowNodeArray.empty() && !LightList.empty())
+	const u32 PostProcessingRoutinesSize = PostProcessingRoutines.size();
+	for (u32 i = 0; i < PostProcessingRoutinesSize;)
 	{
-		driver->setRenderTarget(ScreenQuad.rt[0], true, true, AmbientColour);
-
-		ICameraSceneNode* activeCam = smgr->getActiveCamera();
-		activeCam->OnAnimate(device->getTimer()->getTime());
-		activeCam->OnRegisterSceneNode();
-		activeCam->render();
+		const SPostProcessingPair& first = PostProcessingRoutines[i];
 
-		const u32 ShadowNodeArraySize = ShadowNodeArray.size();
-		const u32 LightListSize = LightList.size();
-		for (u32 l = 0; l < LightListSize; ++l)
+		// A stage can join the pass before it when it reads that pass's output at the same resolution.
+		u32 count = 1;
+		if (PostFusion && first.stageSource.size())
 		{
-			// Set max distance constant for depth shader.
-			depthMC->FarLink = LightList[l].getFarValue();
-
-			driver->setTransform(ETS_VIEW, LightList[l].getViewMatrix());
-			driver->setTransform(ETS_PROJECTION, LightList[l].getProjectionMatrix());
+			while (i + count < PostProcessingRoutinesSize)
+			{
+				const SPostProcessingPair& next = PostProcessingRoutines[i + count];
+				if (!next.stageSource.size() || next.scale != first.scale || next.input != EPPI_PREVIOUS)
+					break;
 
-			ITexture* currentShadowMapTexture = getShadowMapTexture(LightList[l].getShadowMapResolution());
-			driver->setRenderTarget(currentShadowMapTexture, true, true, SColor(0xffffffff));
+				++count;
+			}
+		}
 
-			for (u32 i = 0; i < ShadowNodeArraySize; ++i)
-			{
-				if (ShadowNodeArray[i].shadowMode == ESM_RECEIVE || ShadowNodeArray[i].shadowMode == ESM_EXCLUDE)
-					continue;
+		SPostProcessingPass pass;
+		pass.materialType = first.materialType;
+		pass.callback = first.callback;
+		pass.first = i;
+		pass.count = count;
+		pass.scale = first.scale;
+		pass.input = first.input;
 
-				const u32 CurrentMaterialCount = ShadowNodeArray[i].node->getMaterialCount();
-				core::array<irr::s32> BufferMaterialList(CurrentMaterialCount);
-				BufferMaterialList.set_used(0);
+		if (count > 1)
+		{
+			core::stringc key;
+			for (u32 j = i; j < i + count; ++j)
+				key += core::stringc(PostProcessingRoutines[j].materialType) + ",";
 
-				for (u32 m = 0; m < CurrentMaterialCount; ++m)
+			s32 fused = -1;
+			for (u32 f = 0; f < FusedPostProcessingRoutines.size(); ++f)
+			{
+				if (FusedPostProcessingRoutines[f].stageSource == key)
 				{
-					BufferMaterialList.push_back(ShadowNodeArray[i].node->getMaterial(m).MaterialType);
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)
-						(BufferMaterialList[m] == video::EMT_TRANSPARENT_ALPHA_CHANNEL_REF ? DepthT : Depth);
+					fused = (s32)f;
+					break;
 				}
-
-				ShadowNodeArray[i].node->OnAnimate(device->getTimer()->getTime());
-				ShadowNodeArray[i].node->render();
-
-				const u32 BufferMaterialListSize = BufferMaterialList.size();
-				for (u32 m = 0; m < BufferMaterialListSize; ++m)
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)BufferMaterialList[m];
 			}
 
-			// Blur the shadow map texture if we're using VSM filtering.
-			if (useVSM)
+			if (fused == -1)
 			{
-				ITexture* currentSecondaryShadowMap = getShadowMapTexture(LightList[l].getShadowMapResolution(), true);
+				core::array<core::stringc> stages;
+				for (u32 j = i; j < i + count; ++j)
+					stages.push_back(PostProcessingRoutines[j].stageSource);
 
-				driver->setRenderTarget(currentSecondaryShadowMap, true, true, SColor(0xffffffff));
-				ScreenQuad.getMaterial().setTexture(0, currentShadowMapTexture);
-				ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)VSMBlurH;
+				SPostProcessingPair fusedPair = compileScreenQuadMaterial(buildPostStageShader(stages));
+				fusedPair.stageSource = key;
 
-				ScreenQuad.render(driver);
-
-				driver->setRenderTarget(currentShadowMapTexture, true, true, SColor(0xffffffff));
-				ScreenQuad.getMaterial().setTexture(0, currentSecondaryShadowMap);
-				ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)VSMBlurV;
-
-				ScreenQuad.render(driver);
+				fused = (s32)FusedPostProcessingRoutines.size();
+				FusedPostProcessingRoutines.push_back(fusedPair);
 			}
 
-			driver->setRenderTarget(ScreenQuad.rt[1], true, true, SColor(0xffffffff));
+			// Shaders that fail to compile leave the stages to run one by one.
+			if (FusedPostProcessingRoutines[fused].materialType >= 0)
+			{
+				pass.materialType = FusedPostProcessingRoutines[fused].materialType;
+				pass.callback = FusedPostProcessingRoutines[fused].callback;
+			}
+			else
+			{
+				pass.count = count = 1;
+			}
+		}
 
-			driver->setTransform(ETS_VIEW, activeCam->getViewMatrix());
-			driver->setTransform(ETS_PROJECTION, activeCam->getProjectionMatrix());
+		PostProcessingPasses.push_back(pass);
+		i += count;
+	}
 
-			shadowMC->LightColour = LightList[l].getLightColor();
+	PostChainDirty = false;
+}
 
-			if (!LightList[l].active)
-				shadowMC->LightColour = irr::video::SColorf(0.0,0.0,0.0,1.0);
 
-			shadowMC->LightLink = LightList[l].getPosition();
-			shadowMC->FarLink = LightList[l].getFarValue();
-			shadowMC->ViewLink = LightList[l].getViewMatrix();
-			shadowMC->ProjLink = LightList[l].getProjectionMatrix();
-			shadowMC->MapRes = (f32)LightList[l].getShadowMapResolution();
+irr::video::ITexture* EffectHandler::getPostProcessingTarget(irr::u32 scale, irr::video::ITexture* input)
+{
+	if (scale <= 1)
+		return ScreenQuad.rt[0] == input ? ScreenQuad.rt[1] : ScreenQuad.rt[0];
 
-			for (u32 i = 0; i < ShadowNodeArraySize; ++i)
-			{
-				if (ShadowNodeArray[i].shadowMode == ESM_CAST || ShadowNodeArray[i].shadowMode == ESM_EXCLUDE)
-					continue;
+	const u32 level = scale >= 4 ? 1 : 0;
+	const u32 target = PostTargets[level][0] && PostTargets[level][0] == input ? 1 : 0;
 
-				const u32 CurrentMaterialCount = ShadowNodeArray[i].node->getMaterialCount();
-				core::array<irr::s32> BufferMaterialList(CurrentMaterialCount);
-				core::array<irr::video::ITexture*> BufferTextureList(CurrentMaterialCount);
+	if (!PostTargets[level][target])
+	{
+		const dimension2du size(core::max_(ScreenRTTSize.Width / scale, 1u), core::max_(ScreenRTTSize.Height / scale, 1u));
 
-				for (u32 m = 0; m < CurrentMaterialCount; ++m)
-				{
-					BufferMaterialList.push_back(ShadowNodeArray[i].node->getMaterial(m).MaterialType);
-					BufferTextureList.push_back(ShadowNodeArray[i].node->getMaterial(m).getTexture(0));
+		PostTargets[level][target] = driver->addRenderTargetTexture(size,
+			core::stringc("XEFFECTS_POST_") + core::stringc(scale) + "_" + core::stringc(target));
+	}
 
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)Shadow[ShadowNodeArray[i].filterType];
-					ShadowNodeArray[i].node->getMaterial(m).setTexture(0, currentShadowMapTexture);
-				}
+	return PostTargets[level][target];
+}
 
-				ShadowNodeArray[i].node->OnAnimate(device->getTimer()->getTime());
-				ShadowNodeArray[i].node->render();
 
-				for (u32 m = 0; m < CurrentMaterialCount; ++m)
-				{
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)BufferMaterialList[m];
-					ShadowNodeArray[i].node->getMaterial(m).setTexture(0, BufferTextureList[m]);
-				}
-			}
+void EffectHandler::setOutputTarget(irr::video::ITexture* target, irr::video::SColor clearColour)
+{
+	driver->setRenderTarget(target, true, true, clearColour);
 
-			driver->setRenderTarget(ScreenQuad.rt[0], false, false, SColor(0x0));
-			ScreenQuad.getMaterial().setTexture(0, ScreenQuad.rt[1]);
-			ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)Simple;
+	// The screen targets may be smaller than the window, the final quad is stretched over all of it.
+	if (!target)
+		driver->setViewPort(core::rect<s32>(core::position2di(0, 0), driver->getScreenSize()));
+}
 
-			ScreenQuad.render(driver);
-		}
 
-		// Render all the excluded and casting-only nodes.
-		for (u32 i = 0; i < ShadowNodeArraySize; ++i)
+void EffectHandler::removePostProcessingTargets()
+{
+	for (u32 level = 0; level < 2; ++level)
+	{
+		for (u32 i = 0; i < 2; ++i)
 		{
-			if (ShadowNodeArray[i].shadowMode != ESM_CAST && ShadowNodeArray[i].shadowMode != ESM_EXCLUDE)
-				continue;
-
-			const u32 CurrentMaterialCount = ShadowNodeArray[i].node->getMaterialCount();
-			core::array<irr::s32> BufferMaterialList(CurrentMaterialCount);
-			BufferMaterialList.set_used(0);
-
-			for (u32 m = 0; m < CurrentMaterialCount; ++m)
-			{
-				BufferMaterialList.push_back(ShadowNodeArray[i].node->getMaterial(m).MaterialType);
+			if (PostTargets[level][i])
+				driver->removeTexture(PostTargets[level][i]);
 
-				switch (BufferMaterialList[m])
-				{
-				case EMT_TRANSPARENT_ALPHA_CHANNEL_REF:
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)WhiteWashTRef;
-					break;
-				case EMT_TRANSPARENT_ADD_COLOR:
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)WhiteWashTAdd;
-					break;
-				case EMT_TRANSPARENT_ALPHA_CHANNEL:
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)WhiteWashTAlpha;
-					break;
-				default:
-					ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)WhiteWash;
-					break;
-				}
-			}
-
-			ShadowNodeArray[i].node->OnAnimate(device->getTimer()->getTime());
-			ShadowNodeArray[i].node->render();
-
-			for (u32 m = 0; m < CurrentMaterialCount; ++m)
-				ShadowNodeArray[i].node->getMaterial(m).MaterialType = (E_MATERIAL_TYPE)BufferMaterialList[m];
+			PostTargets[level][i] = 0;
 		}
 	}
-	else
-	{
-		driver->setRenderTarget(ScreenQuad.rt[0], true, true, SColor(0xffffffff));
-	}
-
-	driver->setRenderTarget(ScreenQuad.rt[1], true, true, ClearColour);
-	smgr->drawAll();
-
-	const u32 PostProcessingRoutinesSize = PostProcessingRoutines.size();
+}
 
-	driver->setRenderTarget(PostProcessingRoutinesSize
-		? ScreenRTT : outputTarget, true, true, SColor(0x0));
 
-	ScreenQuad.getMaterial().setTexture(0, ScreenQuad.rt[1]);
-	ScreenQuad.getMaterial().setTexture(1, ScreenQuad.rt[0]);
+ShadowNodeRegistry::~ShadowNodeRegistry()
+{
+	for (u32 i = 0; i < slots.size(); ++i)
+	{
+		if (slots[i].used)
+			slots[i].entry.node->drop();
+	}
+}
 
-	ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)LightModulate;
-	ScreenQuad.render(driver);
 
-	// Perform depth pass after rendering, to ensure animations stay up to date.
-	if (DepthPass)
+ShadowNodeRegistry::Handle ShadowNodeRegistry::add(ISceneNode* node, E_SHADOW_MODE shadowMode, E_FILTER_TYPE filterType)
+{
+	core::map<ISceneNode*, u32>::Node* existing = lookup.find(node);
+	if (existing)
 	{
-		driver->setRenderTarget(DepthRTT, true, true, SColor(0xffffffff));
+		const u32 slot = existing->getValue();
+		SSlot& s = slots[slot];
 
-		// Set max distance constant for depth shader.
-		depthMC->FarLink = smgr->getActiveCamera()->getFarValue();
+		s.entry.filterType = filterType;
 
-		for (u32 i = 0; i < DepthPassArray.size(); ++i)
+		if (s.entry.shadowMode != shadowMode)
 		{
-			core::array<irr::s32> BufferMaterialList(DepthPassArray[i]->getMaterialCount());
-			BufferMaterialList.set_used(0);
-
-			for (u32 g = 0; g < DepthPassArray[i]->getMaterialCount(); ++g)
-				BufferMaterialList.push_back(DepthPassArray[i]->getMaterial(g).MaterialType);
-
-			DepthPassArray[i]->setMaterialType((E_MATERIAL_TYPE)Depth);
-			DepthPassArray[i]->OnAnimate(device->getTimer()->getTime());
-			DepthPassArray[i]->render();
-
-			for (u32 g = 0; g < DepthPassArray[i]->getMaterialCount(); ++g)
-				DepthPassArray[i]->getMaterial(g).MaterialType = (E_MATERIAL_TYPE)BufferMaterialList[g];
+			unlink(slot);
+			s.entry.shadowMode = shadowMode;
+			link(slot);
 		}
 
-		driver->setRenderTarget(0, false, false);
+		return (s.generation << 16) | slot;
 	}
 
-	if (PostProcessingRoutinesSize)
+	u32 slot;
+	if (!freeSlots.empty())
 	{
-		bool Alter = false;
-		ScreenQuad.getMaterial().setTexture(1, ScreenRTT);
-		ScreenQuad.getMaterial().setTexture(2, DepthRTT);
-		for (u32 i = 0; i < PostProcessingRoutinesSize; ++i)
-		{
-			ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)PostProcessingRoutines[i].materialType;
+		slot = freeSlots.getLast();
+		freeSlots.erase(freeSlots.size() - 1);
+	}
+	else
+	{
+		if (slots.size() >= 0xffff)
+			return INVALID_HANDLE;
 
-			Alter = !Alter;
-			ScreenQuad.getMaterial().setTexture(0, i == 0 ? ScreenRTT : ScreenQuad.rt[int(!Alter)]);
-			driver->setRenderTarget(i >= PostProcessingRoutinesSize - 1 ?
-				outputTarget : ScreenQuad.rt[int(Alter)], true, true, ClearColour);
+		slot = slots.size();
 
-			if (PostProcessingRoutines[i].renderCallback) PostProcessingRoutines[i].renderCallback->OnPreRender(this);
-			ScreenQuad.render(driver);
-			if (PostProcessingRoutines[i].renderCallback) PostProcessingRoutines[i].renderCallback->OnPostRender(this);
-		}
+		SSlot s;
+		s.generation = 0;
+		s.partitionIndex = 0;
+		s.used = false;
+		slots.push_back(s);
 	}
+
+	SSlot& s = slots[slot];
+	s.used = true;
+	s.entry.node = node;
+	s.entry.shadowMode = shadowMode;
+	s.entry.filterType = filterType;
+	s.entry.materialsChanged = true;
+
+	node->grab();
+	lookup.insert(node, slot);
+	link(slot);
+	++count;
+
+	return (s.generation << 16) | slot;
 }
 
 
-irr::video::ITexture* EffectHandler::getShadowMapTexture(const irr::u32 resolution, const bool secondary)
+bool ShadowNodeRegistry::remove(ISceneNode* node)
 {
-	// Using Irrlicht cache now.
-	core::stringc shadowMapName = core::stringc("XEFFECTS_SM_") + core::stringc(resolution);
+	core::map<ISceneNode*, u32>::Node* existing = lookup.find(node);
+	if (!existing)
+		return false;
 
-	if (secondary)
-		shadowMapName += "_2";
+	release(existing->getValue());
+	return true;
+}
 
-	ITexture* shadowMapTexture = driver->getTexture(shadowMapName);
 
-	if (shadowMapTexture == 0)
-	{
-		device->getLogger()->log("XEffects: Please ignore previous warning, it is harmless.");
+bool ShadowNodeRegistry::remove(Handle handle)
+{
+	const u32 slot = handle & 0xffff;
 
-		shadowMapTexture = driver->addRenderTargetTexture(dimension2du(resolution, resolution),
-			shadowMapName, use32BitDepth ? ECF_G32R32F : ECF_G16R16F);
-	}
+	if (handle == INVALID_HANDLE || slot >= slots.size() || !slots[slot].used
+		|| slots[slot].generation != (handle >> 16))
+		return false;
 
-	return shadowMapTexture;
+	release(slot);
+	return true;
 }
 
 
-irr::video::ITexture* EffectHandler::generateRandomVectorTexture(const irr::core::dimension2du& dimensions,
-	const irr::core::stringc& name)
+SShadowNode* ShadowNodeRegistry::find(ISceneNode* node)
 {
-	IImage* tmpImage = driver->createImage(irr::video::ECF_A8R8G8B8, dimensions);
+	core::map<ISceneNode*, u32>::Node* existing = lookup.find(node);
+	return existing ? &slots[existing->getValue()].entry : 0;
+}
 
-	srand(device->getTimer()->getRealTime());
 
-	for (u32 x = 0; x < dimensions.Width; ++x)
+const SShadowNode* ShadowNodeRegistry::find(ISceneNode* node) const
+{
+	core::map<ISceneNode*, u32>::Node* existing = lookup.find(node);
+	return existing ? &slots[existing->getValue()].entry : 0;
+}
+
+
+u32 ShadowNodeRegistry::removeDeadNodes()
+{
+	u32 removed = 0;
+
+	for (u32 mode = 0; mode < ESM_COUNT; ++mode)
 	{
-		for (u32 y = 0; y < dimensions.Height; ++y)
+		// Backwards, so the entry swapped into a removed one has already been checked.
+		for (u32 i = partitions[mode].size(); i > 0; --i)
 		{
-			vector3df randVec;
-
-			// Reject vectors outside the unit sphere to get a uniform distribution.
-			do { randVec = vector3df((f32)rand() / (f32)RAND_MAX, (f32)rand() / (f32)RAND_MAX, (f32)rand() / (f32)RAND_MAX); } while (randVec.getLengthSQ() > 1.0f);
+			const u32 slot = partitions[mode][i - 1];
 
-			const SColorf randCol(randVec.X, randVec.Y, randVec.Z);
-			tmpImage->setPixel(x, y, randCol.toSColor());
+			if (slots[slot].entry.node->getReferenceCount() == 1)
+			{
+				release(slot);
+				++removed;
+			}
 		}
 	}
 
-	ITexture* randTexture = driver->addTexture(name, tmpImage);
+	return removed;
+}
 
-	tmpImage->drop();
 
-	return randTexture;
+void ShadowNodeRegistry::link(u32 slot)
+{
+	core::array<u32>& partition = partitions[slots[slot].entry.shadowMode];
+
+	slots[slot].partitionIndex = partition.size();
+	partition.push_back(slot);
 }
 
 
-EffectHandler::SPostProcessingPair EffectHandler::obtainScreenQuadMaterialFromFile(const irr::core::stringc& filename,
-	irr::video::E_MATERIAL_TYPE baseMaterial)
+void ShadowNodeRegistry::unlink(u32 slot)
 {
-	CShaderPreprocessor sPP(driver);
+	core::array<u32>& partition = partitions[slots[slot].entry.shadowMode];
+	const u32 index = slots[slot].partitionIndex;
+	const u32 last = partition.getLast();
 
-	sPP.addShaderDefine("SCREENX", core::stringc(ScreenRTTSize.Width));
-	sPP.addShaderDefine("SCREENY", core::stringc(ScreenRTTSize.Height));
+	partition[index] = last;
+	slots[last].partitionIndex = index;
+	partition.erase(partition.size() - 1);
+}
 
-	video::E_VERTEX_SHADER_TYPE VertexLevel = driver->queryFeature(video::EVDF_VERTEX_SHADER_3_0) ? EVST_VS_3_0 : EVST_VS_2_0;
-	video::E_PIXEL_SHADER_TYPE PixelLevel = driver->queryFeature(video::EVDF_PIXEL_SHADER_3_0) ? EPST_PS_3_0 : EPST_PS_2_0;
 
-	E_SHADER_EXTENSION shaderExt = (driver->getDriverType() == EDT_DIRECT3D9) ? ESE_HLSL : ESE_GLSL;
+void ShadowNodeRegistry::release(u32 slot)
+{
+	SSlot& s = slots[slot];
+
+	unlink(slot);
+	lookup.remove(s.entry.node);
+	s.entry.node->drop();
+
+	// Keep the arrays' memory for the next entry in this slot.
+	s.entry.node = 0;
+	s.entry.depthMaterials.set_used(0);
+	s.entry.receiveMaterials.set_used(0);
+	s.entry.whiteWashMaterials.set_used(0);
+
+	s.used = false;
+	s.generation = (s.generation + 1) & 0xffff;
+	freeSlots.push_back(slot);
+	--count;
+}
 
-	video::IGPUProgrammingServices* gpu = driver->getGPUProgrammingServices();
 
-	const stringc shaderString = sPP.ppShaderFF(filename.c_str());
+ShadowNodeRegistry::Handle EffectHandler::addShadowToNode(irr::scene::ISceneNode* node, E_FILTER_TYPE filterType,
+	E_SHADOW_MODE shadowMode)
+{
+	if (!node)
+		return ShadowNodeRegistry::INVALID_HANDLE;
 
-	ScreenQuadCB* SQCB = new ScreenQuadCB(this, true);
+	const ShadowNodeRegistry::Handle handle = ShadowNodes.add(node, shadowMode, filterType);
 
-	s32 PostMat = gpu->addHighLevelShaderMaterial(
-		sPP.ppShader(SCREEN_QUAD_V[shaderExt]).c_str(), "vertexMain", VertexLevel,
-		shaderString.c_str(), "pixelMain", PixelLevel,
-		SQCB, baseMaterial);
+	SShadowNode* shadowNode = ShadowNodes.find(node);
+	if (shadowNode)
+		buildShadowNodeMaterials(*shadowNode);
+
+	return handle;
+}
+
+
+void EffectHandler::addNodeToDepthPass(irr::scene::ISceneNode* node)
+{
+	if (DepthPassArray.binary_search(node) == -1)
+		DepthPassArray.push_back(node);
+}
+
+
+void EffectHandler::removeNodeFromDepthPass(irr::scene::ISceneNode* node)
+{
+	s32 i = DepthPassArray.binary_search(node);
+
+	if (i != -1)
+		DepthPassArray.erase(i);
+}
+
+
+void EffectHandler::renderCasters(const SShadowCascade* cascade)
+{
+	const E_SHADOW_MODE casterModes[] = { ESM_CAST, ESM_BOTH };
+
+	for (u32 p = 0; p < 2; ++p)
+	{
+		const core::array<u32>& partition = ShadowNodes.getPartition(casterModes[p]);
+		for (u32 i = 0; i < partition.size(); ++i)
+		{
+			SShadowNode& shadowNode = ShadowNodes.getEntry(partition[i]);
+
+			// Each cascade only draws the casters overlapping its own light space box.
+			if (cascade)
+			{
+				core::aabbox3df box = shadowNode.node->getTransformedBoundingBox();
+				cascade->viewMat.transformBoxEx(box);
+
+				const f32 r = cascade->radius;
+				if (box.MinEdge.X > r || box.MaxEdge.X < -r || box.MinEdge.Y > r || box.MaxEdge.Y < -r)
+					continue;
+			}
+
+			drawShadowNode(shadowNode, shadowNode.depthMaterials);
+		}
+	}
+}
+
+
+void EffectHandler::buildShadowNodeMaterials(SShadowNode& shadowNode)
+{
+	ISceneNode* node = shadowNode.node;
+	const u32 materialCount = node->getMaterialCount();
+
+	shadowNode.materialsChanged = false;
+	shadowNode.depthMaterials.set_used(materialCount);
+	shadowNode.receiveMaterials.set_used(materialCount);
+	shadowNode.whiteWashMaterials.set_used(materialCount);
+
+	for (u32 m = 0; m < materialCount; ++m)
+	{
+		const SMaterial& source = node->getMaterial(m);
+
+		shadowNode.depthMaterials[m] = source;
+		shadowNode.depthMaterials[m].MaterialType = (E_MATERIAL_TYPE)
+			(source.MaterialType == video::EMT_TRANSPARENT_ALPHA_CHANNEL_REF ? DepthT : Depth);
+
+		// Shader and shadow map are filled in by each receiver pass.
+		shadowNode.receiveMaterials[m] = source;
+
+		shadowNode.whiteWashMaterials[m] = source;
+		switch (source.MaterialType)
+		{
+		case EMT_TRANSPARENT_ALPHA_CHANNEL_REF:
+			shadowNode.whiteWashMaterials[m].MaterialType = (E_MATERIAL_TYPE)WhiteWashTRef;
+			break;
+		case EMT_TRANSPARENT_ADD_COLOR:
+			shadowNode.whiteWashMaterials[m].MaterialType = (E_MATERIAL_TYPE)WhiteWashTAdd;
+			break;
+		case EMT_TRANSPARENT_ALPHA_CHANNEL:
+			shadowNode.whiteWashMaterials[m].MaterialType = (E_MATERIAL_TYPE)WhiteWashTAlpha;
+			break;
+		default:
+			shadowNode.whiteWashMaterials[m].MaterialType = (E_MATERIAL_TYPE)WhiteWash;
+			break;
+		}
+	}
+}
+
+
+void EffectHandler::syncShadowNodes()
+{
+	const u32 time = device->getTimer()->getTime();
+
+	ShadowNodes.removeDeadNodes();
+
+	for (u32 mode = 0; mode < ESM_COUNT; ++mode)
+	{
+		const core::array<u32>& partition = ShadowNodes.getPartition((E_SHADOW_MODE)mode);
+		for (u32 i = 0; i < partition.size(); ++i)
+		{
+			SShadowNode& shadowNode = ShadowNodes.getEntry(partition[i]);
+			shadowNode.node->OnAnimate(time);
+
+			// Comparing every material each frame costs more than the passes save, changes are flagged instead.
+			if (shadowNode.materialsChanged || shadowNode.depthMaterials.size() != shadowNode.node->getMaterialCount())
+				buildShadowNodeMaterials(shadowNode);
+		}
+	}
+}
+
+
+void EffectHandler::drawShadowNode(SShadowNode& shadowNode, core::array<SMaterial>& materials)
+{
+	ISceneNode* node = shadowNode.node;
+
+	if (node->getType() == ESNT_MESH || node->getType() == ESNT_ANIMATED_MESH)
+	{
+		IMesh* mesh = 0;
+		if (node->getType() == ESNT_MESH)
+		{
+			mesh = static_cast<IMeshSceneNode*>(node)->getMesh();
+		}
+		else
+		{
+			// The same frame the node's own render would draw, OnAnimate already advanced it.
+			IAnimatedMeshSceneNode* animated = static_cast<IAnimatedMeshSceneNode*>(node);
+			if (animated->getMesh())
+				mesh = animated->getMesh()->getMesh((s32)animated->getFrameNr(), 255,
+					animated->getStartFrame(), animated->getEndFrame());
+		}
+
+		if (!mesh)
+			return;
+
+		driver->setTransform(ETS_WORLD, node->getAbsoluteTransformation());
+
+		const u32 bufferCount = core::min_(mesh->getMeshBufferCount(), materials.size());
+		for (u32 b = 0; b < bufferCount; ++b)
+		{
+			driver->setMaterial(materials[b]);
+			driver->drawMeshBuffer(mesh->getMeshBuffer(b));
+		}
+
+		return;
+	}
+
+	// Other node types build their geometry in render, so the set is swapped in around it.
+	const u32 materialCount = core::min_(node->getMaterialCount(), materials.size());
+
+	MaterialScratch.set_used(materialCount);
+	for (u32 m = 0; m < materialCount; ++m)
+	{
+		MaterialScratch[m] = node->getMaterial(m);
+		node->getMaterial(m) = materials[m];
+	}
+
+	node->render();
+
+	for (u32 m = 0; m < materialCount; ++m)
+		node->getMaterial(m) = MaterialScratch[m];
+}
+
+
+void EffectHandler::fitCascades(SShadowLight& light, ICameraSceneNode* camera, u32 tileResolution)
+{
+	const u32 count = light.getCascadeCount();
+	const f32 lambda = light.getCascadeSplitLambda();
+
+	const f32 nearValue = core::max_(camera->getNearValue(), 0.01f);
+	f32 farValue = camera->getFarValue();
+	if (light.shadowDistance > 0.0f)
+		farValue = core::min_(farValue, light.shadowDistance);
+	farValue = core::max_(farValue, nearValue + 1.0f);
+
+	// Practical split scheme, blending logarithmic and uniform splits.
+	f32 splits[5];
+	splits[0] = nearValue;
+	for (u32 c = 1; c <= count; ++c)
+	{
+		const f32 t = (f32)c / (f32)count;
+		const f32 logSplit = nearValue * powf(farValue / nearValue, t);
+		const f32 uniformSplit = nearValue + (farValue - nearValue) * t;
+		splits[c] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+	}
+
+	const vector3df camPos = camera->getAbsolutePosition();
+	const vector3df forward = (camera->getTarget() - camPos).normalize();
+	const vector3df right = camera->getUpVector().crossProduct(forward).normalize();
+	const vector3df up = forward.crossProduct(right);
+
+	const f32 tanY = tanf(camera->getFOV() * 0.5f);
+	const f32 tanX = tanY * camera->getAspectRatio();
+
+	const vector3df lightDir = (light.getTarget() - light.getPosition()).normalize();
+	const vector3df lightUp = fabsf(lightDir.Y) > 0.99f ? vector3df(0.0f, 0.0f, 1.0f) : vector3df(0.0f, 1.0f, 0.0f);
+
+	matrix4 lightRotation;
+	lightRotation.buildCameraLookAtMatrixLH(vector3df(0.0f), lightDir, lightUp);
+
+	for (u32 c = 0; c < count; ++c)
+	{
+		SShadowCascade& cascade = light.cascades[c];
+
+		vector3df corners[8];
+		for (u32 k = 0; k < 2; ++k)
+		{
+			const f32 d = splits[c + k];
+			const vector3df center = camPos + forward * d;
+			const vector3df x = right * (d * tanX);
+			const vector3df y = up * (d * tanY);
+
+			corners[k * 4 + 0] = center - x - y;
+			corners[k * 4 + 1] = center + x - y;
+			corners[k * 4 + 2] = center - x + y;
+			corners[k * 4 + 3] = center + x + y;
+		}
+
+		// A bounding sphere keeps the cascade size constant while the camera turns.
+		vector3df sphereCenter;
+		for (u32 k = 0; k < 8; ++k)
+			sphereCenter += corners[k];
+		sphereCenter /= 8.0f;
+
+		f32 radius = 0.0f;
+		for (u32 k = 0; k < 8; ++k)
+			radius = core::max_(radius, corners[k].getDistanceFrom(sphereCenter));
+		radius = ceilf(radius * 16.0f) / 16.0f;
+
+		// Snap the center to whole shadow map texels so static shadows do not shimmer.
+		vector3df centerLS = sphereCenter;
+		lightRotation.transformVect(centerLS);
+
+		const f32 texel = 2.0f * radius / (f32)tileResolution;
+		centerLS.X = floorf(centerLS.X / texel) * texel;
+		centerLS.Y = floorf(centerLS.Y / texel) * texel;
+
+		matrix4 offset;
+		offset.setTranslation(vector3df(-centerLS.X, -centerLS.Y, 0.0f));
+		cascade.viewMat = offset * lightRotation;
+		cascade.projMat.buildProjectionMatrixOrthoLH(2.0f * radius, 2.0f * radius,
+			centerLS.Z - radius - light.casterRange, centerLS.Z + radius);
+		cascade.radius = radius;
+
+		// 2x2 atlas, one tile per cascade.
+		const s32 tileX = (s32)((c % 2) * tileResolution);
+		const s32 tileY = (s32)((c / 2) * tileResolution);
+		cascade.tile.set(core::rect<s32>(tileX, tileY, tileX + tileResolution, tileY + tileResolution),
+			dimension2du(tileResolution * 2, tileResolution * 2), driver->getDriverType() == EDT_OPENGL);
+	}
+}
+
+
+u32 EffectHandler::getImportanceResolution(const SShadowLight& light, ICameraSceneNode* camera) const
+{
+	if (!camera)
+		return light.getShadowMapResolution();
+
+	// Bounding sphere of the light's volume against the camera's vertical field of view.
+	const vector3df lightDir = (light.getTarget() - light.getPosition()).normalize();
+	const f32 radius = light.getFarValue() * 0.5f;
+	const vector3df center = light.getPosition() + lightDir * radius;
+
+	const f32 distance = core::max_(camera->getAbsolutePosition().getDistanceFrom(center) - radius,
+		camera->getNearValue());
+	const f32 coverage = core::clamp(radius / (distance * tanf(camera->getFOV() * 0.5f)), 0.0f, 1.0f);
+
+	return (u32)(coverage * light.getShadowMapResolution());
+}
+
+
+void EffectHandler::blurShadowMap(ITexture* shadowMap)
+{
+	if (!useVSM)
+		return;
+
+	ITexture* secondaryShadowMap = getShadowMapTexture(shadowMap->getSize().Width, true);
+
+	driver->setRenderTarget(secondaryShadowMap, true, true, SColor(0xffffffff));
+	ScreenQuad.getMaterial().setTexture(0, shadowMap);
+	ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)VSMBlurH;
+
+	ScreenQuad.render(driver);
+
+	driver->setRenderTarget(shadowMap, true, true, SColor(0xffffffff));
+	ScreenQuad.getMaterial().setTexture(0, secondaryShadowMap);
+	ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)VSMBlurV;
+
+	ScreenQuad.render(driver);
+}
+
+
+void EffectHandler::renderAtlasTile(SShadowLight& light)
+{
+	ScopedPhase phase("Shadow atlas tile");
+
+	depthMC->FarLink = light.getFarValue();
+
+	driver->setViewPort(light.atlasTile.viewPort);
+	driver->setTransform(ETS_VIEW, light.getViewMatrix());
+	driver->setTransform(ETS_PROJECTION, light.getProjectionMatrix());
+
+	renderCasters();
+}
+
+
+void EffectHandler::renderAtlases()
+{
+	AtlasesRendered = true;
+
+	const u32 LightListSize = LightList.size();
+
+	if (ShadowAtlasSize == 0)
+	{
+		for (u32 l = 0; l < LightListSize; ++l)
+			LightList[l].atlasTile.valid = false;
+
+		return;
+	}
+
+	const ECOLOR_FORMAT format = use32BitDepth ? ECF_G32R32F : ECF_G16R16F;
+
+	if (!StaticAtlas)
+		StaticAtlas = new ShadowAtlas(driver, "XEFFECTS_ATLAS_STATIC", ShadowAtlasSize, format);
+
+	if (!DynamicAtlas)
+		DynamicAtlas = new ShadowAtlas(driver, "XEFFECTS_ATLAS_DYNAMIC", ShadowAtlasSize, format);
+
+	// Lights are packed largest tile first, which the atlas requires.
+	core::array<core::vector2d<u32> > staticOrder;
+	core::array<core::vector2d<u32> > dynamicOrder;
+
+	for (u32 l = 0; l < LightListSize; ++l)
+	{
+		SShadowLight& light = LightList[l];
+
+		if (light.getDirectional())
+		{
+			light.atlasTile.valid = false;
+			continue;
+		}
+
+		if (light.staticShadow)
+		{
+			if (!light.baked || light.bakedViewMat != light.getViewMatrix() || light.bakedProjMat != light.getProjectionMatrix())
+				StaticAtlasDirty = true;
+
+			staticOrder.push_back(core::vector2d<u32>(light.getShadowMapResolution(), l));
+		}
+		else
+		{
+			light.baked = false;
+			dynamicOrder.push_back(core::vector2d<u32>(getImportanceResolution(light, smgr->getActiveCamera()), l));
+		}
+	}
+
+	// The static atlas is only rebuilt when one of its lights changes.
+	if (StaticAtlasDirty && StaticAtlas->getTexture())
+	{
+		StaticAtlasDirty = false;
+
+		staticOrder.sort();
+		StaticAtlas->reset();
+		driver->setRenderTarget(StaticAtlas->getTexture(), true, true, SColor(0xffffffff));
+
+		for (u32 i = staticOrder.size(); i > 0; --i)
+		{
+			SShadowLight& light = LightList[staticOrder[i - 1].Y];
+
+			light.baked = true;
+			light.bakedViewMat = light.getViewMatrix();
+			light.bakedProjMat = light.getProjectionMatrix();
+
+			if (StaticAtlas->allocate(staticOrder[i - 1].X, light.atlasTile))
+				renderAtlasTile(light);
+		}
+
+		driver->setViewPort(core::rect<s32>(0, 0, StaticAtlas->getSize(), StaticAtlas->getSize()));
+		blurShadowMap(StaticAtlas->getTexture());
+	}
+
+	if (!dynamicOrder.empty() && DynamicAtlas->getTexture())
+	{
+		dynamicOrder.sort();
+		DynamicAtlas->reset();
+		driver->setRenderTarget(DynamicAtlas->getTexture(), true, true, SColor(0xffffffff));
+
+		for (u32 i = dynamicOrder.size(); i > 0; --i)
+		{
+			SShadowLight& light = LightList[dynamicOrder[i - 1].Y];
+
+			// Shrink the tile rather than fall back while the atlas still has room.
+			u32 tileSize = dynamicOrder[i - 1].X;
+			while (!DynamicAtlas->allocate(tileSize, light.atlasTile) && tileSize > DynamicAtlas->getMinTileSize())
+				tileSize /= 2;
+
+			if (light.atlasTile.valid)
+				renderAtlasTile(light);
+		}
+
+		driver->setViewPort(core::rect<s32>(0, 0, DynamicAtlas->getSize(), DynamicAtlas->getSize()));
+		blurShadowMap(DynamicAtlas->getTexture());
+	}
+
+	for (u32 l = 0; l < LightListSize; ++l)
+	{
+		if (LightList[l].atlasTile.valid)
+			LightShadowMaps[l] = LightList[l].staticShadow ? StaticAtlas->getTexture() : DynamicAtlas->getTexture();
+	}
+}
+
+
+void EffectHandler::renderShadowMaps()
+{
+	const u32 LightListSize = LightList.size();
+
+	while (LightShadowMaps.size() < LightListSize)
+		LightShadowMaps.push_back(0);
+
+	// Spot and point lights share the atlases, the rest get their own shadow maps below.
+	if (!AtlasesRendered)
+		renderAtlases();
+
+	for (u32 l = 0; l < LightListSize; ++l)
+	{
+		// Already rendered this frame by an earlier view, or for this view when cascaded.
+		if (LightShadowMaps[l])
+			continue;
+
+		ScopedPhase phase("Shadow pass", (int)l);
+
+		// Set max distance constant for depth shader.
+		depthMC->FarLink = LightList[l].getFarValue();
+
+		ITexture* currentShadowMapTexture = getShadowMapTexture(LightList[l].getShadowMapResolution(), false, l);
+		driver->setRenderTarget(currentShadowMapTexture, true, true, SColor(0xffffffff));
+
+		// Cascades are fit to the view being drawn, update clears them again once the view is done.
+		if (LightList[l].isCascaded())
+		{
+			const u32 tileResolution = LightList[l].getShadowMapResolution() / 2;
+			fitCascades(LightList[l], smgr->getActiveCamera(), tileResolution);
+
+			for (u32 c = 0; c < LightList[l].getCascadeCount(); ++c)
+			{
+				const SShadowCascade& cascade = LightList[l].cascades[c];
+
+				driver->setViewPort(cascade.tile.viewPort);
+				driver->setTransform(ETS_VIEW, cascade.viewMat);
+				driver->setTransform(ETS_PROJECTION, cascade.projMat);
+
+				renderCasters(&cascade);
+			}
+
+			driver->setViewPort(core::rect<s32>(0, 0, currentShadowMapTexture->getSize().Width,
+				currentShadowMapTexture->getSize().Height));
+		}
+		else
+		{
+			driver->setTransform(ETS_VIEW, LightList[l].getViewMatrix());
+			driver->setTransform(ETS_PROJECTION, LightList[l].getProjectionMatrix());
+
+			renderCasters();
+		}
+
+		// Blur the shadow map texture if we're using VSM filtering.
+		blurShadowMap(currentShadowMapTexture);
+
+		LightShadowMaps[l] = currentShadowMapTexture;
+	}
+}
+
+
+bool EffectHandler::renderMultiLightPass(ICameraSceneNode* camera)
+{
+	const u32 LightListSize = LightList.size();
+
+	MultiLightShaded.set_used(LightListSize);
+	for (u32 l = 0; l < LightListSize; ++l)
+		MultiLightShaded[l] = false;
+
+	if (!MultiLightShading || !MultiLightSupported || !StaticAtlas || !DynamicAtlas)
+		return false;
+
+	matrix4 viewProj = camera->getProjectionMatrix();
+	viewProj *= camera->getViewMatrix();
+	LightBins.begin(viewProj);
+
+	// Bin the volume of every atlas light, indexed by its bit in the tile masks.
+	u32 binned[LightGrid::MAX_LIGHTS];
+	vector3df centers[LightGrid::MAX_LIGHTS];
+	f32 radii[LightGrid::MAX_LIGHTS];
+	u32 binnedCount = 0;
+	bool shadedAny = false;
+
+	for (u32 l = 0; l < LightListSize && binnedCount < LightGrid::MAX_LIGHTS; ++l)
+	{
+		SShadowLight& light = LightList[l];
+		if (!light.atlasTile.valid)
+			continue;
+
+		// Inactive lights add nothing, they only need to be kept out of the per light passes.
+		MultiLightShaded[l] = true;
+		shadedAny = true;
+
+		if (!light.active)
+			continue;
+
+		const vector3df lightDir = (light.getTarget() - light.getPosition()).normalize();
+		radii[binnedCount] = light.getFarValue() * 0.5f;
+		centers[binnedCount] = light.getPosition() + lightDir * radii[binnedCount];
+		binned[binnedCount] = l;
+
+		LightBins.addLight(binnedCount, centers[binnedCount], radii[binnedCount]);
+		++binnedCount;
+	}
+
+	if (!shadedAny)
+		return false;
+
+	multiLightMC->MapTexel = 1.0f / (f32)ShadowAtlasSize;
+
+	const E_SHADOW_MODE receiverModes[] = { ESM_RECEIVE, ESM_BOTH };
+
+	// Every pass shades up to four lights per receiver, nodes reached by more keep their closest ones,
+	// relative to light size, for the first pass and the rest for the passes after it.
+	MultiLightMasks.set_used(0);
+	bool lightsLeft = true;
+
+	for (u32 pass = 0; lightsLeft; ++pass)
+	{
+		lightsLeft = false;
+
+		driver->setRenderTarget(ScreenQuad.rt[1], true, true, SColor(0xffffffff));
+		driver->setTransform(ETS_VIEW, camera->getViewMatrix());
+		driver->setTransform(ETS_PROJECTION, camera->getProjectionMatrix());
+
+		u32 receiver = 0;
+
+		for (u32 p = 0; p < 2; ++p)
+		{
+			const core::array<u32>& partition = ShadowNodes.getPartition(receiverModes[p]);
+			for (u32 i = 0; i < partition.size(); ++i)
+			{
+				SShadowNode& shadowNode = ShadowNodes.getEntry(partition[i]);
+				ISceneNode* node = shadowNode.node;
+				if (!node->isVisible())
+					continue;
+
+				const s32 material = getMultiLightMaterial(shadowNode.filterType);
+				if (material < 0)
+				{
+					// Only a first pass can fail, later ones reuse the variants it compiled.
+					for (u32 l = 0; l < LightListSize; ++l)
+						MultiLightShaded[l] = false;
+
+					return false;
+				}
+
+				const aabbox3df box = node->getTransformedBoundingBox();
+				if (pass == 0)
+					MultiLightMasks.push_back(LightBins.getLightMask(box));
+
+				// Receivers with nothing left still draw, unlit, so the cleared target does not show through.
+				u32& mask = MultiLightMasks[receiver++];
+
+				for (u32 slot = 0; slot < MultiLightShaderCB::MAX_LIGHTS; ++slot)
+				{
+					s32 best = -1;
+					f32 bestScore = 0.0f;
+
+					for (u32 b = 0; b < binnedCount; ++b)
+					{
+						if (!(mask & (1u << b)))
+							continue;
+
+						const f32 score = box.getCenter().getDistanceFrom(centers[b]) / radii[b];
+						if (best < 0 || score < bestScore)
+						{
+							best = (s32)b;
+							bestScore = score;
+						}
+					}
+
+					if (best < 0)
+					{
+						multiLightMC->LightColour[slot] = SColorf(0.0f, 0.0f, 0.0f, 0.0f);
+						multiLightMC->LightFar[slot] = 1.0f;
+						multiLightMC->LightAtlas[slot] = 0.0f;
+						multiLightMC->LightViewProj[slot].makeIdentity();
+						memset(multiLightMC->TileRect + slot * 4, 0, sizeof(f32) * 4);
+						continue;
+					}
+
+					mask &= ~(1u << best);
+
+					SShadowLight& light = LightList[binned[best]];
+
+					multiLightMC->LightViewProj[slot] = light.atlasTile.bias * light.getProjectionMatrix();
+					multiLightMC->LightViewProj[slot] *= light.getViewMatrix();
+					multiLightMC->LightPos[slot] = light.getPosition();
+					multiLightMC->LightColour[slot] = light.getLightColor();
+					multiLightMC->LightFar[slot] = light.getFarValue();
+					multiLightMC->LightAtlas[slot] = light.staticShadow ? 0.0f : 1.0f;
+					memcpy(multiLightMC->TileRect + slot * 4, light.atlasTile.tileRect, sizeof(f32) * 4);
+				}
+
+				if (mask)
+					lightsLeft = true;
+
+				core::array<SMaterial>& materials = shadowNode.receiveMaterials;
+				for (u32 m = 0; m < materials.size(); ++m)
+				{
+					materials[m].MaterialType = (E_MATERIAL_TYPE)material;
+					materials[m].setTexture(0, StaticAtlas->getTexture());
+					materials[m].setTexture(1, DynamicAtlas->getTexture());
+				}
+
+				drawShadowNode(shadowNode, materials);
+			}
+		}
+
+		driver->setRenderTarget(ScreenQuad.rt[0], false, false, SColor(0x0));
+		ScreenQuad.getMaterial().setTexture(0, ScreenQuad.rt[1]);
+		ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)Simple;
+
+		ScreenQuad.render(driver);
+	}
+
+	return true;
+}
+
+
+void EffectHandler::renderReceivers(ITexture* shadowMap, bool tiled)
+{
+	const E_SHADOW_MODE receiverModes[] = { ESM_RECEIVE, ESM_BOTH };
+
+	for (u32 p = 0; p < 2; ++p)
+	{
+		const core::array<u32>& partition = ShadowNodes.getPartition(receiverModes[p]);
+		for (u32 i = 0; i < partition.size(); ++i)
+		{
+			SShadowNode& shadowNode = ShadowNodes.getEntry(partition[i]);
+			if (!shadowNode.node->isVisible())
+				continue;
+
+			const E_MATERIAL_TYPE shadowMaterial = (E_MATERIAL_TYPE)getShadowMaterial(shadowNode.filterType, tiled);
+
+			core::array<SMaterial>& materials = shadowNode.receiveMaterials;
+			for (u32 m = 0; m < materials.size(); ++m)
+			{
+				materials[m].MaterialType = shadowMaterial;
+				materials[m].setTexture(0, shadowMap);
+			}
+
+			drawShadowNode(shadowNode, materials);
+		}
+	}
+}
+
+
+void EffectHandler::updateShadowMaps()
+{
+	if (shadowsUnsupported || ShadowMapsUpdated || smgr->getActiveCamera() == 0 || ShadowNodes.empty() || LightList.empty())
+		return;
+
+	ShadowMapsUpdated = true;
+
+	syncShadowNodes();
+
+	// Light space passes do not depend on the view, they only run once per invalidateShadowMaps.
+	renderShadowMaps();
+}
+
+
+void EffectHandler::update(irr::video::ITexture* outputTarget)
+{
+	if (shadowsUnsupported || smgr->getActiveCamera() == 0)
+		return;
+
+	if (!ShadowNodes.empty() && !LightList.empty())
+	{
+		updateShadowMaps();
+		ShadowMapsUpdated = false;
+
+		driver->setRenderTarget(ScreenQuad.rt[0], true, true, AmbientColour);
+
+		ICameraSceneNode* activeCam = smgr->getActiveCamera();
+		activeCam->OnAnimate(device->getTimer()->getTime());
+		activeCam->OnRegisterSceneNode();
+		activeCam->render();
+
+		// Atlas lights share one receiver pass, the rest are accumulated one light at a time.
+		const bool multiLightPass = renderMultiLightPass(activeCam);
+
+		const u32 LightListSize = LightList.size();
+		for (u32 l = 0; l < LightListSize; ++l)
+		{
+			if (multiLightPass && MultiLightShaded[l])
+				continue;
+
+			ITexture* currentShadowMapTexture = LightShadowMaps[l];
+
+			driver->setRenderTarget(ScreenQuad.rt[1], true, true, SColor(0xffffffff));
+
+			driver->setTransform(ETS_VIEW, activeCam->getViewMatrix());
+			driver->setTransform(ETS_PROJECTION, activeCam->getProjectionMatrix());
+
+			shadowMC->LightColour = LightList[l].getLightColor();
+
+			if (!LightList[l].active)
+				shadowMC->LightColour = irr::video::SColorf(0.0,0.0,0.0,1.0);
+
+			shadowMC->LightLink = LightList[l].getPosition();
+			shadowMC->FarLink = LightList[l].getFarValue();
+			shadowMC->MapRes = (f32)LightList[l].getShadowMapResolution();
+
+			if (LightList[l].isCascaded())
+			{
+				// Far cascades first, nearer ones overwrite the part of the view their tile covers.
+				shadowMC->Tiled = true;
+
+				for (u32 c = LightList[l].getCascadeCount(); c > 0; --c)
+				{
+					const SShadowCascade& cascade = LightList[l].cascades[c - 1];
+
+					shadowMC->ViewLink = cascade.viewMat;
+					shadowMC->ProjLink = cascade.tile.bias * cascade.projMat;
+					memcpy(shadowMC->TileRect, cascade.tile.tileRect, sizeof(cascade.tile.tileRect));
+
+					renderReceivers(currentShadowMapTexture, true);
+				}
+
+				shadowMC->Tiled = false;
+			}
+			else if (LightList[l].atlasTile.valid)
+			{
+				const SShadowTile& tile = LightList[l].atlasTile;
+
+				shadowMC->Tiled = true;
+				shadowMC->ViewLink = LightList[l].getViewMatrix();
+				shadowMC->ProjLink = tile.bias * LightList[l].getProjectionMatrix();
+				shadowMC->MapRes = (f32)currentShadowMapTexture->getSize().Width;
+				memcpy(shadowMC->TileRect, tile.tileRect, sizeof(tile.tileRect));
+
+				renderReceivers(currentShadowMapTexture, true);
+
+				shadowMC->Tiled = false;
+			}
+			else
+			{
+				shadowMC->ViewLink = LightList[l].getViewMatrix();
+				shadowMC->ProjLink = LightList[l].getProjectionMatrix();
+
+				renderReceivers(currentShadowMapTexture, false);
+			}
+
+			driver->setRenderTarget(ScreenQuad.rt[0], false, false, SColor(0x0));
+			ScreenQuad.getMaterial().setTexture(0, ScreenQuad.rt[1]);
+			ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)Simple;
+
+			ScreenQuad.render(driver);
+		}
+
+		// Cascaded lights depend on the view, every view fits and renders its own.
+		for (u32 l = 0; l < LightListSize; ++l)
+		{
+			if (LightList[l].isCascaded())
+				LightShadowMaps[l] = 0;
+		}
+
+		// Render all the excluded and casting-only nodes.
+		const E_SHADOW_MODE whiteWashModes[] = { ESM_CAST, ESM_EXCLUDE };
+
+		for (u32 p = 0; p < 2; ++p)
+		{
+			const core::array<u32>& partition = ShadowNodes.getPartition(whiteWashModes[p]);
+			for (u32 i = 0; i < partition.size(); ++i)
+			{
+				SShadowNode& shadowNode = ShadowNodes.getEntry(partition[i]);
+				if (shadowNode.node->isVisible())
+					drawShadowNode(shadowNode, shadowNode.whiteWashMaterials);
+			}
+		}
+	}
+	else
+	{
+		driver->setRenderTarget(ScreenQuad.rt[0], true, true, SColor(0xffffffff));
+	}
+
+	driver->setRenderTarget(ScreenQuad.rt[1], true, true, ClearColour);
+	smgr->drawAll();
+
+	const u32 PostProcessingRoutinesSize = PostProcessingRoutines.size();
+
+	setOutputTarget(PostProcessingRoutinesSize ? ScreenRTT : outputTarget, SColor(0x0));
+
+	ScreenQuad.getMaterial().setTexture(0, ScreenQuad.rt[1]);
+	ScreenQuad.getMaterial().setTexture(1, ScreenQuad.rt[0]);
+
+	ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)LightModulate;
+	ScreenQuad.render(driver);
+
+	// Perform depth pass after rendering, to ensure animations stay up to date.
+	if (DepthPass)
+	{
+		driver->setRenderTarget(DepthRTT, true, true, SColor(0xffffffff));
+
+		// Set max distance constant for depth shader.
+		depthMC->FarLink = smgr->getActiveCamera()->getFarValue();
+
+		for (u32 i = 0; i < DepthPassArray.size(); ++i)
+		{
+			core::array<irr::s32> BufferMaterialList(DepthPassArray[i]->getMaterialCount());
+			BufferMaterialList.set_used(0);
+
+			for (u32 g = 0; g < DepthPassArray[i]->getMaterialCount(); ++g)
+				BufferMaterialList.push_back(DepthPassArray[i]->getMaterial(g).MaterialType);
+
+			DepthPassArray[i]->setMaterialType((E_MATERIAL_TYPE)Depth);
+			DepthPassArray[i]->OnAnimate(device->getTimer()->getTime());
+			DepthPassArray[i]->render();
+
+			for (u32 g = 0; g < DepthPassArray[i]->getMaterialCount(); ++g)
+				DepthPassArray[i]->getMaterial(g).MaterialType = (E_MATERIAL_TYPE)BufferMaterialList[g];
+		}
+
+		driver->setRenderTarget(0, false, false);
+	}
+
+	if (PostProcessingRoutinesSize)
+	{
+		if (PostChainDirty)
+			buildPostProcessingChain();
+
+		ScreenQuad.getMaterial().setTexture(1, ScreenRTT);
+		ScreenQuad.getMaterial().setTexture(2, DepthRTT);
+
+		ITexture* previous = ScreenRTT;
+
+		const u32 PostProcessingPassesSize = PostProcessingPasses.size();
+		for (u32 p = 0; p < PostProcessingPassesSize; ++p)
+		{
+			const SPostProcessingPass& pass = PostProcessingPasses[p];
+			ITexture* input = pass.input == EPPI_SCENE ? ScreenRTT : previous;
+
+			// The last pass draws straight into the output, unless it runs at reduced resolution.
+			ITexture* target = (p == PostProcessingPassesSize - 1 && pass.scale == 1)
+				? outputTarget : getPostProcessingTarget(pass.scale, input);
+
+			// Fused passes take the constants set on each of their stages.
+			if (pass.count > 1 && pass.callback)
+			{
+				for (u32 i = pass.first; i < pass.first + pass.count; ++i)
+				{
+					if (!PostProcessingRoutines[i].callback)
+						continue;
+
+					core::map<core::stringc, ScreenQuadCB::SUniformDescriptor>::Iterator it =
+						PostProcessingRoutines[i].callback->uniformDescriptors.getIterator();
+
+					for (; !it.atEnd(); it++)
+						pass.callback->uniformDescriptors[it->getKey()] = it->getValue();
+				}
+			}
+
+			ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)pass.materialType;
+			ScreenQuad.getMaterial().setTexture(0, input);
+			setOutputTarget(target, ClearColour);
+
+			for (u32 i = pass.first; i < pass.first + pass.count; ++i)
+				if (PostProcessingRoutines[i].renderCallback) PostProcessingRoutines[i].renderCallback->OnPreRender(this);
+
+			ScreenQuad.render(driver);
+
+			for (u32 i = pass.first; i < pass.first + pass.count; ++i)
+				if (PostProcessingRoutines[i].renderCallback) PostProcessingRoutines[i].renderCallback->OnPostRender(this);
+
+			previous = target;
+		}
+
+		// A reduced last pass is scaled up into the output.
+		if (previous != outputTarget)
+		{
+			ScreenQuad.getMaterial().MaterialType = (E_MATERIAL_TYPE)Simple;
+			ScreenQuad.getMaterial().setTexture(0, previous);
+			setOutputTarget(outputTarget, ClearColour);
+
+			ScreenQuad.render(driver);
+		}
+	}
+}
+
+
+irr::video::ITexture* EffectHandler::getShadowMapTexture(const irr::u32 resolution, const bool secondary,
+	const irr::s32 lightIndex)
+{
+	const ECOLOR_FORMAT format = use32BitDepth ? ECF_G32R32F : ECF_G16R16F;
+
+	// Blur targets are shared by every map of the same resolution.
+	if (secondary)
+	{
+		core::map<u32, ITexture*>::Node* cached = SecondaryShadowMaps.find(resolution);
+		if (cached)
+			return cached->getValue();
+
+		ITexture* shadowMapTexture = driver->addRenderTargetTexture(dimension2du(resolution, resolution),
+			core::stringc("XEFFECTS_SM_") + core::stringc(resolution) + "_2", format);
+
+		SecondaryShadowMaps.insert(resolution, shadowMapTexture);
+		return shadowMapTexture;
+	}
+
+	if (lightIndex < 0)
+	{
+		// Using Irrlicht cache now.
+		core::stringc shadowMapName = core::stringc("XEFFECTS_SM_") + core::stringc(resolution);
+
+		ITexture* shadowMapTexture = driver->getTexture(shadowMapName);
+
+		if (shadowMapTexture == 0)
+		{
+			device->getLogger()->log("XEffects: Please ignore previous warning, it is harmless.");
+
+			shadowMapTexture = driver->addRenderTargetTexture(dimension2du(resolution, resolution),
+				shadowMapName, format);
+		}
+
+		return shadowMapTexture;
+	}
+
+	while (LightShadowTextures.size() <= (u32)lightIndex)
+		LightShadowTextures.push_back(0);
+
+	ITexture*& shadowMapTexture = LightShadowTextures[lightIndex];
+
+	if (shadowMapTexture && shadowMapTexture->getSize().Width != resolution)
+	{
+		driver->removeTexture(shadowMapTexture);
+		shadowMapTexture = 0;
+	}
+
+	// Names only have to be unique, lights keep their texture when earlier lights are removed.
+	if (shadowMapTexture == 0)
+	{
+		shadowMapTexture = driver->addRenderTargetTexture(dimension2du(resolution, resolution),
+			core::stringc("XEFFECTS_SM_") + core::stringc(resolution) + "_L" + core::stringc(ShadowMapSerial++), format);
+	}
+
+	return shadowMapTexture;
+}
+
+
+irr::video::ITexture* EffectHandler::generateRandomVectorTexture(const irr::core::dimension2du& dimensions,
+	const irr::core::stringc& name)
+{
+	IImage* tmpImage = driver->createImage(irr::video::ECF_A8R8G8B8, dimensions);
+
+	srand(device->getTimer()->getRealTime());
+
+	for (u32 x = 0; x < dimensions.Width; ++x)
+	{
+		for (u32 y = 0; y < dimensions.Height; ++y)
+		{
+			vector3df randVec;
+
+			// Reject vectors outside the unit sphere to get a uniform distribution.
+			do { randVec = vector3df((f32)rand() / (f32)RAND_MAX, (f32)rand() / (f32)RAND_MAX, (f32)rand() / (f32)RAND_MAX); } while (randVec.getLengthSQ() > 1.0f);
+
+			const SColorf randCol(randVec.X, randVec.Y, randVec.Z);
+			tmpImage->setPixel(x, y, randCol.toSColor());
+		}
+	}
+
+	ITexture* randTexture = driver->addTexture(name, tmpImage);
+
+	tmpImage->drop();
+
+	return randTexture;
+}
+
+
+EffectHandler::SPostProcessingPair EffectHandler::obtainScreenQuadMaterialFromFile(const irr::core::stringc& filename,
+	irr::video::E_MATERIAL_TYPE baseMaterial)
+{
+	CShaderPreprocessor sPP(driver);
+
+	sPP.addShaderDefine("SCREENX", core::stringc(ScreenRTTSize.Width));
+	sPP.addShaderDefine("SCREENY", core::stringc(ScreenRTTSize.Height));
+
+	const stringc shaderString = sPP.ppShaderFF(filename.c_str());
+
+	if (shaderString.find("POST_STAGE") == -1)
+		return compileScreenQuadMaterial(shaderString, baseMaterial);
+
+	// Stages get wrapped on their own too, so they also work wherever fusion does not apply.
+	core::array<core::stringc> stages;
+	stages.push_back(shaderString);
+
+	SPostProcessingPair pPair = compileScreenQuadMaterial(buildPostStageShader(stages), baseMaterial);
+	pPair.stageSource = shaderString;
+
+	return pPair;
+}
+
+
+EffectHandler::SPostProcessingPair EffectHandler::compileScreenQuadMaterial(const irr::core::stringc& pixelShader,
+	irr::video::E_MATERIAL_TYPE baseMaterial)
+{
+	CShaderPreprocessor sPP(driver);
+
+	video::E_VERTEX_SHADER_TYPE VertexLevel = driver->queryFeature(video::EVDF_VERTEX_SHADER_3_0) ? EVST_VS_3_0 : EVST_VS_2_0;
+	video::E_PIXEL_SHADER_TYPE PixelLevel = driver->queryFeature(video::EVDF_PIXEL_SHADER_3_0) ? EPST_PS_3_0 : EPST_PS_2_0;
+
+	E_SHADER_EXTENSION shaderExt = (driver->getDriverType() == EDT_DIRECT3D9) ? ESE_HLSL : ESE_GLSL;
+
+	video::IGPUProgrammingServices* gpu = driver->getGPUProgrammingServices();
+
+	ScreenQuadCB* SQCB = new ScreenQuadCB(this, true);
+
+	s32 PostMat = gpu->addHighLevelShaderMaterial(
+		sPP.ppShader(SCREEN_QUAD_V[shaderExt]).c_str(), "vertexMain", VertexLevel,
+		pixelShader.c_str(), "pixelMain", PixelLevel,
+		SQCB, baseMaterial);
 
 	SPostProcessingPair pPair(PostMat, SQCB);
 
@@ -543,6 +1686,35 @@ EffectHandler::SPostProcessingPair EffectHandler::obtainScreenQuadMaterialFromFi
 }
 
 
+irr::core::stringc EffectHandler::buildPostStageShader(const irr::core::array<irr::core::stringc>& stages)
+{
+	E_SHADER_EXTENSION shaderExt = (driver->getDriverType() == EDT_DIRECT3D9) ? ESE_HLSL : ESE_GLSL;
+
+	core::stringc shader = POST_STAGE_HEADER_P[shaderExt];
+	core::stringc calls;
+
+	// Every stage's POST_STAGE gets its own name, then main runs them in order on the colour.
+	for (u32 i = 0; i < stages.size(); ++i)
+	{
+		const core::stringc stageName = core::stringc("postStage") + core::stringc(i);
+
+		CShaderPreprocessor sPP(driver);
+		sPP.addShaderDefine("POST_STAGE", stageName);
+
+		shader += sPP.ppShader(stages[i]);
+		shader += "\n";
+
+		calls += core::stringc("\tcolour = ") + stageName + "(colour, texCoord);\n";
+	}
+
+	shader += POST_STAGE_MAIN_P[shaderExt];
+	shader += calls;
+	shader += POST_STAGE_END_P[shaderExt];
+
+	return shader;
+}
+
+
 void EffectHandler::setPostProcessingEffectConstant(const irr::s32 materialType, const irr::core::stringc& name,
 	const f32* data, const irr::u32 count)
 {
@@ -555,11 +1727,14 @@ void EffectHandler::setPostProcessingEffectConstant(const irr::s32 materialType,
 
 
 s32 EffectHandler::addPostProcessingEffectFromFile(const irr::core::stringc& filename,
-	IPostProcessingRenderCallback* callback)
+	IPostProcessingRenderCallback* callback, irr::u32 scale, E_POST_PROCESSING_INPUT input)
 {
 	SPostProcessingPair pPair = obtainScreenQuadMaterialFromFile(filename);
 	pPair.renderCallback = callback;
+	pPair.scale = scale >= 4 ? 4 : (scale >= 2 ? 2 : 1);
+	pPair.input = input;
 	PostProcessingRoutines.push_back(pPair);
+	PostChainDirty = true;
 
 	return pPair.materialType;
 }
@@ -4,6 +4,8 @@
 #include <irrlicht.h>
 #include "CShaderPre.h"
 #include "CScreenQuad.h"
+#include "ShadowAtlas.h"
+#include "LightGrid.h"
 
 /// Shadow mode enums, sets whether a node recieves shadows, casts shadows, or both.
 /// If the mode is ESM_CAST, it will not be affected by shadows or lighting.
@@ -27,6 +29,22 @@ enum E_FILTER_TYPE
 	EFT_COUNT
 };
 
+/// Where a post processing effect reads its colour map from.
+enum E_POST_PROCESSING_INPUT
+{
+	EPPI_PREVIOUS, /// Output of the effect before it, or the scene for the first effect
+	EPPI_SCENE, /// The untainted scene, whatever ran before
+	EPPI_COUNT
+};
+
+/// One slice of a cascaded directional light, refitted to the frustum of every view drawn.
+struct SShadowCascade
+{
+	irr::core::matrix4 viewMat, projMat;
+	SShadowTile tile; /// Quarter of the light's shadow map
+	irr::f32 radius;
+};
+
 struct SShadowLight
 {
 	/// Shadow light constructor. The first parameter is the square shadow map resolution.
@@ -190,9 +208,43 @@ struct SShadowLight
 		return mapRes;
 	}
 
+	/// Cascaded shadow maps, only used by directional lights. More than one cascade splits the camera
+	/// frustum into slices which share the light's shadow map as a 2x2 atlas.
+	void setCascades(irr::u32 count, irr::f32 splitLambda = 0.75f)
+	{
+		cascadeCount = irr::core::clamp<irr::u32>(count, 1, 4);
+		cascadeSplitLambda = irr::core::clamp(splitLambda, 0.0f, 1.0f);
+	}
+
+	irr::u32 getCascadeCount() const
+	{
+		return cascadeCount;
+	}
+
+	irr::f32 getCascadeSplitLambda() const
+	{
+		return cascadeSplitLambda;
+	}
+
+	bool isCascaded() const
+	{
+		return dir && cascadeCount > 1;
+	}
+
 	irr::u32 id;
 	bool active = true;
 
+	irr::f32 shadowDistance = 0.0f; /// Camera distance covered by cascades, 0 uses the camera's far value
+	irr::f32 casterRange = 500.0f; /// How far towards the light casters outside a cascade are still captured
+	SShadowCascade cascades[4];
+
+	/// Static spot and point lights keep their shadow atlas tile between frames and only render it
+	/// again when the light itself changes. Moving casters are not picked up until then.
+	bool staticShadow = false;
+	SShadowTile atlasTile; /// Invalid when the light renders to its own shadow map
+	irr::core::matrix4 bakedViewMat, bakedProjMat; /// Matrices the static tile was rendered with
+	bool baked = false; /// Whether the static atlas holds this light's tile
+
 private:
 
 	void updateViewMatrix()
@@ -211,6 +263,93 @@ private:
 	irr::f32 fieldOfView = 90.0;
 	irr::f32 nearVal = 0.1;
 	bool dir = false;
+
+	irr::u32 cascadeCount = 1;
+	irr::f32 cascadeSplitLambda = 0.75f;
+};
+
+struct SShadowNode
+{
+	irr::scene::ISceneNode* node;
+
+	E_SHADOW_MODE shadowMode;
+	E_FILTER_TYPE filterType;
+
+	/// Copies of the node's materials with each pass's shader already set. Passes draw with the copies,
+	/// they are only rebuilt when the node's material count changes or materialsChanged is set.
+	bool materialsChanged;
+	irr::core::array<irr::video::SMaterial> depthMaterials;
+	irr::core::array<irr::video::SMaterial> receiveMaterials;
+	irr::core::array<irr::video::SMaterial> whiteWashMaterials;
+};
+
+/// Holds one shadow node entry per scene node. Entries live in slots addressed by handles, which carry
+/// a generation so stale handles are rejected, and each shadow mode keeps a packed list of its slots so
+/// passes only walk the nodes they draw. Removal swaps the last entry of the mode's list into the gap.
+/// Registered nodes are grabbed, removeDeadNodes drops entries whose node nobody else holds anymore.
+class ShadowNodeRegistry
+{
+public:
+	typedef irr::u32 Handle;
+	static const Handle INVALID_HANDLE = 0xffffffff;
+
+	ShadowNodeRegistry() : count(0) {}
+	~ShadowNodeRegistry();
+
+	/// Registers a node, or changes its mode and filter if it is registered already.
+	Handle add(irr::scene::ISceneNode* node, E_SHADOW_MODE shadowMode, E_FILTER_TYPE filterType);
+
+	/// Removes by node, found through the node lookup in O(log n).
+	bool remove(irr::scene::ISceneNode* node);
+
+	/// Removes by handle in O(1).
+	bool remove(Handle handle);
+
+	SShadowNode* find(irr::scene::ISceneNode* node);
+	const SShadowNode* find(irr::scene::ISceneNode* node) const;
+
+	/// Slots of every entry with the given mode, in no particular order.
+	const irr::core::array<irr::u32>& getPartition(E_SHADOW_MODE shadowMode) const
+	{
+		return partitions[shadowMode];
+	}
+
+	SShadowNode& getEntry(irr::u32 slot)
+	{
+		return slots[slot].entry;
+	}
+
+	/// Removes entries whose node was removed from the scene and dropped by everyone else.
+	irr::u32 removeDeadNodes();
+
+	irr::u32 size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+private:
+	struct SSlot
+	{
+		SShadowNode entry;
+		irr::u32 generation;
+		irr::u32 partitionIndex; /// Position in the partition of the entry's mode
+		bool used;
+	};
+
+	void link(irr::u32 slot);
+	void unlink(irr::u32 slot);
+	void release(irr::u32 slot);
+
+	irr::core::array<SSlot> slots;
+	irr::core::array<irr::u32> freeSlots;
+	irr::core::array<irr::u32> partitions[ESM_COUNT];
+	irr::core::map<irr::scene::ISceneNode*, irr::u32> lookup;
+	irr::u32 count;
 };
 
 // This is a general interface that can be overidden if you want to perform operations before or after
@@ -228,6 +367,7 @@ public:
 class DepthShaderCB;
 class ShadowShaderCB;
 class ScreenQuadCB;
+class MultiLightShaderCB;
 
 /// Main effect handling class, use this to apply shadows and effects.
 class EffectHandler
@@ -270,10 +410,44 @@ public:
 	}
 
 	/// Retrieves the shadow map texture for the specified square shadow map resolution.
-	/// Only one shadow map is kept for each resolution, so if multiple lights are using
-	/// the same resolution, you will only see the last light drawn's output.
+	/// Each light keeps its own shadow map so it can be reused by every view in a frame, pass the
+	/// light index to get it. Without an index the shared map for that resolution is returned.
 	/// The secondary param specifies whether to retrieve the secondary shadow map used in blurring.
-	irr::video::ITexture* getShadowMapTexture(const irr::u32 resolution, const bool secondary = false);
+	irr::video::ITexture* getShadowMapTexture(const irr::u32 resolution, const bool secondary = false,
+		const irr::s32 lightIndex = -1);
+
+	/// Marks every light's shadow map as out of date. Call this once per frame, the first update of
+	/// the frame then renders the shadow maps and every later update (other cameras, render to texture)
+	/// reuses them, so extra views only pay for their own lighting and scene passes. Cascaded lights
+	/// follow the view and are rendered again by every update.
+	void invalidateShadowMaps()
+	{
+		LightShadowMaps.clear();
+		AtlasesRendered = false;
+	}
+
+	/// Spot and point lights share two atlas textures of this size, one retained for static lights and
+	/// one packed every frame with tiles sized by how much of the screen each light covers. 0 gives every
+	/// light its own shadow map again.
+	void setShadowAtlasSize(irr::u32 size);
+
+	irr::u32 getShadowAtlasSize() const
+	{
+		return ShadowAtlasSize;
+	}
+
+	/// Shades every light in the shadow atlases in one geometry pass, using the lights binned into
+	/// the screen tiles each node covers. Other lights, or all of them when this is off or the
+	/// hardware lacks shader model 3, still take one pass each.
+	void setMultiLightShading(bool enable)
+	{
+		MultiLightShading = enable;
+	}
+
+	bool getMultiLightShading() const
+	{
+		return MultiLightShading;
+	}
 
 	/// Retrieves the screen depth map texture if the depth pass is enabled. This is unrelated to the shadow map, and is
 	/// meant to be used for post processing effects that require screen depth info, eg. DOF or SSAO.
@@ -299,11 +473,35 @@ public:
 	/// Removes shadows from a scene node.
 	void removeShadowFromNode(irr::scene::ISceneNode* node)
 	{
-		SShadowNode tmpShadowNode = { node, ESM_RECEIVE, EFT_NONE };
-		irr::s32 i = ShadowNodeArray.binary_search(tmpShadowNode);
+		ShadowNodes.remove(node);
+	}
 
-		if (i != -1)
-			ShadowNodeArray.erase(i);
+	/// Removes a shadow node by the handle addShadowToNode returned.
+	void removeShadowFromNode(ShadowNodeRegistry::Handle handle)
+	{
+		ShadowNodes.remove(handle);
+	}
+
+	/// Rebuilds the pass materials of a registered node on the next update. Call this after changing the
+	/// node's materials, the shadow passes keep drawing with the materials the node had until then.
+	void markShadowNodeMaterialsChanged(irr::scene::ISceneNode* node)
+	{
+		SShadowNode* shadowNode = ShadowNodes.find(node);
+		if (shadowNode)
+			shadowNode->materialsChanged = true;
+	}
+
+	/// Looks up how a scene node was registered with addShadowToNode or excludeNodeFromLightingCalculations.
+	/// Returns false if the node is not registered.
+	bool getShadowNodeInfo(irr::scene::ISceneNode* node, E_SHADOW_MODE& shadowMode, E_FILTER_TYPE& filterType) const
+	{
+		const SShadowNode* shadowNode = ShadowNodes.find(node);
+		if (!shadowNode)
+			return false;
+
+		shadowMode = shadowNode->shadowMode;
+		filterType = shadowNode->filterType;
+		return true;
 	}
 
 	void removeLightNode(int index)
@@ -311,6 +509,17 @@ public:
 		for (int i = 0; i < LightList.size(); i++) {
 			if (LightList[i].id == index) {
 				LightList.erase(i);
+
+				if ((irr::u32)i < LightShadowTextures.size())
+				{
+					if (LightShadowTextures[i])
+						driver->removeTexture(LightShadowTextures[i]);
+
+					LightShadowTextures.erase(i);
+				}
+
+				StaticAtlasDirty = true;
+				invalidateShadowMaps();
 				return;
 			}
 		}
@@ -320,8 +529,7 @@ public:
 	// occur from XEffect's light modulation on this particular scene node.
 	void excludeNodeFromLightingCalculations(irr::scene::ISceneNode* node)
 	{
-		SShadowNode tmpShadowNode = { node, ESM_EXCLUDE, EFT_NONE };
-		ShadowNodeArray.push_back(tmpShadowNode);
+		addShadowToNode(node, EFT_NONE, ESM_EXCLUDE);
 	}
 
 	/// Updates the effects handler. This must be done between IVideoDriver::beginScene and IVideoDriver::endScene.
@@ -331,12 +539,18 @@ public:
 	/// A render target may be passed as the output target, else rendering will commence on the backbuffer.
 	void update(irr::video::ITexture* outputTarget = 0);
 
+	/// Animates the shadow nodes and renders the shadow maps for the active camera's view. update does this
+	/// itself, call it first when nodes are about to be hidden for the view so hidden casters still cast.
+	void updateShadowMaps();
+
 	/// Adds a shadow to the scene node. The filter type specifies how many shadow map samples
 	/// to take, a higher value can produce a smoother or softer result. The shadow mode can
 	/// be either ESM_BOTH, ESM_CAST, or ESM_RECEIVE. ESM_BOTH casts and receives shadows,
 	/// ESM_CAST only casts shadows, and is unaffected by shadows or lighting, and ESM_RECEIVE
-	/// only receives but does not cast shadows.
-	void addShadowToNode(irr::scene::ISceneNode* node, E_FILTER_TYPE filterType = EFT_NONE, E_SHADOW_MODE shadowMode = ESM_BOTH);
+	/// only receives but does not cast shadows. A node is only ever registered once, adding it again
+	/// changes its filter type and mode.
+	ShadowNodeRegistry::Handle addShadowToNode(irr::scene::ISceneNode* node, E_FILTER_TYPE filterType = EFT_NONE,
+		E_SHADOW_MODE shadowMode = ESM_BOTH);
 
 	/// Returns the device time divided by 100, for use with the shader callbacks.
 	irr::f32 getTime()
@@ -387,6 +601,9 @@ public:
 
 	The last parameter is the render callback, you may pass 0 if you do not need one.
 	Please see IPostProcessingRenderCallback for more info about this callback.
+
+	Effects run at full screen render target resolution and read the output of the effect before them,
+	setPostProcessingEffectScale and setPostProcessingEffectInput change either.
 	*/
 	void addPostProcessingEffect(irr::s32 MaterialType, IPostProcessingRenderCallback* callback = 0);
 
@@ -418,16 +635,41 @@ public:
 				delete PostProcessingRoutines[i].renderCallback;
 
 			PostProcessingRoutines.erase(i);
+			PostChainDirty = true;
 		}
 	}
 
 	/// Adds a post processing effect by reading a pixel shader from a file. The vertex shader is taken care of.
 	/// The vertex shader will pass the correct screen quad texture coordinates via the TEXCOORD0 semantic in
 	/// Direct3D or the gl_TexCoord[0] varying in OpenGL.
-	/// See addPostProcessingEffect for more info.
+	///
+	/// Instead of a whole pixel shader the file may hold a single per-pixel stage, a function named POST_STAGE
+	/// taking the colour so far and the texture coordinate and returning the new colour:
+	///		vec4 POST_STAGE(vec4 colour, vec2 texCoord) for GLSL, float4 POST_STAGE(float4 colour, float2 texCoord)
+	///		for HLSL. The samplers are declared for it.
+	/// Adjacent stages with the same scale are fused into one shader and drawn in a single pass, so their
+	/// uniform and helper function names must not clash.
+	///
+	/// The scale divides the resolution the effect renders at, 1, 2 or 4, and the input is where its colour map
+	/// comes from. See addPostProcessingEffect for more info.
 	/// Returns the Irrlicht material type of the post processing effect.
 	irr::s32 addPostProcessingEffectFromFile(const irr::core::stringc& filename,
-		IPostProcessingRenderCallback* callback = 0);
+		IPostProcessingRenderCallback* callback = 0, irr::u32 scale = 1,
+		E_POST_PROCESSING_INPUT input = EPPI_PREVIOUS);
+
+	/// Sets the resolution divisor of a post processing effect, 1, 2 or 4. Reduced effects render into smaller
+	/// intermediate targets, the next full resolution effect reads them filtered.
+	void setPostProcessingEffectScale(irr::s32 materialType, irr::u32 scale);
+
+	/// Sets where a post processing effect reads its colour map from.
+	void setPostProcessingEffectInput(irr::s32 materialType, E_POST_PROCESSING_INPUT input);
+
+	/// Enables fusing adjacent POST_STAGE effects into one pass. Enabled by default.
+	void setPostProcessingFusion(bool enable)
+	{
+		PostFusion = enable;
+		PostChainDirty = true;
+	}
 
 	/// Sets a shader parameter for a post-processing effect. The first parameter is the material type, the second
 	/// is the uniform paratmeter name, the third is a float pointer that points to the data and the last is the
@@ -486,24 +728,12 @@ public:
 
 private:
 
-	struct SShadowNode
-	{
-		bool operator < (const SShadowNode& other) const
-		{
-			return node < other.node;
-		}
-
-		irr::scene::ISceneNode* node;
-
-		E_SHADOW_MODE shadowMode;
-		E_FILTER_TYPE filterType;
-	};
-
 	struct SPostProcessingPair
 	{
 		SPostProcessingPair(const irr::s32 materialTypeIn, ScreenQuadCB* callbackIn,
 			IPostProcessingRenderCallback* renderCallbackIn = 0)
-			: materialType(materialTypeIn), callback(callbackIn), renderCallback(renderCallbackIn) {
+			: materialType(materialTypeIn), callback(callbackIn), renderCallback(renderCallbackIn),
+			scale(1), input(EPPI_PREVIOUS) {
 		}
 
 		bool operator < (const SPostProcessingPair& other) const
@@ -514,11 +744,96 @@ private:
 		ScreenQuadCB* callback;
 		IPostProcessingRenderCallback* renderCallback;
 		irr::s32 materialType;
+		irr::u32 scale;
+		E_POST_PROCESSING_INPUT input;
+		irr::core::stringc stageSource; /// POST_STAGE function, empty for whole pixel shaders
+	};
+
+	/// One draw of the post processing chain, covering one effect or several fused ones.
+	struct SPostProcessingPass
+	{
+		irr::s32 materialType;
+		ScreenQuadCB* callback;
+		irr::u32 first; /// Index of the first effect in PostProcessingRoutines
+		irr::u32 count;
+		irr::u32 scale;
+		E_POST_PROCESSING_INPUT input;
 	};
 
 	SPostProcessingPair obtainScreenQuadMaterialFromFile(const irr::core::stringc& filename,
 		irr::video::E_MATERIAL_TYPE baseMaterial = irr::video::EMT_SOLID);
 
+	/// Compiles a screen quad pixel shader with the default vertex shader.
+	SPostProcessingPair compileScreenQuadMaterial(const irr::core::stringc& pixelShader,
+		irr::video::E_MATERIAL_TYPE baseMaterial = irr::video::EMT_SOLID);
+
+	/// Builds a pixel shader calling the given POST_STAGE functions in order.
+	irr::core::stringc buildPostStageShader(const irr::core::array<irr::core::stringc>& stages);
+
+	/// Splits the effects into passes, fusing adjacent stages.
+	void buildPostProcessingChain();
+
+	/// Intermediate target for a pass at the given scale, never the texture it reads from.
+	irr::video::ITexture* getPostProcessingTarget(irr::u32 scale, irr::video::ITexture* input);
+
+	void removePostProcessingTargets();
+
+	/// Shadow receiver and multi light materials for a filter type, compiled on first use.
+	irr::s32 getShadowMaterial(E_FILTER_TYPE filterType, bool tiled);
+	irr::s32 getMultiLightMaterial(E_FILTER_TYPE filterType);
+
+	/// Returns -1 if the shader failed to compile.
+	irr::s32 compileShadowVariant(const char* vertexShader, const char* pixelShader, E_FILTER_TYPE filterType,
+		bool tiled, irr::video::IShaderConstantSetCallBack* callback);
+
+	/// Material slots waiting for their shader to be compiled.
+	static const irr::s32 SHADER_PENDING = -2;
+
+	/// Binds a target for a screen quad pass. The back buffer always gets a viewport over the whole window.
+	void setOutputTarget(irr::video::ITexture* target, irr::video::SColor clearColour);
+
+	/// Renders the light space depth pass of every light that has not been rendered since the last invalidateShadowMaps,
+	/// and of the cascaded lights for the active camera.
+	void renderShadowMaps();
+
+	/// Rebuilds the pass materials of a shadow node from the node's current materials.
+	void buildShadowNodeMaterials(SShadowNode& shadowNode);
+
+	/// Animates every shadow node once and rebuilds the pass materials of nodes marked as changed.
+	void syncShadowNodes();
+
+	/// Draws a shadow node with one of its pass material sets. Mesh and animated mesh nodes are drawn
+	/// buffer by buffer so their own materials are never touched, other nodes get the set swapped in
+	/// for their render call.
+	void drawShadowNode(SShadowNode& shadowNode, irr::core::array<irr::video::SMaterial>& materials);
+
+	/// Draws the shadow casting nodes with the current transforms, skipping nodes outside the cascade if one is given.
+	void renderCasters(const SShadowCascade* cascade = 0);
+
+	/// Draws the visible shadow receiving nodes into the current target using the shadow map. Tiled
+	/// receivers only shade the pixels that fall inside the tile set on the shadow callback.
+	void renderReceivers(irr::video::ITexture* shadowMap, bool tiled);
+
+	/// Packs and renders the static and dynamic shadow atlases.
+	void renderAtlases();
+
+	/// Renders one light into its atlas tile, the atlas must be the current render target.
+	void renderAtlasTile(SShadowLight& light);
+
+	/// Screen space size a spot or point light's shadow deserves, in texels.
+	irr::u32 getImportanceResolution(const SShadowLight& light, irr::scene::ICameraSceneNode* camera) const;
+
+	/// Blurs a whole shadow map or atlas when VSM filtering is enabled.
+	void blurShadowMap(irr::video::ITexture* shadowMap);
+
+	/// Adds the atlas lights to the light accumulation target, four per receiver and pass. Receivers
+	/// reached by more lights take extra passes until every light is shaded. Lights it shaded are
+	/// flagged in MultiLightShaded, returns false if it did not run.
+	bool renderMultiLightPass(irr::scene::ICameraSceneNode* camera);
+
+	/// Splits the camera frustum and fits one light space projection per slice.
+	void fitCascades(SShadowLight& light, irr::scene::ICameraSceneNode* camera, irr::u32 tileResolution);
+
 	irr::IrrlichtDevice* device;
 	irr::video::IVideoDriver* driver;
 	irr::scene::ISceneManager* smgr;
@@ -528,6 +843,9 @@ private:
 	irr::s32 DepthT;
 	irr::s32 DepthWiggle;
 	irr::s32 Shadow[EFT_COUNT];
+	irr::s32 ShadowTiled[EFT_COUNT];
+	irr::s32 MultiLight[EFT_COUNT];
+	bool MultiLightSupported;
 	irr::s32 LightModulate;
 	irr::s32 Simple;
 	irr::s32 WhiteWash;
@@ -539,14 +857,37 @@ private:
 
 	DepthShaderCB* depthMC;
 	ShadowShaderCB* shadowMC;
+	MultiLightShaderCB* multiLightMC;
 
 	irr::video::ITexture* ScreenRTT;
 	irr::video::ITexture* DepthRTT;
 
 	irr::core::array<SPostProcessingPair> PostProcessingRoutines;
+	irr::core::array<SPostProcessingPass> PostProcessingPasses;
+	irr::core::array<SPostProcessingPair> FusedPostProcessingRoutines; // Keyed by stageSource, the fused material types
+	irr::video::ITexture* PostTargets[2][2]; // Half and quarter resolution ping-pong targets, created on first use
+	bool PostChainDirty;
+	bool PostFusion;
 	irr::core::array<SShadowLight> LightList;
-	irr::core::array<SShadowNode> ShadowNodeArray;
+	irr::core::array<irr::video::ITexture*> LightShadowMaps; // Per light, 0 until rendered this frame (this view when cascaded)
+	irr::core::array<irr::video::ITexture*> LightShadowTextures; // Per light, own shadow maps kept between frames
+	irr::core::map<irr::u32, irr::video::ITexture*> SecondaryShadowMaps; // VSM blur targets by resolution
+	irr::u32 ShadowMapSerial;
+
+	ShadowAtlas* StaticAtlas;
+	ShadowAtlas* DynamicAtlas;
+	irr::u32 ShadowAtlasSize;
+	bool StaticAtlasDirty;
+	bool AtlasesRendered;
+
+	LightGrid LightBins;
+	irr::core::array<bool> MultiLightShaded; // Per light, set by the multi light pass
+	irr::core::array<irr::u32> MultiLightMasks; // Per receiver, binned lights not yet shaded by the multi light pass
+	bool MultiLightShading;
+	bool ShadowMapsUpdated; // updateShadowMaps ran for the view update is about to draw
+	ShadowNodeRegistry ShadowNodes;
 	irr::core::array<irr::scene::ISceneNode*> DepthPassArray;
+	irr::core::array<irr::video::SMaterial> MaterialScratch; // Node materials saved around swapped renders
 
 	irr::core::dimension2du ScreenRTTSize;
 	irr::video::SColor ClearColour;
@@ -556,6 +897,7 @@ private:
 	bool shadowsUnsupported;
 	bool use32BitDepth;
 	bool useVSM;
+	bool useRoundSpot;
 	bool DepthPass;
 };
 
@@ -107,6 +107,9 @@ const char* SHADOW_PASS_1V[ESE_COUNT] = {"uniform mat4 mWorldViewProj;\n"
 const char* SHADOW_PASS_2P[ESE_COUNT] = {"uniform sampler2D ShadowMapSampler;\n"
 "uniform vec4 LightColour;\n"
 "varying float lightVal;\n"
+"\n##ifdef SHADOW_TILE\n"
+"uniform vec4 TileRect;\n"
+"##endif\n"
 ""
 "\n##ifdef VSM\n"
 "float testShadow(vec2 texCoords, vec2 offset, float RealDist)\n"
@@ -159,11 +162,20 @@ const char* SHADOW_PASS_2P[ESE_COUNT] = {"uniform sampler2D ShadowMapSampler;\n"
 ""
 "    SMPos.xy  = SMPos.xy / SMPos.w / 2.0 + vec2(0.5, 0.5);\n"
 ""
+"	// Leave pixels outside this light's atlas tile alone, an earlier pass may have shaded them.\n"
+"##ifdef SHADOW_TILE\n"
+"	if(SMPos.x < TileRect.x || SMPos.y < TileRect.y || SMPos.x > TileRect.z || SMPos.y > TileRect.w)\n"
+"		discard;\n"
+"	vec2 tilePos = (SMPos.xy - TileRect.xy) / (TileRect.zw - TileRect.xy);\n"
+"##else\n"
+"	vec2 tilePos = SMPos.xy;\n"
+"##endif\n"
+""
 "	vec4 finalCol = vec4(0.0, 0.0, 0.0, 0.0);\n"
 ""
 "	// If this point is within the light's frustum.\n"
 "##ifdef ROUND_SPOTLIGHTS\n"
-"	float lengthToCenter = length(SMPos.xy - vec2(0.5, 0.5));\n"
+"	float lengthToCenter = length(tilePos - vec2(0.5, 0.5));\n"
 "	if(SMPos.z - 0.01 > 0.0 && SMPos.z + 0.01 < MVar.z)\n"
 "##else\n"
 "	vec2 clampedSMPos = clamp(SMPos.xy, vec2(0.0, 0.0), vec2(1.0, 1.0));\n"
@@ -190,6 +202,10 @@ const char* SHADOW_PASS_2P[ESE_COUNT] = {"uniform sampler2D ShadowMapSampler;\n"
 "sampler2D ShadowMapSampler : register(s0);\n"
 "float4 LightColour;\n"
 "\n"
+"##ifdef SHADOW_TILE\n"
+"float4 TileRect;\n"
+"##endif\n"
+"\n"
 "##ifdef VSM\n"
 "float calcShadow(float2 texCoords, float2 offset, float RealDist)"
 "{"
@@ -244,11 +260,19 @@ const char* SHADOW_PASS_2P[ESE_COUNT] = {"uniform sampler2D ShadowMapSampler;\n"
 ""
 "	SMPos.xy = SMPos.xy / SMPos.w + float2(0.5, 0.5);\n"
 ""
+"	// Leave pixels outside this light's atlas tile alone, an earlier pass may have shaded them.\n"
+"##ifdef SHADOW_TILE\n"
+"	clip(float4(SMPos.xy - TileRect.xy, TileRect.zw - SMPos.xy));\n"
+"	float2 tilePos = (SMPos.xy - TileRect.xy) / (TileRect.zw - TileRect.xy);\n"
+"##else\n"
+"	float2 tilePos = SMPos.xy;\n"
+"##endif\n"
+""
 "	float4 finalCol = float4(0.0, 0.0, 0.0, 0.0);\n"
 ""
 "	// If this point is within the light's frustum.\n"
 "##ifdef ROUND_SPOTLIGHTS\n"
-"	float lengthToCenter = length(SMPos.xy - float2(0.5, 0.5));\n"
+"	float lengthToCenter = length(tilePos - float2(0.5, 0.5));\n"
 "	if(lengthToCenter < 0.5 && SMPos.z > 0.0 && SMPos.z < MVar[3])\n"
 "##else\n"
 "	float2 clampedSMPos = saturate(SMPos.xy);\n"
@@ -349,6 +373,250 @@ const char* SHADOW_PASS_2V[ESE_COUNT] = {"struct VS_OUTPUT "
 "}"};
 
 
+const char* MULTI_LIGHT_V[ESE_COUNT] = {"uniform mat4 mWorldViewProj;\n"
+"uniform mat4 mLightViewProj[4];\n"
+"uniform vec4 LightPos[4];\n"
+""
+"float lambert(vec3 normal, vec3 position, vec4 lightPos)\n"
+"{"
+"	return max(dot(normal, normalize(lightPos.xyz - position)), 0.0);\n"
+"}\n"
+""
+"void main() "
+"{"
+"	vec3 normal = normalize(gl_Normal.xyz);\n"
+""
+"	gl_Position = mWorldViewProj * gl_Vertex;\n"
+"	gl_TexCoord[0] = mLightViewProj[0] * gl_Vertex;\n"
+"	gl_TexCoord[1] = mLightViewProj[1] * gl_Vertex;\n"
+"	gl_TexCoord[2] = mLightViewProj[2] * gl_Vertex;\n"
+"	gl_TexCoord[3] = mLightViewProj[3] * gl_Vertex;\n"
+"	gl_TexCoord[4] = vec4(lambert(normal, gl_Vertex.xyz, LightPos[0]), lambert(normal, gl_Vertex.xyz, LightPos[1]),\n"
+"		lambert(normal, gl_Vertex.xyz, LightPos[2]), lambert(normal, gl_Vertex.xyz, LightPos[3]));\n"
+"}"
+,
+"float4x4 mWorldViewProj;\n"
+"float4x4 mLightViewProj[4];\n"
+"float4 LightPos[4];\n"
+""
+"struct VS_OUTPUT "
+"{"
+"	float4 Position : POSITION0;\n"
+"	float4 SMPos0 : TEXCOORD0;\n"
+"	float4 SMPos1 : TEXCOORD1;\n"
+"	float4 SMPos2 : TEXCOORD2;\n"
+"	float4 SMPos3 : TEXCOORD3;\n"
+"	float4 Lambert : TEXCOORD4;\n"
+"};\n"
+""
+"float lambert(float3 normal, float3 position, float4 lightPos)\n"
+"{"
+"	return max(dot(normal, normalize(lightPos.xyz - position)), 0.0);\n"
+"}\n"
+""
+"VS_OUTPUT vertexMain(float3 Position : POSITION0, float3 Normal : NORMAL)"
+"{"
+"	VS_OUTPUT OUT;\n"
+"	float4 pos = float4(Position.x, Position.y, Position.z, 1.0);\n"
+"	float3 normal = normalize(Normal);\n"
+""
+"	OUT.Position = mul(pos, mWorldViewProj);\n"
+"	OUT.SMPos0 = mul(pos, mLightViewProj[0]);\n"
+"	OUT.SMPos1 = mul(pos, mLightViewProj[1]);\n"
+"	OUT.SMPos2 = mul(pos, mLightViewProj[2]);\n"
+"	OUT.SMPos3 = mul(pos, mLightViewProj[3]);\n"
+"	OUT.Lambert = float4(lambert(normal, Position, LightPos[0]), lambert(normal, Position, LightPos[1]),\n"
+"		lambert(normal, Position, LightPos[2]), lambert(normal, Position, LightPos[3]));\n"
+""
+"	return OUT;\n"
+"}"};
+
+
+const char* MULTI_LIGHT_P[ESE_COUNT] = {"uniform sampler2D StaticAtlasSampler;\n"
+"uniform sampler2D DynamicAtlasSampler;\n"
+"uniform vec4 LightColour[4];\n"
+"uniform vec4 TileRect[4];\n"
+"uniform float LightAtlas[4];\n"
+"uniform float LightFar[4];\n"
+"uniform float MapTexel;\n"
+""
+"\n##ifdef VSM\n"
+"float testShadow(sampler2D map, vec2 texCoords, vec2 offset, float RealDist)\n"
+"{\n"
+"	vec4 shadTexCol = texture2D(map, texCoords + offset);\n"
+""
+"	float lit_factor = (RealDist <= shadTexCol.x) ? 1.0 : 0.0;\n"
+""
+"	float E_x2 = shadTexCol.y;\n"
+"	float Ex_2 = shadTexCol.x * shadTexCol.x;\n"
+"	float variance = min(max(E_x2 - Ex_2, 0.00001) + 0.000001, 1.0);\n"
+"	float m_d = (shadTexCol.x - RealDist);\n"
+"	float p = variance / (variance + m_d * m_d);\n"
+""
+"	return (1.0 - max(lit_factor, p)) / float(SAMPLE_AMOUNT);\n"
+"}\n"
+"##else\n"
+"float testShadow(sampler2D map, vec2 smTexCoord, vec2 offset, float realDistance)\n"
+"{\n"
+"	float extractedDistance = texture2D(map, smTexCoord + offset).r;\n"
+"	return (extractedDistance <= realDistance) ? (1.0  / float(SAMPLE_AMOUNT)) : 0.0;\n"
+"}\n"
+"##endif\n"
+"\n"
+"vec2 offsetArray[16];\n"
+"\n"
+"float lightFactor(sampler2D map, vec4 SMPos, float maxD, vec4 rect)\n"
+"{"
+"	SMPos.xy = SMPos.xy / SMPos.w / 2.0 + vec2(0.5, 0.5);\n"
+""
+"	if(SMPos.x < rect.x || SMPos.y < rect.y || SMPos.x > rect.z || SMPos.y > rect.w || SMPos.z <= 0.0 || SMPos.z >= maxD)\n"
+"		return 0.0;\n"
+""
+"	float factor = 1.0;\n"
+"	float realDist = SMPos.z / maxD - 0.002;\n"
+""
+"	for(int i = 0;i < SAMPLE_AMOUNT; i++)"
+"		factor -= testShadow(map, SMPos.xy, offsetArray[i] * MapTexel, realDist);\n"
+""
+"##ifdef ROUND_SPOTLIGHTS\n"
+"	vec2 tilePos = (SMPos.xy - rect.xy) / (rect.zw - rect.xy);\n"
+"	factor *= clamp(5.0 - 10.0 * length(tilePos - vec2(0.5, 0.5)), 0.0, 1.0);\n"
+"##endif\n"
+""
+"	return factor;\n"
+"}\n"
+""
+"float atlasFactor(int light, vec4 SMPos)\n"
+"{"
+"	if(LightAtlas[light] > 0.5)\n"
+"		return lightFactor(DynamicAtlasSampler, SMPos, LightFar[light], TileRect[light]);\n"
+""
+"	return lightFactor(StaticAtlasSampler, SMPos, LightFar[light], TileRect[light]);\n"
+"}\n"
+""
+"void main() \n"
+"{"
+"	offsetArray[0] = vec2(0.0, 0.0);\n"
+"	offsetArray[1] = vec2(0.0, 1.0);\n"
+"	offsetArray[2] = vec2(1.0, 1.0);\n"
+"	offsetArray[3] = vec2(-1.0, -1.0);\n"
+"	offsetArray[4] = vec2(-2.0, 0.0);\n"
+"	offsetArray[5] = vec2(0.0, -2.0);\n"
+"	offsetArray[6] = vec2(2.0, -2.0);\n"
+"	offsetArray[7] = vec2(-2.0, 2.0);\n"
+"	offsetArray[8] = vec2(3.0, 0.0);\n"
+"	offsetArray[9] = vec2(0.0, 3.0);\n"
+"	offsetArray[10] = vec2(3.0, 3.0);\n"
+"	offsetArray[11] = vec2(-3.0, -3.0);\n"
+"	offsetArray[12] = vec2(-4.0, 0.0);\n"
+"	offsetArray[13] = vec2(0.0, -4.0);\n"
+"	offsetArray[14] = vec2(4.0, -4.0);\n"
+"	offsetArray[15] = vec2(-4.0, 4.0);\n"
+""
+"	vec4 lambert = gl_TexCoord[4];\n"
+""
+"	gl_FragColor = LightColour[0] * atlasFactor(0, gl_TexCoord[0]) * lambert.x\n"
+"		+ LightColour[1] * atlasFactor(1, gl_TexCoord[1]) * lambert.y\n"
+"		+ LightColour[2] * atlasFactor(2, gl_TexCoord[2]) * lambert.z\n"
+"		+ LightColour[3] * atlasFactor(3, gl_TexCoord[3]) * lambert.w;\n"
+"}"
+,
+"sampler2D StaticAtlasSampler : register(s0);\n"
+"sampler2D DynamicAtlasSampler : register(s1);\n"
+"float4 LightColour[4];\n"
+"float4 TileRect[4];\n"
+"float LightAtlas[4];\n"
+"float LightFar[4];\n"
+"float MapTexel;\n"
+"\n"
+"##ifdef VSM\n"
+"float calcShadow(sampler2D map, float2 texCoords, float2 offset, float RealDist)"
+"{"
+"	float4 shadTexCol = tex2D(map, texCoords + offset);\n"
+""
+"	float lit_factor = (RealDist <= shadTexCol.x);\n"
+""
+"	float E_x2 = shadTexCol.y;\n"
+"	float Ex_2 = shadTexCol.x * shadTexCol.x;\n"
+"	float variance = min(max(E_x2 - Ex_2, 0.00001) + 0.000001, 1.0);\n"
+"	float m_d = (shadTexCol.x - RealDist);\n"
+"	float p = variance / (variance + m_d * m_d);\n"
+""
+"	return (1.0 - max(lit_factor, p)) / SAMPLE_AMOUNT;\n"
+"}\n"
+"##else\n"
+"float calcShadow(sampler2D map, float2 texCoords, float2 offset, float RealDist)"
+"{"
+"	float extractedDistance = tex2D(map, texCoords + offset).r;\n"
+"	return (extractedDistance <= RealDist ? (1.0  / SAMPLE_AMOUNT) : 0.0);\n"
+"}\n"
+"##endif\n"
+""
+"static const float2 offsetArray[16] = "
+"{"
+"	float2(0.0, 0.0),"
+"	float2(0.0, 1.0),"
+"	float2(1.0, -1.0),"
+"	float2(-1.0, 1.0),"
+"	float2(-2.0, 0.0),"
+"	float2(0.0, -2.0),"
+"	float2(-2.0, -2.0),"
+"	float2(2.0, 2.0),"
+"	float2(3.0, 0.0),"
+"	float2(0.0, 3.0),"
+"	float2(3.0, -3.0),"
+"	float2(-3.0, 3.0),"
+"	float2(-4.0, 0.0),"
+"	float2(0.0, -4.0),"
+"	float2(-4.0, -4.0),"
+"	float2(4.0, 4.0)"
+"};\n"
+""
+"float lightFactor(sampler2D map, float4 SMPos, float maxD, float4 rect)"
+"{"
+"	SMPos.xy = float2(SMPos.x, -SMPos.y) / SMPos.w / 2.0 + float2(0.5, 0.5);\n"
+""
+"	if(SMPos.x < rect.x || SMPos.y < rect.y || SMPos.x > rect.z || SMPos.y > rect.w || SMPos.z <= 0.0 || SMPos.z >= maxD)\n"
+"		return 0.0;\n"
+""
+"	float factor = 1.0;\n"
+"	float realDistance = SMPos.z / maxD - 0.005;\n"
+""
+"	for(int i = 0;i < SAMPLE_AMOUNT; ++i)"
+"		factor -= calcShadow(map, SMPos.xy, offsetArray[i] * MapTexel, realDistance);\n"
+""
+"##ifdef ROUND_SPOTLIGHTS\n"
+"	float2 tilePos = (SMPos.xy - rect.xy) / (rect.zw - rect.xy);\n"
+"	factor *= clamp(5.0 - 10.0 * length(tilePos - float2(0.5, 0.5)), 0.0, 1.0);\n"
+"##endif\n"
+""
+"	return factor;\n"
+"}\n"
+""
+"float atlasFactor(int light, float4 SMPos)"
+"{"
+"	if(LightAtlas[light] > 0.5)\n"
+"		return lightFactor(DynamicAtlasSampler, SMPos, LightFar[light], TileRect[light]);\n"
+""
+"	return lightFactor(StaticAtlasSampler, SMPos, LightFar[light], TileRect[light]);\n"
+"}\n"
+""
+"float4 pixelMain"
+"("
+"	float4 SMPos0 : TEXCOORD0,"
+"	float4 SMPos1 : TEXCOORD1,"
+"	float4 SMPos2 : TEXCOORD2,"
+"	float4 SMPos3 : TEXCOORD3,"
+"	float4 Lambert : TEXCOORD4"
+") : COLOR0"
+"{"
+"	return LightColour[0] * atlasFactor(0, SMPos0) * Lambert.x\n"
+"		+ LightColour[1] * atlasFactor(1, SMPos1) * Lambert.y\n"
+"		+ LightColour[2] * atlasFactor(2, SMPos2) * Lambert.z\n"
+"		+ LightColour[3] * atlasFactor(3, SMPos3) * Lambert.w;\n"
+"}"};
+
+
 const char* SIMPLE_P[ESE_COUNT] = {"uniform sampler2D ColorMapSampler;\n"
 ""
 "void main() "
@@ -517,4 +785,35 @@ const char* VSM_BLUR_P[ESE_COUNT] = {"uniform sampler2D ColorMapSampler;\n"
 "	return finalVal / 5.0;\n"
 "}\n"};
 
+// Pieces of the pixel shader wrapped around POST_STAGE post processing effects. The stage functions go
+// between the header and main, main gets one call per stage.
+const char* POST_STAGE_HEADER_P[ESE_COUNT] = {"uniform sampler2D ColorMapSampler;\n"
+"uniform sampler2D ScreenMapSampler;\n"
+"uniform sampler2D DepthMapSampler;\n"
+"uniform sampler2D UserMapSampler;\n"
+"\n"
+,
+"sampler2D ColorMapSampler : register(s0);\n"
+"sampler2D ScreenMapSampler : register(s1);\n"
+"sampler2D DepthMapSampler : register(s2);\n"
+"sampler2D UserMapSampler : register(s3);\n"
+"\n"};
+
+
+const char* POST_STAGE_MAIN_P[ESE_COUNT] = {"void main() \n"
+"{\n"
+"	vec2 texCoord = gl_TexCoord[0].xy;\n"
+"	vec4 colour = texture2D(ColorMapSampler, texCoord);\n"
+,
+"float4 pixelMain(float2 texCoord : TEXCOORD0) : COLOR0\n"
+"{\n"
+"	float4 colour = tex2D(ColorMapSampler, texCoord);\n"};
+
+
+const char* POST_STAGE_END_P[ESE_COUNT] = {"	gl_FragColor = colour;\n"
+"}\n"
+,
+"	return colour;\n"
+"}\n"};
+
 #endif
\ No newline at end of file
@@ -90,8 +90,10 @@ sol::table Empty::getBoundingBox() {
 }
 
 void Empty::destroy() {
-	if (emp)
+	if (emp) {
+		transformStore->remove(emp);
 		emp->remove();
+	}
 }
 
 void bindEmpty() {
@@ -0,0 +1,139 @@
+#include "FrameTimer.h"
+#include <chrono>
+#include <fstream>
+
+namespace {
+	// Weight of a new frame in the running averages
+	const double AVERAGE_WEIGHT = 0.05;
+}
+
+FrameTimer::FrameTimer() : mainThread(std::this_thread::get_id()), tracing(false), traceGeneration(0) {}
+
+unsigned long long FrameTimer::now() {
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FrameTimer::SRing* FrameTimer::getRing() {
+	// Rings outlive their threads, stopTrace still writes what a finished thread recorded
+	thread_local SRing* ring = nullptr;
+	if (!ring) {
+		std::lock_guard<std::mutex> guard(ringsLock);
+		rings.push_back(std::unique_ptr<SRing>(new SRing()));
+		ring = rings.back().get();
+		ring->thread = (unsigned int)rings.size();
+	}
+
+	// First event of a new trace on this thread
+	const unsigned int generation = traceGeneration;
+	if (ring->generation != generation) {
+		std::lock_guard<std::mutex> guard(ring->lock);
+		ring->events.assign(traceCapacity, SEvent());
+		ring->next = 0;
+		ring->wrapped = false;
+		ring->generation = generation;
+	}
+
+	return ring;
+}
+
+void FrameTimer::record(const char* name, unsigned long long startUs, unsigned long long endUs, int arg) {
+	if (std::this_thread::get_id() == mainThread) {
+		const double ms = (endUs - startUs) / 1000.0;
+
+		bool found = false;
+		for (SPhase& p : phases) {
+			if (p.name == name) {
+				p.frameMs += ms;
+				found = true;
+				break;
+			}
+		}
+
+		if (!found)
+			phases.push_back({ name, ms, 0.0, 0.0 });
+	}
+
+	if (!tracing)
+		return;
+
+	SRing* ring = getRing();
+	std::lock_guard<std::mutex> guard(ring->lock);
+	ring->events[ring->next] = { name, startUs, endUs - startUs, arg };
+	if (++ring->next == ring->events.size()) {
+		ring->next = 0;
+		ring->wrapped = true;
+	}
+}
+
+void FrameTimer::endFrame() {
+	const unsigned long long end = now();
+	if (frameStart) {
+		record("Frame", frameStart, end);
+
+		lastFrameMs = (end - frameStart) / 1000.0;
+		averageFrameMs = averageFrameMs == 0.0 ? lastFrameMs : averageFrameMs + (lastFrameMs - averageFrameMs) * AVERAGE_WEIGHT;
+	}
+	frameStart = end;
+
+	for (SPhase& p : phases) {
+		p.lastMs = p.frameMs;
+		p.averageMs += (p.frameMs - p.averageMs) * AVERAGE_WEIGHT;
+		p.frameMs = 0.0;
+	}
+}
+
+bool FrameTimer::startTrace(unsigned int eventsPerThread) {
+	if (tracing || eventsPerThread == 0)
+		return false;
+
+	// Rings are reset by their own threads on their next event
+	traceCapacity = eventsPerThread;
+	traceStart = now();
+	++traceGeneration;
+	tracing = true;
+	return true;
+}
+
+bool FrameTimer::stopTrace(const std::string& path) {
+	if (!tracing)
+		return false;
+
+	tracing = false;
+
+	std::ofstream out(path);
+	if (!out.is_open())
+		return false;
+
+	out << "{\"traceEvents\":[\n";
+	bool first = true;
+
+	std::lock_guard<std::mutex> guard(ringsLock);
+	for (auto& ring : rings) {
+		std::lock_guard<std::mutex> ringGuard(ring->lock);
+
+		// Oldest first, the ring only holds the most recent events once it wrapped
+		if (ring->events.empty())
+			continue;
+
+		const size_t count = ring->wrapped ? ring->events.size() : ring->next;
+		const size_t begin = ring->wrapped ? ring->next : 0;
+
+		for (size_t i = 0; i < count; ++i) {
+			const SEvent& e = ring->events[(begin + i) % ring->events.size()];
+			if (e.start < traceStart)
+				continue;
+
+			out << (first ? "" : ",\n") << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->thread
+				<< ",\"ts\":" << (e.start - traceStart) << ",\"dur\":" << e.duration;
+			if (e.arg >= 0)
+				out << ",\"args\":{\"index\":" << e.arg << "}";
+			out << "}";
+
+			first = false;
+		}
+	}
+
+	out << "\n]}\n";
+	return out.good();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+// CPU timings for the phases of a frame. Main thread phases are summed per frame into running averages for
+// Lime.GetFrameStats. While a trace is recording, every timed scope from any thread also goes into a ring
+// buffer owned by that thread, which stopTrace writes out as a Chrome trace_event file (chrome://tracing or
+// ui.perfetto.dev). Phase names must be string literals, they are kept by pointer.
+class FrameTimer
+{
+public:
+	struct SPhase {
+		const char* name;
+		double frameMs; // Summed over the current frame
+		double lastMs; // Previous frame
+		double averageMs;
+	};
+
+	FrameTimer();
+
+	static unsigned long long now(); // Microseconds on a steady clock
+
+	void record(const char* name, unsigned long long startUs, unsigned long long endUs, int arg = -1);
+
+	// Main thread, once at the end of every frame
+	void endFrame();
+
+	bool startTrace(unsigned int eventsPerThread = 65536);
+	bool stopTrace(const std::string& path);
+	bool isTracing() const { return tracing; }
+
+	const std::vector<SPhase>& getPhases() const { return phases; }
+	double getFrameMs() const { return lastFrameMs; }
+	double getAverageFrameMs() const { return averageFrameMs; }
+private:
+	struct SEvent {
+		const char* name;
+		unsigned long long start;
+		unsigned long long duration;
+		int arg;
+	};
+
+	// Written by its thread only, the lock is there for stopTrace reading it
+	struct SRing {
+		std::mutex lock;
+		std::vector<SEvent> events;
+		size_t next = 0;
+		bool wrapped = false;
+		unsigned int thread = 0;
+		unsigned int generation = 0; // Trace the events belong to
+	};
+
+	SRing* getRing();
+
+	std::thread::id mainThread;
+	std::vector<SPhase> phases; // Main thread only
+	unsigned long long frameStart = 0;
+	double lastFrameMs = 0.0;
+	double averageFrameMs = 0.0;
+
+	std::atomic<bool> tracing;
+	std::atomic<unsigned int> traceGeneration;
+	unsigned int traceCapacity = 0;
+	unsigned long long traceStart = 0;
+	std::mutex ringsLock;
+	std::vector<std::unique_ptr<SRing>> rings;
+};
+
+inline FrameTimer frameTimer;
+
+// Times the enclosing scope
+class ScopedPhase
+{
+public:
+	ScopedPhase(const char* n, int a = -1) : name(n), arg(a), start(FrameTimer::now()) {}
+	~ScopedPhase() { frameTimer.record(name, start, FrameTimer::now(), arg); }
+private:
+	const char* name;
+	int arg;
+	unsigned long long start;
+};
@@ -0,0 +1,74 @@
+#include "GCPacer.h"
+#include "FrameTimer.h"
+
+void GCPacer::setParameters(lua_State* L, int pauseIn, int stepMul) {
+	if (pauseIn > 0) {
+		pause = pauseIn;
+		lua_gc(L, LUA_GCSETPAUSE, pause);
+	}
+
+	if (stepMul > 0)
+		lua_gc(L, LUA_GCSETSTEPMUL, stepMul);
+}
+
+int GCPacer::getHeapKB(lua_State* L) const {
+	return lua_gc(L, LUA_GCCOUNT, 0);
+}
+
+float GCPacer::step(lua_State* L, float budgetMs) {
+	if (enabled != applied) {
+		lua_gc(L, enabled ? LUA_GCSTOP : LUA_GCRESTART, 0);
+		applied = enabled;
+		cycleHeapKB = getHeapKB(L);
+	}
+
+	if (!enabled)
+		return 0.0f;
+
+	const int heap = getHeapKB(L);
+
+	// Nothing allocated since the last cycle, the slack is better spent sleeping
+	if (heap <= cycleHeapKB)
+		return 0.0f;
+
+	const long long threshold = (long long)cycleHeapKB * pause / 100;
+	const float debt = threshold > 0 ? heap / (float)threshold : hardLimit;
+
+	if (debt >= hardLimit) {
+		// Pacing has fallen too far behind, a full cycle now keeps the heap bounded
+		ScopedPhase phase("GC");
+		const unsigned long long start = FrameTimer::now();
+
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		lua_gc(L, LUA_GCSTOP, 0);
+		cycleHeapKB = getHeapKB(L);
+
+		return (FrameTimer::now() - start) / 1000.0f;
+	}
+
+	// Past the threshold the minimum grows with the debt, so the work keeps up with the allocation rate
+	if (debt > 1.0f && budgetMs < minimumMs * debt)
+		budgetMs = minimumMs * debt;
+
+	if (budgetMs <= 0.0f)
+		return 0.0f;
+
+	ScopedPhase phase("GC");
+
+	const unsigned long long start = FrameTimer::now();
+	const unsigned long long budgetUs = (unsigned long long)(budgetMs * 1000.0f);
+
+	do {
+		const bool finished = lua_gc(L, LUA_GCSTEP, stepKB) != 0;
+
+		// A step moves the collector threshold, which hands collection back to the allocator until stopped again
+		lua_gc(L, LUA_GCSTOP, 0);
+
+		if (finished) {
+			cycleHeapKB = getHeapKB(L);
+			break;
+		}
+	} while (FrameTimer::now() - start < budgetUs);
+
+	return (FrameTimer::now() - start) / 1000.0f;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <sol/sol.hpp>
+
+// Takes Lua garbage collection off the allocation trigger and runs it in the idle part of each frame instead.
+// While enabled the automatic collector is stopped and step works through the incremental collector until the
+// given budget is used up or a cycle finishes. Once the heap grows past where the collector would have started
+// on its own (pause percent of the heap after the last cycle), at least minimumMs is spent even without slack,
+// scaled by how many times over that threshold the heap is. Should a script still allocate faster than that
+// reclaims, a full collection runs once the heap reaches hardLimit times the threshold, which bounds the heap at
+// the cost of one long frame.
+class GCPacer
+{
+public:
+	// Takes effect on the next step, disabling hands collection back to Lua
+	void setEnabled(bool enable) { enabled = enable; }
+	bool isEnabled() const { return enabled; }
+
+	// The collector's own pause and step multiplier, in percent
+	void setParameters(lua_State* state, int pause, int stepMul);
+
+	// Returns the milliseconds spent collecting
+	float step(lua_State* state, float budgetMs);
+
+	int getHeapKB(lua_State* state) const;
+
+	float minimumMs = 0.5f;
+	float hardLimit = 2.0f; // Multiple of the pause threshold that forces a full collection
+	int stepKB = 16; // Work per incremental step, the budget is checked between steps
+private:
+	bool enabled = true;
+	bool applied = false; // Collector state last set on the Lua side
+	int pause = 200;
+	int cycleHeapKB = 0; // Heap size when the last cycle finished
+};
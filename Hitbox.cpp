@@ -103,7 +103,10 @@ void Hitbox::setActive(bool a) {
 
 void Hitbox::destroy() {
 	if (node) node->remove();
-	if (holder) holder->remove();
+	if (holder) {
+		transformStore->remove(holder);
+		holder->remove();
+	}
 }
 
 void Hitbox::updateMaterial(bool updateOpacity, bool updateColor) {
@@ -59,6 +59,12 @@ void IrrHandling::initScene()
 	LuaLime l;
 	l.initLua(smgr, driver);
 
+	// Before main.lua, scripts can spawn coroutines and jobs at load time
+	scheduler = new Scheduler();
+	jobPool = new JobPool();
+	luaProfiler = new LuaProfiler();
+	gcPacer = new GCPacer();
+
 	// Is main.lua safe?
 	std::string mainPath = getMainPath(".");
 	if (mainPath == "") {
@@ -104,6 +110,10 @@ void IrrHandling::initScene()
 	device->setWindowCaption(L"Lime Application");
 
 	driver = device->getVideoDriver();
+	renderTargetPool = new RenderTargetPool(driver);
+
+	// Preprocessed shader sources are reused between runs
+	CShaderPreprocessor::setCacheDirectory("shadercache");
 	effects = new EffectHandler(device, driver->getScreenSize(), false, true, false);
 	smgr = device->getSceneManager();
 	guienv = device->getGUIEnvironment();
@@ -112,6 +122,11 @@ void IrrHandling::initScene()
 	smgr->setLightManager(0);
 
 	networkHandler = new NetworkHandler();
+	assetStreamer = new AssetStreamer();
+	lodManager = new LODManager();
+	occlusionCuller = new OcclusionCuller();
+	resolutionScaler = new ResolutionScaler(effects);
+	transformStore = new TransformStore();
 
 	appLoop();
 }
@@ -187,11 +202,6 @@ void IrrHandling::end() {
 
 void IrrHandling::appLoop() {
 
-	// Events
-	sol::protected_function luaOnStart = (*lua)["Lime"]["OnStart"];
-	sol::protected_function luaOnUpdate = (*lua)["Lime"]["OnUpdate"];
-	sol::protected_function luaOnEnd = (*lua)["Lime"]["OnEnd"];
-
 	bool ranHandlers = false;
 
 	lua->script("math.randomseed(os.time())");
@@ -201,9 +211,10 @@ void IrrHandling::appLoop() {
 
 	u32 then = device->getTimer()->getTime();
 
-	f32 const frameDur = 1000.f / m_frameLimit;
-
 	while (device->run()) {
+		// Read every frame, scripts can change the limit
+		f32 const frameDur = m_frameLimit > 0 ? 1000.f / m_frameLimit : 0.f;
+
 		receiver->lastFocused = nullptr;
 		const u32 now = device->getTimer()->getTime();
 		dt = (now - then) / 16.667f;
@@ -215,15 +226,23 @@ void IrrHandling::appLoop() {
 				networkHandler->handle(irrHandler);
 		}
 
+		receiver->dispatchCoalescedEvents();
+		transformStore->pull();
+
 		try {
-			if ((*lua)["Lime"]["OnUpdate"].get_type() == sol::type::function) {
-				sol::protected_function_result result = luaOnUpdate(dt);
+			ScopedPhase phase("Lua update");
+
+			if (sol::protected_function* luaOnUpdate = luaCallbacks.get(onUpdate)) {
+				sol::protected_function_result result = (*luaOnUpdate)(dt);
 				if (!result.valid())
 				{
 					sol::error err = result;
 					dConsole.sendMsg(std::string(err.what()).c_str(), MESSAGE_TYPE::WARNING);
 				}
 			}
+
+			// Coroutines waiting on Lime.Wait, WaitFrames and WaitUntil
+			scheduler->update(now);
 		}
 		catch (const sol::error& e) {
 			std::string err = e.what();
@@ -249,14 +268,29 @@ void IrrHandling::appLoop() {
 			mainCamera->setTarget(mainCameraForward->getAbsolutePosition());
 		}
 
-		//HandleTransformQueue();
+		{
+			ScopedPhase phase("Transforms");
+			transformStore->push();
+			//HandleTransformQueue();
+		}
 
-		HandleCameraQueue();
+		{
+			ScopedPhase phase("Render");
+			HandleCameraQueue();
+		}
 
-		if (!renderedGUI)
+		if (!renderedGUI) {
+			ScopedPhase phase("GUI");
 			guienv->drawAll();
+		}
 
-		driver->endScene();
+		{
+			ScopedPhase phase("End scene");
+			driver->endScene();
+		}
+		renderTargetPool->endFrame();
+		occlusionCuller->endFrame();
+		luaProfiler->endFrame();
 
 		updateFPS();
 
@@ -276,17 +310,58 @@ void IrrHandling::appLoop() {
 
 		// Rounding issue with FPS
 		f32 frameTime = device->getTimer()->getTime() - now;
-		if (frameTime < frameDur)
+
+		// endScene waits on the GPU once it falls behind, so this covers both sides
+		resolutionScaler->update(frameTime, frameDur, driver->getScreenSize());
+
+		// Garbage is collected in the half of the slack the sleep below leaves unused
+		frameTime += gcPacer->step(lua->lua_state(), frameTime < frameDur ? (frameDur - frameTime) / 2.0f : 0.0f);
+
+		if (frameTime < frameDur) {
+			ScopedPhase phase("Sleep");
 			device->sleep((frameDur - frameTime) / 2.0);
+		}
+
+		{
+			ScopedPhase phase("Event tasks");
+			irrHandler->runEventTasks();
+		}
+
+		{
+			ScopedPhase phase("Asset streaming");
+			assetStreamer->pump();
+		}
+
+		{
+			ScopedPhase phase("Jobs");
+			jobPool->pump();
+		}
 
-		irrHandler->runEventTasks();
-		irrHandler->runLuaTasks();
-		irrHandler->runPacketToSend();
+		{
+			ScopedPhase phase("Lua tasks");
+			irrHandler->runLuaTasks();
+		}
+
+		{
+			ScopedPhase phase("Packets out");
+			irrHandler->runPacketToSend();
+		}
+
+		frameTimer.endFrame();
 	}
 
 	if (networkHandler)
 		networkHandler->shutdown();
 
+	if (assetStreamer)
+		assetStreamer->shutdown();
+
+	if (jobPool)
+		jobPool->shutdown();
+
+	if (occlusionCuller)
+		occlusionCuller->shutdown();
+
 	testLuaFunc((*lua)["Lime"]["OnEnd"]);
 
 	if (!didEnd)
@@ -416,6 +491,13 @@ void IrrHandling::HandleCameraQueue() {
 
 	if (smgr->getActiveCamera()) {
 		setCameraMatrix(smgr->getActiveCamera());
+		lodManager->update(smgr->getActiveCamera());
+
+		// Shadow maps go first, casters hidden by the culler still cast
+		if (!legacyDrawing)
+			effects->updateShadowMaps();
+
+		occlusionCuller->cull(smgr->getActiveCamera());
 
 		if (legacyDrawing)
 			smgr->drawAll();
@@ -423,6 +505,8 @@ void IrrHandling::HandleCameraQueue() {
 			effects->update();
 			effects->setClearColour(irr::video::SColor(0, 0, 0, 0));
 		}
+
+		occlusionCuller->restore();
 	}
 
 	while (!cameraQueue.empty()) {
@@ -440,6 +524,12 @@ void IrrHandling::HandleCameraQueue() {
 				c.cam->updateAbsolutePosition();
 				c.forward->updateAbsolutePosition();
 				c.cam->setTarget(c.forward->getAbsolutePosition());
+				lodManager->update(c.cam);
+
+				if (!c.defaultRendering)
+					effects->updateShadowMaps();
+
+				occlusionCuller->cull(c.cam);
 
 				if (c.defaultRendering) {
 					smgr->drawAll();
@@ -447,6 +537,8 @@ void IrrHandling::HandleCameraQueue() {
 				else {
 					effects->update();
 				}
+
+				occlusionCuller->restore();
 			}
 		}
 
@@ -454,6 +546,9 @@ void IrrHandling::HandleCameraQueue() {
 	}
 
 	smgr->setActiveCamera(mainCamera);
+
+	// Shadow maps were shared by every view this frame, render them again next frame
+	effects->invalidateShadowMaps();
 }
 
 void IrrHandling::displayMessage(std::string title, std::string message, int image) {
@@ -566,25 +661,67 @@ void IrrHandling::runPacketToSend() {
 	tlqLock.unlock();
 }
 
-void IrrHandling::addLuaTask(sol::function f, sol::table args) {
-	threadedLuaQueue.push({ f, args });
+void IrrHandling::addLuaTask(sol::function f) {
+	threadedLuaQueue.push(LuaTask(f));
+}
+
+void IrrHandling::addLuaTask(sol::function f, long long a) {
+	LuaTask task(f);
+	task.args = LuaTask::INTEGERS;
+	task.count = 1;
+	task.integers[0] = a;
+	threadedLuaQueue.push(task);
+}
+
+void IrrHandling::addLuaTask(sol::function f, long long a, long long b) {
+	LuaTask task(f);
+	task.args = LuaTask::INTEGERS;
+	task.count = 2;
+	task.integers[0] = a;
+	task.integers[1] = b;
+	threadedLuaQueue.push(task);
+}
+
+void IrrHandling::addLuaTask(sol::function f, int channel, ENetPacket* packet, int sender) {
+	LuaTask task(f);
+	task.args = LuaTask::PACKET;
+	task.integers[0] = channel;
+	task.integers[1] = sender;
+	task.packet = packet;
+	threadedLuaQueue.push(task);
+}
+
+void IrrHandling::addLuaTask(sol::function f, sol::object arg) {
+	LuaTask task(f);
+	task.args = LuaTask::OBJECT;
+	task.object = arg;
+	threadedLuaQueue.push(task);
 }
 
 void IrrHandling::runLuaTasks() {
 	//tlqLock.lock();
 
 	while (!threadedLuaQueue.empty()) {
-		std::pair<sol::function, sol::table> task = threadedLuaQueue.front();
-		if (task.first.valid()) {
-			std::vector<sol::object> args;
-			if (task.second.valid()) {
-				for (size_t i = 1; i <= task.second.size(); ++i) {
-					args.push_back(task.second[i]);
-				}
-			}
-
+		const LuaTask& task = threadedLuaQueue.front();
+		if (task.function.valid()) {
 			try {
-				task.first(sol::as_args(args));
+				switch (task.args) {
+				case LuaTask::NONE:
+					task.function();
+					break;
+				case LuaTask::INTEGERS:
+					if (task.count == 1)
+						task.function(task.integers[0]);
+					else
+						task.function(task.integers[0], task.integers[1]);
+					break;
+				case LuaTask::PACKET:
+					task.function(task.integers[0], Packet(task.packet, (int)task.integers[1]));
+					break;
+				case LuaTask::OBJECT:
+					task.function(task.object);
+					break;
+				}
 			}
 			catch (const sol::error& e) {
 				std::string err = e.what();
@@ -603,6 +740,10 @@ void IrrHandling::runLuaTasks() {
 				end();
 			}
 		}
+		else if (task.args == LuaTask::PACKET && task.packet) {
+			// Nothing will wrap it in a Packet, so it has to be freed here
+			enet_packet_destroy(task.packet);
+		}
 		threadedLuaQueue.pop();
 	}
 
@@ -617,12 +758,13 @@ void IrrHandling::runEventTasks() {
 	bool doVerbose = verbose;
 	tlqLock.lock();
 
-	sol::protected_function SonPeerConnect = (*lua)["NetworkServer"]["OnClientConnect"];
-	sol::protected_function SonPeerDisconnect = (*lua)["NetworkServer"]["OnClientDisconnect"];
-	sol::protected_function SonPacketReceived = (*lua)["NetworkServer"]["OnPacketReceived"];
-	sol::protected_function ConConnect = (*lua)["NetworkClient"]["OnConnect"];
-	sol::protected_function ConDisconnect = (*lua)["NetworkClient"]["OnDisconnect"];
-	sol::protected_function ConPacketReceived = (*lua)["NetworkClient"]["OnPacketReceived"];
+	// Null when the handler is not declared
+	sol::protected_function* SonPeerConnect = luaCallbacks.get(onClientConnect);
+	sol::protected_function* SonPeerDisconnect = luaCallbacks.get(onClientDisconnect);
+	sol::protected_function* SonPacketReceived = luaCallbacks.get(onServerPacketReceived);
+	sol::protected_function* ConConnect = luaCallbacks.get(onConnect);
+	sol::protected_function* ConDisconnect = luaCallbacks.get(onDisconnect);
+	sol::protected_function* ConPacketReceived = luaCallbacks.get(onClientPacketReceived);
 
 	while (!eventOutQueue.empty()) {
 		std::pair<bool, ENetEvent> task = eventOutQueue.front();
@@ -631,13 +773,8 @@ void IrrHandling::runEventTasks() {
 		if (task.first) { // Server
 			switch (event.type) {
 			case ENET_EVENT_TYPE_CONNECT:
-				if (SonPeerConnect.valid()) {
-					sol::table t = lua->create_table();
-					t[1] = event.peer->incomingPeerID;
-					t[2] = event.peer->address.host;
-
-					addLuaTask(SonPeerConnect, t);
-				}
+				if (SonPeerConnect)
+					addLuaTask(*SonPeerConnect, event.peer->incomingPeerID, event.peer->address.host);
 				else {
 					if (doVerbose) dConsole.sendMsg("Networking WARNING: A peer connected but NetworkServer.OnClientConnect is not declared", MESSAGE_TYPE::NETWORK_VERBOSE);
 				}
@@ -653,13 +790,8 @@ void IrrHandling::runEventTasks() {
 				}
 				break;
 			case ENET_EVENT_TYPE_DISCONNECT:
-				if (SonPeerDisconnect.valid()) {
-					sol::table t = lua->create_table();
-					t[1] = event.peer->outgoingPeerID;
-					t[2] = event.peer->address.host;
-
-					addLuaTask(SonPeerDisconnect, t);
-				}
+				if (SonPeerDisconnect)
+					addLuaTask(*SonPeerDisconnect, event.peer->outgoingPeerID, event.peer->address.host);
 				else {
 					if (doVerbose) dConsole.sendMsg("Networking WARNING: A peer disconnected but NetworkServer.OnClientDisconnect is not declared", MESSAGE_TYPE::NETWORK_VERBOSE);
 				}
@@ -675,13 +807,8 @@ void IrrHandling::runEventTasks() {
 				}
 				break;
 			case ENET_EVENT_TYPE_RECEIVE:
-				if (SonPacketReceived.valid()) {
-					sol::table t = lua->create_table();
-					t[1] = event.channelID;
-					t[2] = Packet(event.packet, event.peer->incomingSessionID);
-
-					addLuaTask(SonPacketReceived, t);
-				}
+				if (SonPacketReceived)
+					addLuaTask(*SonPacketReceived, event.channelID, event.packet, event.peer->incomingSessionID);
 				else {
 					if (doVerbose) dConsole.sendMsg("Networking WARNING: A packet was received but NetworkServer.OnPacketReceived is not declared", MESSAGE_TYPE::NETWORK_VERBOSE);
 					enet_packet_destroy(event.packet);
@@ -692,8 +819,8 @@ void IrrHandling::runEventTasks() {
 		else { // Client
 			switch (event.type) {
 			case ENET_EVENT_TYPE_CONNECT:
-				if (ConConnect.valid())
-					addLuaTask(ConConnect, sol::table());
+				if (ConConnect)
+					addLuaTask(*ConConnect);
 				else {
 					if (doVerbose) dConsole.sendMsg("Networking WARNING: Client connected but NetworkClient.OnConnect is not declared", MESSAGE_TYPE::NETWORK_VERBOSE);
 				}
@@ -706,11 +833,8 @@ void IrrHandling::runEventTasks() {
 				}
 				break;
 			case ENET_EVENT_TYPE_DISCONNECT:
-				if (ConDisconnect.valid()) {
-					sol::table t = lua->create_table();
-					t[1] = event.data;
-					addLuaTask(ConDisconnect, t);
-				}
+				if (ConDisconnect)
+					addLuaTask(*ConDisconnect, event.data);
 				else {
 					if (doVerbose) dConsole.sendMsg("Networking WARNING: Client disconnected but NetworkClient.OnDisconnect is not declared", MESSAGE_TYPE::NETWORK_VERBOSE);
 				}
@@ -724,13 +848,8 @@ void IrrHandling::runEventTasks() {
 				}
 				break;
 			case ENET_EVENT_TYPE_RECEIVE:
-				if (ConPacketReceived.valid()) {
-					sol::table t = lua->create_table();
-					t[1] = event.channelID;
-					t[2] = Packet(event.packet, event.peer->incomingPeerID);
-
-					addLuaTask(ConPacketReceived, t);
-				}
+				if (ConPacketReceived)
+					addLuaTask(*ConPacketReceived, event.channelID, event.packet, event.peer->incomingPeerID);
 				else {
 					if (doVerbose) dConsole.sendMsg("Networking WARNING: A packet was received but NetworkClient.OnPacketReceived is not declared", MESSAGE_TYPE::NETWORK_VERBOSE);
 					enet_packet_destroy(event.packet);
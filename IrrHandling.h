@@ -13,6 +13,8 @@
 #include <string>
 #include "DebugConsole.h"
 #include "LuaLime.h"
+#include "LuaCallbacks.h"
+#include "FrameTimer.h"
 #include "XEffects.h"
 
 #include <queue>
@@ -48,11 +50,40 @@ public:
 	irr::core::vector3df transform = irr::core::vector3df();
 };
 
+// A queued Lua call. Arguments are kept as native values and pushed straight onto the stack when it runs,
+// so busy network events do not build a table per call
+struct LuaTask {
+public:
+	enum E_ARGS {
+		NONE,
+		INTEGERS, // integers[0 .. count - 1]
+		PACKET, // Channel in integers[0], the packet goes to Lua as a Packet from sender integers[1]
+		OBJECT
+	};
+
+	LuaTask(sol::function f) : function(f) {};
+
+	sol::function function;
+	E_ARGS args = NONE;
+	int count = 0;
+	long long integers[2] = { 0, 0 };
+	ENetPacket* packet = nullptr;
+	sol::object object;
+};
+
 class IrrHandling
 {
 private:
 	int lastTime = 0;
 	int frameCount = 0;
+
+	const int onUpdate = luaCallbacks.add("Lime", "OnUpdate");
+	const int onClientConnect = luaCallbacks.add("NetworkServer", "OnClientConnect");
+	const int onClientDisconnect = luaCallbacks.add("NetworkServer", "OnClientDisconnect");
+	const int onServerPacketReceived = luaCallbacks.add("NetworkServer", "OnPacketReceived");
+	const int onConnect = luaCallbacks.add("NetworkClient", "OnConnect");
+	const int onDisconnect = luaCallbacks.add("NetworkClient", "OnDisconnect");
+	const int onClientPacketReceived = luaCallbacks.add("NetworkClient", "OnPacketReceived");
 public:
 	void setDriver(irr::video::E_DRIVER_TYPE type);
 	void initScene();
@@ -101,7 +132,7 @@ public:
 	std::queue<BatchedTransform> transformQueue;
 
 	// Lua function call queue
-	std::queue<std::pair<sol::function, sol::table>> threadedLuaQueue;
+	std::queue<LuaTask> threadedLuaQueue;
 	std::queue<std::pair<bool, ENetEvent>> eventOutQueue;
 	std::queue<PacketToSend> packetOutQueue;
 	std::mutex tlqLock;
@@ -109,7 +140,11 @@ public:
 	void addPacketToSend(const PacketToSend& p);
 	void runPacketToSend();
 
-	void addLuaTask(sol::function f, sol::table args);
+	void addLuaTask(sol::function f);
+	void addLuaTask(sol::function f, long long a);
+	void addLuaTask(sol::function f, long long a, long long b);
+	void addLuaTask(sol::function f, int channel, ENetPacket* packet, int sender);
+	void addLuaTask(sol::function f, sol::object arg);
 	void runLuaTasks();
 
 	void addEventTask(bool, ENetEvent);
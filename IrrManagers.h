@@ -6,6 +6,16 @@
 #include "LightManager.h"
 #include <map>
 #include "NetworkHandler.h"
+#include "AssetStreamer.h"
+#include "LODManager.h"
+#include "OcclusionCuller.h"
+#include "RenderTargetPool.h"
+#include "ResolutionScaler.h"
+#include "TransformStore.h"
+#include "Scheduler.h"
+#include "JobPool.h"
+#include "LuaProfiler.h"
+#include "GCPacer.h"
 
 inline irr::IrrlichtDevice* device = nullptr;
 inline irr::video::IVideoDriver* driver = nullptr;
@@ -21,6 +31,16 @@ inline std::map<std::string, gui::IGUIFont*> fontCache;
 inline std::string defaultFont;
 inline CLightManager* lightManager = nullptr;
 inline NetworkHandler* networkHandler = nullptr;
+inline AssetStreamer* assetStreamer = nullptr;
+inline LODManager* lodManager = nullptr;
+inline OcclusionCuller* occlusionCuller = nullptr;
+inline RenderTargetPool* renderTargetPool = nullptr;
+inline ResolutionScaler* resolutionScaler = nullptr;
+inline TransformStore* transformStore = nullptr;
+inline Scheduler* scheduler = nullptr;
+inline JobPool* jobPool = nullptr;
+inline LuaProfiler* luaProfiler = nullptr;
+inline GCPacer* gcPacer = nullptr;
 
 inline irr::scene::ICameraSceneNode* mainCamera = nullptr;
 inline irr::scene::ISceneNode* mainCameraForward = nullptr;
\ No newline at end of file
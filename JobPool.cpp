@@ -0,0 +1,253 @@
+#include "JobPool.h"
+#include "IrrManagers.h"
+#include "Vector2D.h"
+#include "Vector3D.h"
+#include "Vector4D.h"
+
+namespace {
+	// Deep enough for any sane data, and stops reference cycles
+	const int MAX_DEPTH = 32;
+}
+
+SJobValue SJobValue::capture(const sol::object& object, int depth) {
+	SJobValue v;
+
+	switch (object.get_type()) {
+	case sol::type::boolean:
+		v.type = BOOLEAN;
+		v.number = object.as<bool>() ? 1.0 : 0.0;
+		break;
+	case sol::type::number:
+		v.type = NUMBER;
+		v.number = object.as<double>();
+		break;
+	case sol::type::string:
+		v.type = STRING;
+		v.string = object.as<std::string>();
+		break;
+	case sol::type::table:
+		if (depth >= MAX_DEPTH)
+			break;
+
+		v.type = TABLE;
+		for (auto& kv : object.as<sol::table>()) {
+			SJobValue key = capture(kv.first, depth + 1);
+			if (key.type != NIL)
+				v.table.push_back({ std::move(key), capture(kv.second, depth + 1) });
+		}
+		break;
+	case sol::type::userdata:
+		if (object.is<Vector3D>()) {
+			const Vector3D& u = object.as<Vector3D>();
+			v.type = VECTOR3;
+			v.vector[0] = u.x; v.vector[1] = u.y; v.vector[2] = u.z;
+		}
+		else if (object.is<Vector2D>()) {
+			const Vector2D& u = object.as<Vector2D>();
+			v.type = VECTOR2;
+			v.vector[0] = u.x; v.vector[1] = u.y;
+		}
+		else if (object.is<Vector4D>()) {
+			const Vector4D& u = object.as<Vector4D>();
+			v.type = VECTOR4;
+			v.vector[0] = u.x; v.vector[1] = u.y; v.vector[2] = u.z; v.vector[3] = u.w;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return v;
+}
+
+sol::object SJobValue::restore(lua_State* state) const {
+	switch (type) {
+	case BOOLEAN:
+		return sol::make_object(state, number != 0.0);
+	case NUMBER:
+		return sol::make_object(state, number);
+	case STRING:
+		return sol::make_object(state, string);
+	case TABLE: {
+		sol::table t = sol::state_view(state).create_table(0, (int)table.size());
+		for (const auto& kv : table)
+			t.raw_set(kv.first.restore(state), kv.second.restore(state));
+		return t;
+	}
+	case VECTOR2:
+		return sol::make_object(state, Vector2D(vector[0], vector[1]));
+	case VECTOR3:
+		return sol::make_object(state, Vector3D(vector[0], vector[1], vector[2]));
+	case VECTOR4:
+		return sol::make_object(state, Vector4D(vector[0], vector[1], vector[2], vector[3]));
+	default:
+		return sol::make_object(state, sol::lua_nil);
+	}
+}
+
+
+JobPool::JobPool() {}
+
+void JobPool::start(int workerCount) {
+	if (!workers.empty())
+		return;
+
+	if (workerCount <= 0)
+		workerCount = irr::core::clamp<int>((int)std::thread::hardware_concurrency() - 1, 1, 4);
+
+	finished = false;
+	for (int i = 0; i < workerCount; ++i)
+		workers.push_back(std::thread(&JobPool::workerBody, this));
+}
+
+void JobPool::shutdown() {
+	{
+		std::lock_guard<std::mutex> guard(jobLock);
+		finished = true;
+	}
+	jobSignal.notify_all();
+
+	for (std::thread& t : workers) {
+		if (t.joinable())
+			t.join();
+	}
+	workers.clear();
+
+	while (!pendingJobs.empty()) {
+		delete pendingJobs.front();
+		pendingJobs.pop();
+	}
+
+	while (!doneJobs.empty()) {
+		delete doneJobs.front();
+		doneJobs.pop();
+	}
+
+	callbacks.clear();
+}
+
+int JobPool::run(const std::string& path, const sol::object& args, sol::function callback) {
+	if (workers.empty())
+		start();
+
+	int id = nextID++;
+	if (callback.valid())
+		callbacks[id] = callback;
+
+	// Copied here on the main thread, workers never touch the main state
+	LuaJob* job = new LuaJob();
+	job->id = id;
+	job->path = path;
+	job->args = SJobValue::capture(args);
+
+	{
+		std::lock_guard<std::mutex> guard(jobLock);
+		pendingJobs.push(job);
+	}
+	jobSignal.notify_one();
+
+	return id;
+}
+
+void JobPool::openWorkerState(sol::state& state) {
+	state.open_libraries(sol::lib::base, sol::lib::math, sol::lib::string, sol::lib::table);
+
+	// Scripts only reach what they were given
+	state["dofile"] = sol::lua_nil;
+	state["loadfile"] = sol::lua_nil;
+
+	bindVector2D(state.lua_state());
+	bindVector3D(state.lua_state());
+	bindVector4D(state.lua_state());
+}
+
+void JobPool::workerBody() {
+	sol::state state;
+	openWorkerState(state);
+
+	std::unordered_map<std::string, sol::protected_function> scripts;
+
+	while (true) {
+		LuaJob* job = nullptr;
+
+		{
+			std::unique_lock<std::mutex> guard(jobLock);
+			jobSignal.wait(guard, [this] { return finished || !pendingJobs.empty(); });
+			if (finished)
+				return;
+
+			job = pendingJobs.front();
+			pendingJobs.pop();
+		}
+
+		auto it = scripts.find(job->path);
+		if (it == scripts.end()) {
+			sol::load_result chunk = state.load_file(job->path);
+			if (chunk.valid())
+				it = scripts.emplace(job->path, chunk.get<sol::protected_function>()).first;
+			else {
+				sol::error err = chunk;
+				job->error = err.what();
+			}
+		}
+
+		if (it != scripts.end()) {
+			sol::protected_function_result result = it->second(job->args.restore(state.lua_state()));
+			if (result.valid()) {
+				for (int i = 0; i < result.return_count(); ++i)
+					job->results.push_back(SJobValue::capture(result.get<sol::object>(i)));
+			}
+			else {
+				sol::error err = result;
+				job->error = err.what();
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(jobLock);
+			doneJobs.push(job);
+		}
+	}
+}
+
+void JobPool::pump() {
+	while (true) {
+		LuaJob* job = nullptr;
+
+		{
+			std::lock_guard<std::mutex> guard(jobLock);
+			if (doneJobs.empty())
+				break;
+
+			job = doneJobs.front();
+			doneJobs.pop();
+		}
+
+		if (!job->error.empty())
+			dConsole.sendMsg(("Job " + job->path + " failed: " + job->error).c_str(), MESSAGE_TYPE::WARNING);
+
+		auto it = callbacks.find(job->id);
+		if (it != callbacks.end()) {
+			std::vector<sol::object> results;
+			for (const SJobValue& v : job->results)
+				results.push_back(v.restore(lua->lua_state()));
+
+			sol::protected_function callback = it->second;
+			callbacks.erase(it);
+
+			sol::protected_function_result result = job->error.empty() ?
+				callback(sol::as_args(results)) : callback(sol::lua_nil, job->error);
+			if (!result.valid()) {
+				sol::error err = result;
+				dConsole.sendMsg(std::string(err.what()).c_str(), MESSAGE_TYPE::WARNING);
+			}
+		}
+
+		delete job;
+	}
+}
+
+int JobPool::getPendingCount() {
+	std::lock_guard<std::mutex> guard(jobLock);
+	return (int)(pendingJobs.size() + doneJobs.size());
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <sol/sol.hpp>
+#include <string>
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Plain data copied between Lua states. Functions, threads and engine objects other than vectors do not
+// survive the copy and arrive as nil.
+struct SJobValue {
+	enum E_TYPE {
+		NIL,
+		BOOLEAN,
+		NUMBER,
+		STRING, // Also how byte buffers travel
+		TABLE,
+		VECTOR2,
+		VECTOR3,
+		VECTOR4
+	};
+
+	E_TYPE type = NIL;
+	double number = 0.0; // Booleans too
+	float vector[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	std::string string;
+	std::vector<std::pair<SJobValue, SJobValue>> table;
+
+	static SJobValue capture(const sol::object& object, int depth = 0);
+	sol::object restore(lua_State* state) const;
+};
+
+// Work item shared between the main thread and the workers, the Lua callback stays on the main thread
+struct LuaJob {
+	int id = -1;
+	std::string path;
+	SJobValue args;
+
+	std::vector<SJobValue> results;
+	std::string error; // Set when the script failed, results are empty then
+};
+
+// Runs Lua scripts on worker threads, each with its own isolated sol::state. Worker states only get the base,
+// math, string and table libraries plus the vector types, with no engine, file or os access. A job script is
+// compiled once per worker and called with the job's arguments as ..., whatever it returns is copied back
+// and handed to the callback on the main thread.
+class JobPool
+{
+public:
+	JobPool();
+
+	void start(int workerCount = 0); // Spawn worker threads, 0 picks a count from the hardware
+	void shutdown(); // Stop and join worker threads
+
+	int run(const std::string& path, const sol::object& args, sol::function callback); // Returns job ID
+	void pump(); // Main thread only, delivers finished jobs to their callbacks
+
+	int getPendingCount();
+private:
+	void workerBody();
+	static void openWorkerState(sol::state& state);
+
+	int nextID = 0;
+	bool finished = false;
+
+	std::vector<std::thread> workers;
+
+	std::mutex jobLock;
+	std::condition_variable jobSignal;
+	std::queue<LuaJob*> pendingJobs; // Waiting for a worker
+	std::queue<LuaJob*> doneJobs; // Waiting for the main thread
+
+	std::unordered_map<int, sol::function> callbacks; // Main thread only
+};
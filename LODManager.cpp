@@ -0,0 +1,120 @@
+#include "LODManager.h"
+#include "IrrManagers.h"
+
+using namespace irr;
+using namespace scene;
+
+LODManager::LODManager() {}
+
+LODManager::~LODManager() {
+	clearAll();
+}
+
+void LODManager::setLevels(IAnimatedMeshSceneNode* node, const std::vector<SLODLevel>& levels) {
+	if (!node)
+		return;
+
+	clear(node);
+	if (levels.size() < 2)
+		return;
+
+	SLODChain& chain = chains[node];
+	chain.levels = levels;
+
+	node->grab();
+	for (SLODLevel& l : chain.levels)
+		l.mesh->grab();
+}
+
+void LODManager::clear(IAnimatedMeshSceneNode* node) {
+	auto it = chains.find(node);
+	if (it == chains.end())
+		return;
+
+	release(node, it->second);
+	chains.erase(it);
+}
+
+void LODManager::clearAll() {
+	for (auto& kv : chains)
+		release(kv.first, kv.second);
+	chains.clear();
+}
+
+void LODManager::release(IAnimatedMeshSceneNode* node, SLODChain& chain) {
+	show(node, chain, 0);
+
+	for (SLODLevel& l : chain.levels)
+		l.mesh->drop();
+	chain.levels.clear();
+
+	node->drop();
+}
+
+void LODManager::show(IAnimatedMeshSceneNode* node, SLODChain& chain, u32 level) {
+	if (chain.shown == level || level >= chain.levels.size())
+		return;
+
+	// setMesh resets the node's materials from the mesh buffers, keep whatever was loaded onto the node
+	core::array<video::SMaterial> materials;
+	for (u32 i = 0; i < node->getMaterialCount(); ++i)
+		materials.push_back(node->getMaterial(i));
+
+	node->setMesh(chain.levels[level].mesh);
+
+	for (u32 i = 0; i < node->getMaterialCount() && i < materials.size(); ++i)
+		node->getMaterial(i) = materials[i];
+
+	effects->markShadowNodeMaterialsChanged(node);
+	chain.shown = level;
+}
+
+void LODManager::update(ICameraSceneNode* camera) {
+	if (!camera || chains.empty())
+		return;
+
+	const core::vector3df cameraPosition = camera->getAbsolutePosition();
+
+	for (auto it = chains.begin(); it != chains.end();) {
+		IAnimatedMeshSceneNode* node = it->first;
+		SLODChain& chain = it->second;
+
+		// Only referenced from here, the owning mesh was destroyed
+		if (node->getReferenceCount() == 1) {
+			release(node, chain);
+			it = chains.erase(it);
+			continue;
+		}
+
+		if (!node->isVisible() || !node->getParent()) {
+			++it;
+			continue;
+		}
+
+		const f32 distance = node->getTransformedBoundingBox().getCenter().getDistanceFrom(cameraPosition);
+		const u32 count = (u32)chain.levels.size();
+
+		auto selected = chain.selected.find(camera);
+		u32 level = selected != chain.selected.end() ? selected->second : 0;
+
+		while (level + 1 < count && distance > chain.levels[level + 1].distance * (1.0f + hysteresis))
+			++level;
+		while (level > 0 && distance < chain.levels[level].distance * (1.0f - hysteresis))
+			--level;
+
+		chain.selected[camera] = level;
+		show(node, chain, level);
+
+		++it;
+	}
+}
+
+int LODManager::getLevel(IAnimatedMeshSceneNode* node) const {
+	auto it = chains.find(node);
+	return it != chains.end() ? (int)it->second.shown : 0;
+}
+
+int LODManager::getLevelCount(IAnimatedMeshSceneNode* node) const {
+	auto it = chains.find(node);
+	return it != chains.end() ? (int)it->second.levels.size() : 1;
+}
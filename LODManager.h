@@ -0,0 +1,42 @@
+#pragma once
+
+#include <irrlicht.h>
+#include <vector>
+#include <unordered_map>
+
+struct SLODLevel {
+	irr::scene::IAnimatedMesh* mesh = nullptr;
+	irr::f32 distance = 0.0f; // Camera distance at which this level starts
+};
+
+// Distance based mesh swapping for animated mesh scene nodes. Levels are picked separately for every camera
+// that renders the scene (update is called right before each camera draws, so shadow passes use the same level).
+class LODManager
+{
+public:
+	LODManager();
+	~LODManager();
+
+	// Level 0 should be the node's full resolution mesh at distance 0, meshes are grabbed
+	void setLevels(irr::scene::IAnimatedMeshSceneNode* node, const std::vector<SLODLevel>& levels);
+	void clear(irr::scene::IAnimatedMeshSceneNode* node);
+	void clearAll();
+
+	void update(irr::scene::ICameraSceneNode* camera);
+
+	int getLevel(irr::scene::IAnimatedMeshSceneNode* node) const;
+	int getLevelCount(irr::scene::IAnimatedMeshSceneNode* node) const;
+
+	irr::f32 hysteresis = 0.1f; // Fraction of a switch distance the camera has to pass before switching back
+private:
+	struct SLODChain {
+		std::vector<SLODLevel> levels;
+		std::unordered_map<irr::scene::ICameraSceneNode*, irr::u32> selected; // Last level picked per camera
+		irr::u32 shown = 0;
+	};
+
+	void show(irr::scene::IAnimatedMeshSceneNode* node, SLODChain& chain, irr::u32 level);
+	void release(irr::scene::IAnimatedMeshSceneNode* node, SLODChain& chain);
+
+	std::unordered_map<irr::scene::IAnimatedMeshSceneNode*, SLODChain> chains;
+};
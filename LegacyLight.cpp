@@ -134,8 +134,10 @@ void LegacyLight::setFalloff(float f) {
 }
 
 void LegacyLight::destroy() {
-	if (light)
+	if (light) {
+		transformStore->remove(light);
 		light->remove();
+	}
 }
 
 bool LegacyLight::getDebug() {
@@ -44,6 +44,14 @@ Vector3D Light::getPosition() {
 	return true ? Vector3D(target->getPosition().X, target->getPosition().Y, target->getPosition().Z) : Vector3D();
 }
 
+void Light::getPositionInto(Vector3D& out) {
+	copyInto(target->getPosition(), out);
+}
+
+std::tuple<float, float, float> Light::getPositionXYZ() {
+	return toTuple(target->getPosition());
+}
+
 void Light::setPosition(const Vector3D& pos) {
 	if (true) {
 		holder->setPosition(vector3df(pos.x, pos.y, pos.z));
@@ -110,9 +118,46 @@ void Light::setActive(bool enable) {
 	effects->getShadowLight(index).active = enable;
 }
 
+int Light::getCascades() {
+	return effects->getShadowLight(index).getCascadeCount();
+}
+
+void Light::setCascades(int count) {
+	SShadowLight& l = effects->getShadowLight(index);
+	l.setCascades(count < 1 ? 1 : count, l.getCascadeSplitLambda());
+}
+
+float Light::getCascadeSplit() {
+	return effects->getShadowLight(index).getCascadeSplitLambda();
+}
+
+void Light::setCascadeSplit(float lambda) {
+	SShadowLight& l = effects->getShadowLight(index);
+	l.setCascades(l.getCascadeCount(), lambda);
+}
+
+float Light::getShadowDistance() {
+	return effects->getShadowLight(index).shadowDistance;
+}
+
+void Light::setShadowDistance(float distance) {
+	effects->getShadowLight(index).shadowDistance = distance;
+}
+
+bool Light::getStatic() {
+	return effects->getShadowLight(index).staticShadow;
+}
+
+void Light::setStatic(bool enable) {
+	effects->getShadowLight(index).staticShadow = enable;
+}
+
 void Light::destroy() {
 	effects->removeLightNode(index);
 	index = -1;
+
+	if (holder)
+		transformStore->remove(holder);
 }
 
 bool Light::getDebug() {
@@ -141,7 +186,11 @@ void bindLight() {
 		"precisionPlanes", sol::property(&Light::getViewPlanes, &Light::setViewPlanes),
 		"fieldOfView", sol::property(&Light::getFOV, &Light::setFOV),
 		"directional", sol::property(&Light::getDirectional, &Light::setDirectional),
-		"active", sol::property(&Light::getActive, &Light::setActive)
+		"active", sol::property(&Light::getActive, &Light::setActive),
+		"cascades", sol::property(&Light::getCascades, &Light::setCascades),
+		"cascadeSplit", sol::property(&Light::getCascadeSplit, &Light::setCascadeSplit),
+		"shadowDistance", sol::property(&Light::getShadowDistance, &Light::setShadowDistance),
+		"static", sol::property(&Light::getStatic, &Light::setStatic)
 	);
 
 	bind_type["destroy"] = &Light::destroy;
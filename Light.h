@@ -30,6 +30,10 @@ public:
     Vector3D getPosition();
     void setPosition(const Vector3D& pos);
 
+    // Same source as the position property
+    void getPositionInto(Vector3D& out) override;
+    std::tuple<float, float, float> getPositionXYZ() override;
+
     Vector3D getRotation();
     void setRotation(const Vector3D& rot);
 
@@ -48,6 +52,18 @@ public:
     bool getActive();
     void setActive(bool enable);
 
+    int getCascades();
+    void setCascades(int count);
+
+    float getCascadeSplit();
+    void setCascadeSplit(float lambda);
+
+    float getShadowDistance();
+    void setShadowDistance(float distance);
+
+    bool getStatic();
+    void setStatic(bool enable);
+
     void destroy();
 
     bool getDebug();
@@ -0,0 +1,97 @@
+#include "LightGrid.h"
+
+using namespace irr;
+using namespace core;
+
+LightGrid::LightGrid(u32 columnsIn, u32 rowsIn)
+	: columns(columnsIn), rows(rowsIn)
+{
+	masks.set_used(columns * rows);
+}
+
+
+void LightGrid::begin(const matrix4& viewProjection)
+{
+	viewProj = viewProjection;
+
+	for (u32 i = 0; i < masks.size(); ++i)
+		masks[i] = 0;
+}
+
+
+void LightGrid::addLight(u32 bit, const vector3df& center, f32 radius)
+{
+	if (bit >= MAX_LIGHTS)
+		return;
+
+	rect<s32> tiles;
+	if (!getTileRect(aabbox3df(center - vector3df(radius), center + vector3df(radius)), tiles))
+		return;
+
+	for (s32 y = tiles.UpperLeftCorner.Y; y <= tiles.LowerRightCorner.Y; ++y)
+		for (s32 x = tiles.UpperLeftCorner.X; x <= tiles.LowerRightCorner.X; ++x)
+			masks[y * columns + x] |= 1u << bit;
+}
+
+
+u32 LightGrid::getLightMask(const aabbox3df& box) const
+{
+	rect<s32> tiles;
+	if (!getTileRect(box, tiles))
+		return 0;
+
+	u32 mask = 0;
+	for (s32 y = tiles.UpperLeftCorner.Y; y <= tiles.LowerRightCorner.Y; ++y)
+		for (s32 x = tiles.UpperLeftCorner.X; x <= tiles.LowerRightCorner.X; ++x)
+			mask |= masks[y * columns + x];
+
+	return mask;
+}
+
+
+bool LightGrid::getTileRect(const aabbox3df& box, rect<s32>& tiles) const
+{
+	vector3df corners[8];
+	box.getEdges(corners);
+
+	f32 minX = 1.0f, minY = 1.0f, maxX = -1.0f, maxY = -1.0f;
+	bool clipped = false;
+
+	for (u32 i = 0; i < 8; ++i)
+	{
+		f32 clip[4];
+		viewProj.transformVect(clip, corners[i]);
+
+		// Anything reaching behind the camera could cover the whole screen.
+		if (clip[3] <= 0.0001f)
+		{
+			clipped = true;
+			break;
+		}
+
+		const f32 x = clip[0] / clip[3];
+		const f32 y = clip[1] / clip[3];
+
+		minX = min_(minX, x);
+		minY = min_(minY, y);
+		maxX = max_(maxX, x);
+		maxY = max_(maxY, y);
+	}
+
+	if (clipped)
+	{
+		tiles = rect<s32>(0, 0, columns - 1, rows - 1);
+		return true;
+	}
+
+	if (maxX < -1.0f || minX > 1.0f || maxY < -1.0f || minY > 1.0f)
+		return false;
+
+	// Tile rows run top to bottom, normalized device y bottom to top.
+	tiles.UpperLeftCorner.X = clamp((s32)((minX * 0.5f + 0.5f) * columns), 0, (s32)columns - 1);
+	tiles.LowerRightCorner.X = clamp((s32)((maxX * 0.5f + 0.5f) * columns), 0, (s32)columns - 1);
+	tiles.UpperLeftCorner.Y = clamp((s32)((0.5f - maxY * 0.5f) * rows), 0, (s32)rows - 1);
+	tiles.LowerRightCorner.Y = clamp((s32)((0.5f - minY * 0.5f) * rows), 0, (s32)rows - 1);
+
+	return true;
+}
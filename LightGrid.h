@@ -0,0 +1,35 @@
+#ifndef H_XEFFECTS_LIGHT_GRID
+#define H_XEFFECTS_LIGHT_GRID
+
+#include <irrlicht.h>
+
+/// Bins light volumes into a coarse grid of screen tiles on the CPU. Each tile keeps a bit mask of the
+/// lights touching it, so a node only has to look at the tiles under its screen rectangle to find
+/// the lights it needs. Up to 32 lights can be binned.
+class LightGrid
+{
+public:
+	LightGrid(irr::u32 columns = 16, irr::u32 rows = 9);
+
+	/// Clears every tile and sets the camera the following lights and queries are projected with.
+	void begin(const irr::core::matrix4& viewProjection);
+
+	/// Bins a light's bounding sphere under the given bit.
+	void addLight(irr::u32 bit, const irr::core::vector3df& center, irr::f32 radius);
+
+	/// Lights touching any tile covered by the box on screen.
+	irr::u32 getLightMask(const irr::core::aabbox3df& box) const;
+
+	static const irr::u32 MAX_LIGHTS = 32;
+
+private:
+	/// Tile range covered by a world space box, false when it is entirely off screen.
+	bool getTileRect(const irr::core::aabbox3df& box, irr::core::rect<irr::s32>& tiles) const;
+
+	irr::u32 columns;
+	irr::u32 rows;
+	irr::core::matrix4 viewProj;
+	irr::core::array<irr::u32> masks;
+};
+
+#endif
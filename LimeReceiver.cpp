@@ -39,12 +39,12 @@ bool LimeReceiver::OnEvent(const SEvent& event)
 
         if (event.KeyInput.PressedDown) {
             if (!keysRepeat[event.KeyInput.Key]) {
-                callLuaFunction("Input", "OnKeyPressed", static_cast<irr::EKEY_CODE>(event.KeyInput.Key));
+                callLuaFunction(onKeyPressed, static_cast<irr::EKEY_CODE>(event.KeyInput.Key));
                 keysRepeat[event.KeyInput.Key] = true;
             }
         }
         else {
-            callLuaFunction("Input", "OnKeyReleased", static_cast<irr::EKEY_CODE>(event.KeyInput.Key));
+            callLuaFunction(onKeyReleased, static_cast<irr::EKEY_CODE>(event.KeyInput.Key));
             keysRepeat[event.KeyInput.Key] = false;
         }
     }
@@ -56,7 +56,7 @@ bool LimeReceiver::OnEvent(const SEvent& event)
         {
         case EMIE_LMOUSE_PRESSED_DOWN:
             MouseState.LeftButtonDown = true;
-            callLuaFunction("Input", "OnLeftMouseClick");
+            callLuaFunction(onLeftMouseClick);
             break;
 
         case EMIE_LMOUSE_LEFT_UP:
@@ -65,7 +65,7 @@ bool LimeReceiver::OnEvent(const SEvent& event)
 
         case EMIE_RMOUSE_PRESSED_DOWN:
             MouseState.RightButtonDown = true;
-            callLuaFunction("Input", "OnRightMouseClick");
+            callLuaFunction(onRightMouseClick);
             break;
 
         case EMIE_RMOUSE_LEFT_UP:
@@ -74,7 +74,7 @@ bool LimeReceiver::OnEvent(const SEvent& event)
 
         case EMIE_MMOUSE_PRESSED_DOWN:
             MouseState.MiddleButtonDown = true;
-            callLuaFunction("Input", "OnMiddleMouseClick");
+            callLuaFunction(onMiddleMouseClick);
             break;
 
         case EMIE_MMOUSE_LEFT_UP:
@@ -84,12 +84,12 @@ bool LimeReceiver::OnEvent(const SEvent& event)
         case EMIE_MOUSE_MOVED:
             MouseState.Position.X = event.MouseInput.X;
             MouseState.Position.Y = event.MouseInput.Y;
-            callLuaFunction("Input", "OnMouseMove", Vector2D(MouseState.Position.X, MouseState.Position.Y));
+            mouseMoved = true; // Dispatched once per frame with the last position
             break;
 
         case EMIE_MOUSE_WHEEL:
             MouseState.WheelDelta = event.MouseInput.Wheel;
-            callLuaFunction("Input", "OnMouseScroll", MouseState.WheelDelta);
+            callLuaFunction(onMouseScroll, MouseState.WheelDelta);
             break;
 
         default:
@@ -134,6 +134,14 @@ bool LimeReceiver::OnEvent(const SEvent& event)
     return false;
 }
 
+void LimeReceiver::dispatchCoalescedEvents()
+{
+    if (mouseMoved) {
+        mouseMoved = false;
+        callLuaFunction(onMouseMove, Vector2D(MouseState.Position.X, MouseState.Position.Y));
+    }
+}
+
 sol::table LimeReceiver::getMouseState() const
 {
     sol::table table = lua->create_table();
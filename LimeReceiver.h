@@ -2,6 +2,7 @@
 #include <irrlicht.h>
 #include <sol/sol.hpp>
 #include "LuaLime.h"
+#include "LuaCallbacks.h"
 #include "Vector2D.h"
 
 class ButtonCallbackPairClick {
@@ -66,6 +67,9 @@ public:
 
     virtual bool OnEvent(const SEvent& event) override;
 
+    // Runs the handlers for events that are merged into one call per frame (OnMouseMove)
+    void dispatchCoalescedEvents();
+
     sol::table getMouseState() const;
 
     sol::table getControllerState() const;
@@ -77,24 +81,28 @@ private:
     std::array<bool, KEY_KEY_CODES_COUNT> keys;
     std::array<bool, KEY_KEY_CODES_COUNT> keysRepeat;
     SEvent::SJoystickEvent JoystickState;
+    bool mouseMoved = false;
+
+    const int onKeyPressed = luaCallbacks.add("Input", "OnKeyPressed");
+    const int onKeyReleased = luaCallbacks.add("Input", "OnKeyReleased");
+    const int onLeftMouseClick = luaCallbacks.add("Input", "OnLeftMouseClick");
+    const int onRightMouseClick = luaCallbacks.add("Input", "OnRightMouseClick");
+    const int onMiddleMouseClick = luaCallbacks.add("Input", "OnMiddleMouseClick");
+    const int onMouseMove = luaCallbacks.add("Input", "OnMouseMove");
+    const int onMouseScroll = luaCallbacks.add("Input", "OnMouseScroll");
 
+    // Handlers that are not declared are skipped silently, most scripts only use a few of them
     template<typename... Args>
-    void callLuaFunction(const std::string& tableName, const std::string& functionName, Args&&... args)
+    void callLuaFunction(int callback, Args&&... args)
     {
-        sol::object obj = (*lua)[tableName][functionName];
-        if (obj.get_type() == sol::type::function)
-        {
-            sol::protected_function func = obj.as<sol::protected_function>();
-            sol::protected_function_result result = func(std::forward<Args>(args)...);
-            if (!result.valid()) {
-                sol::error err = result;
-                dConsole.sendMsg(std::string(err.what()).c_str(), MESSAGE_TYPE::WARNING);
-            }
-        }
-        else {
-            // Uncommenting this prints errors for things like Input.OnMouseMove etc.
-            //std::string out = "Function " + tableName + "." + functionName + " not found or callable.";
-            //dConsole.sendMsg(out.c_str(), MESSAGE_TYPE::WARNING);
+        sol::protected_function* func = luaCallbacks.get(callback);
+        if (!func)
+            return;
+
+        sol::protected_function_result result = (*func)(std::forward<Args>(args)...);
+        if (!result.valid()) {
+            sol::error err = result;
+            dConsole.sendMsg(std::string(err.what()).c_str(), MESSAGE_TYPE::WARNING);
         }
     }
 
@@ -0,0 +1,138 @@
+#include "LuaCallbacks.h"
+#include "LuaLime.h"
+#include <algorithm>
+
+int LuaCallbacks::add(const std::string& table, const std::string& name) {
+	for (size_t i = 0; i < callbacks.size(); ++i)
+		if (callbacks[i].table == table && callbacks[i].name == name)
+			return (int)i;
+
+	SCallback c;
+	c.table = table;
+	c.name = name;
+	callbacks.push_back(c);
+
+	return (int)callbacks.size() - 1;
+}
+
+bool LuaCallbacks::isHandlerKey(const sol::object& key) {
+	if (key.get_type() != sol::type::string)
+		return false;
+
+	const std::string name = key.as<std::string>();
+	return name.size() > 2 && name.compare(0, 2, "On") == 0;
+}
+
+std::tuple<sol::object, sol::table, sol::object> LuaCallbacks::pairsOver(sol::table self, sol::table hidden, sol::this_state s) {
+	sol::state_view state(s);
+
+	// A snapshot, assigning fields while iterating it behaves like it would on a plain table
+	sol::table merged = state.create_table();
+	for (auto& kv : self)
+		merged.raw_set(kv.first, kv.second);
+	for (auto& kv : hidden)
+		merged.raw_set(kv.first, kv.second);
+
+	return { state.globals().raw_get<sol::object>("next"), merged, sol::make_object(state, sol::lua_nil) };
+}
+
+void LuaCallbacks::watch(sol::state& state, const std::string& name) {
+	if (!hiddenGlobals.valid())
+		guardGlobals(state);
+
+	// Out of the raw globals, so replacing the table later goes through __newindex as well
+	sol::table globals = state.globals();
+	sol::object table = globals.raw_get<sol::object>(name);
+	globals.raw_set(name, sol::lua_nil);
+
+	watched.push_back(name);
+	setGlobal(state, name, table);
+}
+
+void LuaCallbacks::guardGlobals(sol::state_view state) {
+	hiddenGlobals = state.create_table();
+	sol::table hidden = hiddenGlobals;
+
+	// Only fires for globals that do not exist yet, assigning existing ones stays a raw store
+	sol::table meta = state.create_table();
+	meta["__index"] = hidden;
+	meta["__newindex"] = [this](sol::table self, sol::object key, sol::object value, sol::this_state s) {
+		if (key.get_type() == sol::type::string) {
+			const std::string name = key.as<std::string>();
+			if (std::find(watched.begin(), watched.end(), name) != watched.end()) {
+				setGlobal(s, name, value);
+				return;
+			}
+		}
+
+		self.raw_set(key, value);
+	};
+	meta["__pairs"] = [hidden](sol::table self, sol::this_state s) { return pairsOver(self, hidden, s); };
+
+	state.globals()[sol::metatable_key] = meta;
+}
+
+void LuaCallbacks::setGlobal(sol::state_view state, const std::string& name, sol::object value) {
+	if (value.get_type() == sol::type::table)
+		hook(state, value.as<sol::table>());
+
+	hiddenGlobals.raw_set(name, value);
+	invalidate();
+}
+
+void LuaCallbacks::hook(sol::state_view state, sol::table table) {
+	// Already hooked under another name, or a script's own metatable which is not replaced
+	sol::object existing = table[sol::metatable_key];
+	if (existing.get_type() != sol::type::lua_nil)
+		return;
+
+	sol::table storage = state.create_table();
+
+	// Handlers set before this have to leave the raw table too, or assigning them again would skip __newindex
+	std::vector<std::pair<sol::object, sol::object>> moved;
+	for (auto& kv : table)
+		if (isHandlerKey(kv.first))
+			moved.push_back({ kv.first, kv.second });
+
+	for (auto& kv : moved) {
+		storage.raw_set(kv.first, kv.second);
+		table.raw_set(kv.first, sol::lua_nil);
+	}
+
+	sol::table meta = state.create_table();
+	meta["__index"] = storage;
+	meta["__newindex"] = [this, storage](sol::table self, sol::object key, sol::object value) mutable {
+		if (isHandlerKey(key)) {
+			storage.raw_set(key, value);
+			invalidate();
+		}
+		else
+			self.raw_set(key, value);
+	};
+	meta["__pairs"] = [storage](sol::table self, sol::this_state s) { return pairsOver(self, storage, s); };
+
+	table[sol::metatable_key] = meta;
+}
+
+sol::protected_function* LuaCallbacks::get(int id) {
+	if (!lua || id < 0 || id >= (int)callbacks.size())
+		return nullptr;
+
+	SCallback& c = callbacks[id];
+	if (c.version != version) {
+		c.version = version;
+		c.callable = false;
+		c.function = sol::protected_function();
+
+		sol::object table = (*lua)[c.table];
+		if (table.get_type() == sol::type::table) {
+			sol::object f = table.as<sol::table>()[c.name];
+			if (f.get_type() == sol::type::function) {
+				c.function = f.as<sol::protected_function>();
+				c.callable = true;
+			}
+		}
+	}
+
+	return c.callable ? &c.function : nullptr;
+}
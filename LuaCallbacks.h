@@ -0,0 +1,54 @@
+#pragma once
+
+#include <sol/sol.hpp>
+#include <string>
+#include <vector>
+#include <tuple>
+
+// Lua event handlers (Input.OnKeyPressed, NetworkServer.OnPacketReceived, ...) kept as resolved references instead
+// of being looked up by name on every event. watch moves a table's On* fields into a hidden table behind its
+// metatable, so every assignment to one goes through __newindex and bumps the version. The watched globals are kept
+// the same way behind the globals table, so a script replacing a whole table (Input = { ... }) gets the new table
+// watched too. Handlers are only looked up again after the version changed.
+//
+// Because of this, rawget on a watched table does not see its handlers, and rawget on _G does not see the watched
+// tables. pairs still sees both where __pairs is honoured (LuaJIT built with LUAJIT_ENABLE_LUA52COMPAT). A
+// replacement table that already has a metatable is left alone, its handlers are only looked up again when one of
+// the watched globals is assigned.
+class LuaCallbacks
+{
+public:
+	// Returns the id get takes, can be called before the Lua state exists
+	int add(const std::string& table, const std::string& name);
+
+	// Call once for every global table holding handlers, after it is created and before scripts run
+	void watch(sol::state& state, const std::string& table);
+
+	// The handler, null when the field does not hold a function
+	sol::protected_function* get(int id);
+
+	// Looks every handler up again on its next get
+	void invalidate() { ++version; }
+private:
+	struct SCallback {
+		std::string table;
+		std::string name;
+		sol::protected_function function;
+		bool callable = false;
+		unsigned int version = 0;
+	};
+
+	void guardGlobals(sol::state_view state);
+	void setGlobal(sol::state_view state, const std::string& name, sol::object value);
+	void hook(sol::state_view state, sol::table table);
+
+	static bool isHandlerKey(const sol::object& key);
+	static std::tuple<sol::object, sol::table, sol::object> pairsOver(sol::table self, sol::table hidden, sol::this_state s);
+
+	std::vector<SCallback> callbacks;
+	std::vector<std::string> watched; // Global names kept in hiddenGlobals
+	sol::table hiddenGlobals;
+	unsigned int version = 1;
+};
+
+inline LuaCallbacks luaCallbacks;
@@ -22,16 +22,19 @@
 #include "Hitbox.h"
 #include "Packet.h"
 #include "MeshBuffer.h"
+#include "MeshInstanceSet.h"
+#include "StaticBatch.h"
 
 #include "Compatible2D.h"
 #include "Compatible3D.h"
+#include "LuaCallbacks.h"
 
 #include <sol/sol.hpp>
 #include <sstream>
 
 int LuaLime::initLua(irr::scene::ISceneManager* smgr, irr::video::IVideoDriver* driver) {
 	lua = new sol::state(); // maybe change heap alloc
-	lua->open_libraries(sol::lib::base, sol::lib::string, sol::lib::os, sol::lib::coroutine, sol::lib::jit, sol::lib::utf8, sol::lib::io, sol::lib::math, sol::lib::table, sol::lib::package);
+	lua->open_libraries(sol::lib::base, sol::lib::string, sol::lib::os, sol::lib::coroutine, sol::lib::jit, sol::lib::ffi, sol::lib::utf8, sol::lib::io, sol::lib::math, sol::lib::table, sol::lib::package);
 
 	// warden
 	bindWarden();
@@ -62,6 +65,14 @@ int LuaLime::initLua(irr::scene::ISceneManager* smgr, irr::video::IVideoDriver*
 	bindHitbox();
 	bindPacket();
 	bindMeshBuffer();
+	bindMeshInstanceSet();
+	bindStaticBatch();
+
+	// Event handlers are resolved once and again only when a script assigns them
+	luaCallbacks.watch(*lua, "Lime");
+	luaCallbacks.watch(*lua, "Input");
+	luaCallbacks.watch(*lua, "NetworkServer");
+	luaCallbacks.watch(*lua, "NetworkClient");
 
 	return 0;
 }
\ No newline at end of file
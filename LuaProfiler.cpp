@@ -0,0 +1,79 @@
+#include "LuaProfiler.h"
+#include <luajit.h>
+#include <fstream>
+
+namespace {
+	// Deep enough for any real script, deeper stacks keep their root frames
+	const int MAX_STACK_DEPTH = 64;
+}
+
+bool LuaProfiler::start(lua_State* L, int intervalMs) {
+	if (running || !L)
+		return false;
+
+	stacks.clear();
+	samples = frames = frameSamples = maxFrameSamples = 0;
+
+	// f samples per function rather than per line, which keeps the number of distinct stacks down
+	const std::string mode = "fi" + std::to_string(intervalMs > 0 ? intervalMs : 10);
+
+	state = L;
+	running = true;
+	luaJIT_profile_start(L, mode.c_str(), &LuaProfiler::onSample, this);
+	return true;
+}
+
+bool LuaProfiler::stop(const std::string& path) {
+	if (!running)
+		return false;
+
+	luaJIT_profile_stop(state);
+	running = false;
+	state = nullptr;
+
+	if (path.empty())
+		return true;
+
+	std::ofstream out(path);
+	if (!out.is_open())
+		return false;
+
+	for (const auto& kv : stacks)
+		out << kv.first << ' ' << kv.second << '\n';
+
+	return out.good();
+}
+
+void LuaProfiler::endFrame() {
+	if (!running)
+		return;
+
+	++frames;
+	if (frameSamples > maxFrameSamples)
+		maxFrameSamples = frameSamples;
+	frameSamples = 0;
+}
+
+void LuaProfiler::onSample(void* data, lua_State* L, int count, int vmstate) {
+	LuaProfiler* profiler = static_cast<LuaProfiler*>(data);
+
+	// Negative depth dumps the root first, F names functions with their module, ; separates frames
+	size_t length = 0;
+	const char* dump = luaJIT_profile_dumpstack(L, "F;", -MAX_STACK_DEPTH, &length);
+
+	std::string stack(dump, length);
+	if (!stack.empty() && stack.back() == ';')
+		stack.pop_back();
+
+	if (vmstate == 'G')
+		stack += stack.empty() ? "[GC]" : ";[GC]";
+	else if (vmstate == 'J')
+		stack += stack.empty() ? "[JIT]" : ";[JIT]";
+
+	if (stack.empty())
+		stack = "[idle]";
+
+	profiler->stacks[stack] += (unsigned int)count;
+	profiler->samples += (unsigned int)count;
+	profiler->frameSamples += (unsigned int)count;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <sol/sol.hpp>
+#include <string>
+#include <unordered_map>
+
+// Sampling profiler on top of LuaJIT's built in one (luaJIT_profile_start). Every sample records the Lua stack
+// of the main state, root first, and counts identical stacks together, so the cost stays the same however long
+// it runs. Samples taken in the garbage collector or the JIT compiler get an extra [GC] or [JIT] frame. stop
+// writes the counts as collapsed stacks, the input flamegraph.pl and speedscope take.
+class LuaProfiler
+{
+public:
+	// Interval between samples in milliseconds, LuaJIT's default of 10 is cheap enough to leave running
+	bool start(lua_State* state, int intervalMs = 10);
+
+	// Writes the collapsed stacks when given a path, returns false if that failed
+	bool stop(const std::string& path = std::string());
+
+	// Call once per frame while running
+	void endFrame();
+
+	bool isRunning() const { return running; }
+	unsigned int getSampleCount() const { return samples; }
+	unsigned int getFrameCount() const { return frames; }
+	unsigned int getMaxFrameSamples() const { return maxFrameSamples; } // Worst frame so far
+private:
+	static void onSample(void* data, lua_State* state, int samples, int vmstate);
+
+	std::unordered_map<std::string, unsigned int> stacks;
+	lua_State* state = nullptr;
+	unsigned int samples = 0;
+	unsigned int frames = 0;
+	unsigned int frameSamples = 0;
+	unsigned int maxFrameSamples = 0;
+	bool running = false;
+};
@@ -0,0 +1,491 @@
+#include "MeshInstanceSet.h"
+
+namespace {
+    // Merged buffers keep the source vertex type, so tangents and the second texture coordinates survive
+    IMeshBuffer* createBuffer(E_VERTEX_TYPE type) {
+        switch (type) {
+        case EVT_2TCOORDS:
+            return new SMeshBufferLightMap();
+        case EVT_TANGENTS:
+            return new SMeshBufferTangents();
+        default:
+            return new SMeshBuffer();
+        }
+    }
+
+    template <class T>
+    void transformVertex(T& v, const matrix4& transform) {
+        transform.transformVect(v.Pos);
+        transform.rotateVect(v.Normal);
+        v.Normal.normalize();
+    }
+
+    template <>
+    void transformVertex<S3DVertexTangents>(S3DVertexTangents& v, const matrix4& transform) {
+        transform.transformVect(v.Pos);
+        transform.rotateVect(v.Normal);
+        v.Normal.normalize();
+        transform.rotateVect(v.Tangent);
+        v.Tangent.normalize();
+        transform.rotateVect(v.Binormal);
+        v.Binormal.normalize();
+    }
+
+    template <class T>
+    void fillBatch(IMeshBuffer* dst, IMeshBuffer* src, const InstanceSetSceneNode::SInstance* instances, u32 count) {
+        CMeshBuffer<T>* target = static_cast<CMeshBuffer<T>*>(dst);
+        target->Vertices.set_used(0);
+        target->Indices.set_used(0);
+
+        if (count == 0)
+            return;
+
+        target->Vertices.reallocate(src->getVertexCount() * count);
+        target->Indices.reallocate(src->getIndexCount() * count);
+
+        const T* vertices = static_cast<const T*>(src->getVertices());
+        const u16* indices16 = src->getIndexType() == EIT_16BIT ? src->getIndices() : nullptr;
+        const u32* indices32 = src->getIndexType() == EIT_32BIT ? reinterpret_cast<const u32*>(src->getIndices()) : nullptr;
+
+        for (u32 i = 0; i < count; ++i) {
+            const InstanceSetSceneNode::SInstance& inst = instances[i];
+            const u16 base = (u16)target->Vertices.size();
+
+            for (u32 v = 0; v < src->getVertexCount(); ++v) {
+                T vert = vertices[v];
+                transformVertex(vert, inst.transform);
+
+                vert.Color.set(
+                    vert.Color.getAlpha() * inst.color.getAlpha() / 255,
+                    vert.Color.getRed() * inst.color.getRed() / 255,
+                    vert.Color.getGreen() * inst.color.getGreen() / 255,
+                    vert.Color.getBlue() * inst.color.getBlue() / 255);
+
+                target->Vertices.push_back(vert);
+            }
+
+            // 32 bit sources below 65536 vertices only ever hold indices that fit in 16 bits
+            for (u32 n = 0; n < src->getIndexCount(); ++n)
+                target->Indices.push_back(base + (u16)(indices16 ? indices16[n] : indices32[n]));
+        }
+    }
+}
+
+InstanceSetSceneNode::InstanceSetSceneNode(IMesh* m, ISceneNode* parent, ISceneManager* smgr, s32 id)
+    : ISceneNode(parent, smgr, id), mesh(m) {
+    if (mesh) {
+        mesh->grab();
+
+        u32 maxVertices = 1;
+        for (u32 i = 0; i < mesh->getMeshBufferCount(); ++i) {
+            const u32 vertexCount = mesh->getMeshBuffer(i)->getVertexCount();
+            materials.push_back(mesh->getMeshBuffer(i)->getMaterial());
+
+            // Merged batches use 16 bit indices, a single copy of larger buffers cannot be merged at all
+            oversized.push_back(vertexCount > 65535u);
+            if (vertexCount <= 65535u)
+                maxVertices = core::max_(maxVertices, vertexCount);
+        }
+
+        instancesPerBatch = core::max_(1u, 65535u / maxVertices);
+    }
+}
+
+InstanceSetSceneNode::~InstanceSetSceneNode() {
+    clearBatches();
+    if (mesh)
+        mesh->drop();
+}
+
+void InstanceSetSceneNode::clearBatches() {
+    for (SMesh* b : batches) {
+        if (b)
+            b->drop();
+    }
+    batches.clear();
+    dirtyBatches.clear();
+}
+
+bool InstanceSetSceneNode::isMerged() const {
+    return merged || tintedCount > 0;
+}
+
+void InstanceSetSceneNode::setMerged(bool enable) {
+    merged = enable;
+}
+
+void InstanceSetSceneNode::setInstanceCount(u32 count) {
+    for (u32 i = count; i < instances.size(); ++i) {
+        if (instances[i].color.color != 0xffffffff)
+            --tintedCount;
+    }
+    instances.resize(count);
+
+    u32 batchCount = (count + instancesPerBatch - 1) / instancesPerBatch;
+    for (u32 i = batchCount; i < batches.size(); ++i) {
+        if (batches[i])
+            batches[i]->drop();
+    }
+    batches.resize(batchCount, nullptr);
+    dirtyBatches.assign(batchCount, true);
+
+    boxDirty = true;
+}
+
+void InstanceSetSceneNode::markDirty(u32 i) {
+    u32 batch = i / instancesPerBatch;
+    if (batch < dirtyBatches.size())
+        dirtyBatches[batch] = true;
+    boxDirty = true;
+}
+
+void InstanceSetSceneNode::setInstance(u32 i, const vector3df& pos, const vector3df& rot, const vector3df& scale) {
+    if (i >= instances.size())
+        return;
+
+    matrix4& m = instances[i].transform;
+    m.makeIdentity();
+    m.setRotationDegrees(rot);
+    m.setTranslation(pos);
+
+    if (scale != vector3df(1.0f, 1.0f, 1.0f)) {
+        matrix4 s;
+        s.setScale(scale);
+        m *= s;
+    }
+
+    markDirty(i);
+}
+
+void InstanceSetSceneNode::setInstanceColor(u32 i, SColor color) {
+    if (i >= instances.size())
+        return;
+
+    const bool wasTinted = instances[i].color.color != 0xffffffff;
+    const bool isTinted = color.color != 0xffffffff;
+    if (isTinted != wasTinted)
+        tintedCount = isTinted ? tintedCount + 1 : tintedCount - 1;
+
+    instances[i].color = color;
+
+    markDirty(i);
+}
+
+void InstanceSetSceneNode::recalculateBox() {
+    boxDirty = false;
+
+    if (!mesh || instances.empty()) {
+        box.reset(0, 0, 0);
+        return;
+    }
+
+    const aabbox3d<f32>& meshBox = mesh->getBoundingBox();
+    for (u32 i = 0; i < instances.size(); ++i) {
+        aabbox3d<f32> b = meshBox;
+        instances[i].transform.transformBoxEx(b);
+
+        if (i == 0)
+            box = b;
+        else
+            box.addInternalBox(b);
+    }
+}
+
+void InstanceSetSceneNode::rebuildBatch(u32 batch) {
+    if (!mesh)
+        return;
+
+    if (!batches[batch])
+        batches[batch] = new SMesh();
+
+    SMesh* merged = batches[batch];
+    const u32 first = batch * instancesPerBatch;
+    const u32 last = core::min_<u32>(first + instancesPerBatch, (u32)instances.size());
+
+    for (u32 b = 0; b < mesh->getMeshBufferCount(); ++b) {
+        IMeshBuffer* src = mesh->getMeshBuffer(b);
+
+        if (merged->getMeshBufferCount() <= b) {
+            IMeshBuffer* buffer = createBuffer(src->getVertexType());
+            buffer->setHardwareMappingHint(EHM_DYNAMIC);
+            merged->addMeshBuffer(buffer);
+            buffer->drop();
+        }
+
+        IMeshBuffer* dst = merged->getMeshBuffer(b);
+        const u32 count = oversized[b] ? 0 : last - first;
+
+        switch (src->getVertexType()) {
+        case EVT_2TCOORDS:
+            fillBatch<S3DVertex2TCoords>(dst, src, instances.data() + first, count);
+            break;
+        case EVT_TANGENTS:
+            fillBatch<S3DVertexTangents>(dst, src, instances.data() + first, count);
+            break;
+        default:
+            fillBatch<S3DVertex>(dst, src, instances.data() + first, count);
+            break;
+        }
+
+        dst->recalculateBoundingBox();
+        dst->setDirty();
+    }
+
+    merged->recalculateBoundingBox();
+    dirtyBatches[batch] = false;
+}
+
+void InstanceSetSceneNode::OnRegisterSceneNode() {
+    if (IsVisible && !instances.empty()) {
+        if (boxDirty)
+            recalculateBox();
+
+        bool transparent = false;
+        for (u32 i = 0; i < materials.size(); ++i) {
+            if (SceneManager->getVideoDriver()->getMaterialRenderer(materials[i].MaterialType) &&
+                SceneManager->getVideoDriver()->getMaterialRenderer(materials[i].MaterialType)->isTransparent())
+                transparent = true;
+        }
+
+        SceneManager->registerNodeForRendering(this, transparent ? ESNRP_TRANSPARENT : ESNRP_SOLID);
+    }
+
+    ISceneNode::OnRegisterSceneNode();
+}
+
+void InstanceSetSceneNode::render() {
+    IVideoDriver* driver = SceneManager->getVideoDriver();
+    if (!mesh || instances.empty())
+        return;
+
+    const bool useBatches = isMerged();
+    if (useBatches) {
+        driver->setTransform(ETS_WORLD, AbsoluteTransformation);
+
+        for (u32 batch = 0; batch < batches.size(); ++batch) {
+            if (dirtyBatches[batch])
+                rebuildBatch(batch);
+
+            for (u32 b = 0; b < batches[batch]->getMeshBufferCount(); ++b) {
+                if (oversized[b])
+                    continue;
+
+                driver->setMaterial(materials[b]);
+                driver->drawMeshBuffer(batches[batch]->getMeshBuffer(b));
+            }
+        }
+    }
+
+    // Material state is set once per buffer and the same vertex buffer is reused for every instance.
+    // Buffers too large to merge always take this path, drawn without their instance colors.
+    for (u32 b = 0; b < mesh->getMeshBufferCount(); ++b) {
+        if (useBatches && !oversized[b])
+            continue;
+
+        IMeshBuffer* buffer = mesh->getMeshBuffer(b);
+        driver->setMaterial(materials[b]);
+
+        for (u32 i = 0; i < instances.size(); ++i) {
+            driver->setTransform(ETS_WORLD, AbsoluteTransformation * instances[i].transform);
+            driver->drawMeshBuffer(buffer);
+        }
+    }
+}
+
+MeshInstanceSet::MeshInstanceSet() {}
+
+MeshInstanceSet::MeshInstanceSet(const std::string& filePath) : MeshInstanceSet() {
+    load(filePath);
+}
+
+MeshInstanceSet::MeshInstanceSet(const std::string& filePath, int count) : MeshInstanceSet(filePath) {
+    setCount(count);
+}
+
+bool MeshInstanceSet::load(const std::string& filePath) {
+    irr::scene::IAnimatedMesh* mesh = smgr->getMesh(filePath.c_str());
+    if (!mesh)
+        return false;
+
+    int count = getCount();
+    destroy();
+
+    meshPath = filePath;
+    mesh->setHardwareMappingHint(EHM_STATIC);
+    node = new InstanceSetSceneNode(mesh->getMesh(0), smgr->getRootSceneNode(), smgr, -1);
+
+    for (u32 i = 0; i < node->getMaterialCount(); ++i)
+        node->getMaterial(i).Lighting = false;
+
+    setCount(count);
+
+    if (irrHandler->defaultExclude)
+        effects->excludeNodeFromLightingCalculations(node);
+
+    return true;
+}
+
+void MeshInstanceSet::destroy() {
+    if (node) {
+        effects->removeShadowFromNode(node);
+        transformStore->remove(node);
+        node->remove();
+        node->drop();
+        node = nullptr;
+        meshPath.clear();
+    }
+}
+
+int MeshInstanceSet::getCount() {
+    return node ? (int)node->getInstanceCount() : 0;
+}
+
+void MeshInstanceSet::setCount(int count) {
+    if (!node)
+        return;
+
+    u32 old = node->getInstanceCount();
+    node->setInstanceCount(count > 0 ? count : 0);
+
+    for (u32 i = old; i < node->getInstanceCount(); ++i)
+        node->setInstance(i, vector3df(0, 0, 0), vector3df(0, 0, 0), vector3df(1, 1, 1));
+}
+
+void MeshInstanceSet::setTransform(int i, const Vector3D& pos, const Vector3D& rot, const Vector3D& scale) {
+    if (node && i >= 0)
+        node->setInstance(i, vector3df(pos.x, pos.y, pos.z), vector3df(rot.x, rot.y, rot.z), vector3df(scale.x, scale.y, scale.z));
+}
+
+void MeshInstanceSet::setColor(int i, const Vector4D& col) {
+    if (node && i >= 0)
+        node->setInstanceColor(i, SColor(col.w, col.x, col.y, col.z));
+}
+
+int MeshInstanceSet::setTransforms(int start, sol::table packed) {
+    if (!node || start < 0)
+        return 0;
+
+    const int slots = core::min_<int>((int)packed.size() / 9, (int)node->getInstanceCount() - start);
+    for (int s = 0; s < slots; ++s) {
+        const int k = s * 9;
+        node->setInstance(start + s,
+            vector3df(packed.raw_get<float>(k + 1), packed.raw_get<float>(k + 2), packed.raw_get<float>(k + 3)),
+            vector3df(packed.raw_get<float>(k + 4), packed.raw_get<float>(k + 5), packed.raw_get<float>(k + 6)),
+            vector3df(packed.raw_get<float>(k + 7), packed.raw_get<float>(k + 8), packed.raw_get<float>(k + 9)));
+    }
+
+    return slots > 0 ? slots : 0;
+}
+
+int MeshInstanceSet::setPositions(int start, sol::table packed) {
+    if (!node || start < 0)
+        return 0;
+
+    const int slots = core::min_<int>((int)packed.size() / 3, (int)node->getInstanceCount() - start);
+    for (int s = 0; s < slots; ++s) {
+        const int k = s * 3;
+        node->setInstance(start + s,
+            vector3df(packed.raw_get<float>(k + 1), packed.raw_get<float>(k + 2), packed.raw_get<float>(k + 3)),
+            vector3df(0, 0, 0), vector3df(1, 1, 1));
+    }
+
+    return slots > 0 ? slots : 0;
+}
+
+int MeshInstanceSet::setColors(int start, sol::table packed) {
+    if (!node || start < 0)
+        return 0;
+
+    const int slots = core::min_<int>((int)packed.size() / 4, (int)node->getInstanceCount() - start);
+    for (int s = 0; s < slots; ++s) {
+        const int k = s * 4;
+        node->setInstanceColor(start + s, SColor(
+            (u32)core::clamp(packed.raw_get<float>(k + 4), 0.0f, 255.0f),
+            (u32)core::clamp(packed.raw_get<float>(k + 1), 0.0f, 255.0f),
+            (u32)core::clamp(packed.raw_get<float>(k + 2), 0.0f, 255.0f),
+            (u32)core::clamp(packed.raw_get<float>(k + 3), 0.0f, 255.0f)));
+    }
+
+    return slots > 0 ? slots : 0;
+}
+
+bool MeshInstanceSet::getMerged() {
+    return node ? node->isMerged() : false;
+}
+
+void MeshInstanceSet::setMerged(bool enable) {
+    if (node)
+        node->setMerged(enable);
+}
+
+bool MeshInstanceSet::loadMaterial(const Material& material, int slot) {
+    if (!node || slot < 0 || slot >= (int)node->getMaterialCount()) return false;
+
+    node->getMaterial(slot) = material.mat;
+    return true;
+}
+
+void MeshInstanceSet::exclude() {
+    if (node)
+        effects->excludeNodeFromLightingCalculations(node);
+}
+
+bool MeshInstanceSet::getVisibility() const {
+    return node ? node->isVisible() : false;
+}
+
+void MeshInstanceSet::setVisibility(bool visible) {
+    if (node)
+        node->setVisible(visible);
+}
+
+Vector3D MeshInstanceSet::getPosition() {
+    return node ? Vector3D(node->getPosition().X, node->getPosition().Y, node->getPosition().Z) : Vector3D();
+}
+
+void MeshInstanceSet::setPosition(const Vector3D& pos) {
+    if (node)
+        node->setPosition(vector3df(pos.x, pos.y, pos.z));
+}
+
+Vector3D MeshInstanceSet::getRotation() {
+    return node ? Vector3D(node->getRotation().X, node->getRotation().Y, node->getRotation().Z) : Vector3D();
+}
+
+void MeshInstanceSet::setRotation(const Vector3D& rot) {
+    if (node)
+        node->setRotation(vector3df(rot.x, rot.y, rot.z));
+}
+
+Vector3D MeshInstanceSet::getScale() {
+    return node ? Vector3D(node->getScale().X, node->getScale().Y, node->getScale().Z) : Vector3D();
+}
+
+void MeshInstanceSet::setScale(const Vector3D& scale) {
+    if (node)
+        node->setScale(vector3df(scale.x, scale.y, scale.z));
+}
+
+void bindMeshInstanceSet() {
+    sol::usertype<MeshInstanceSet> bindType = lua->new_usertype<MeshInstanceSet>("MeshInstanceSet",
+        sol::constructors<MeshInstanceSet(), MeshInstanceSet(const std::string & filePath), MeshInstanceSet(const std::string & filePath, int count)>(),
+
+        sol::base_classes, sol::bases<Compatible3D>(),
+
+        "visible", sol::property(&MeshInstanceSet::getVisibility, &MeshInstanceSet::setVisibility),
+        "position", sol::property(&MeshInstanceSet::getPosition, &MeshInstanceSet::setPosition),
+        "rotation", sol::property(&MeshInstanceSet::getRotation, &MeshInstanceSet::setRotation),
+        "scale", sol::property(&MeshInstanceSet::getScale, &MeshInstanceSet::setScale),
+        "count", sol::property(&MeshInstanceSet::getCount, &MeshInstanceSet::setCount),
+        "merged", sol::property(&MeshInstanceSet::getMerged, &MeshInstanceSet::setMerged));
+
+    bindType["load"] = &MeshInstanceSet::load;
+    bindType["destroy"] = &MeshInstanceSet::destroy;
+    bindType["setTransform"] = &MeshInstanceSet::setTransform;
+    bindType["setColor"] = &MeshInstanceSet::setColor;
+    bindType["setTransforms"] = &MeshInstanceSet::setTransforms;
+    bindType["setPositions"] = &MeshInstanceSet::setPositions;
+    bindType["setColors"] = &MeshInstanceSet::setColors;
+    bindType["loadMaterial"] = &MeshInstanceSet::loadMaterial;
+    bindType["ignoreLighting"] = &MeshInstanceSet::exclude;
+}
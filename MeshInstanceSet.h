@@ -0,0 +1,112 @@
+#pragma once
+
+#include "irrlicht.h"
+#include "IrrManagers.h"
+#include "Material.h"
+#include "Vector3D.h"
+#include "Vector4D.h"
+#include "LuaLime.h"
+#include <string>
+#include <vector>
+
+#include "Compatible3D.h"
+
+using namespace irr;
+using namespace scene;
+using namespace core;
+using namespace video;
+
+// Draws many copies of one mesh from a single scene node. Irrlicht has no instancing API, so instances are
+// merged on the CPU into batches which are only rebuilt when their slots change, giving one draw call per
+// buffer per batch. Merging can be switched off for untinted sets whose instances change every frame, in
+// which case every buffer is drawn once per instance from the same vertex buffer.
+class InstanceSetSceneNode : public ISceneNode {
+public:
+    struct SInstance {
+        matrix4 transform;
+        SColor color = SColor(255, 255, 255, 255);
+    };
+
+    InstanceSetSceneNode(IMesh* m, ISceneNode* parent, ISceneManager* smgr, s32 id);
+    virtual ~InstanceSetSceneNode();
+
+    virtual void OnRegisterSceneNode() override;
+    virtual void render() override;
+
+    virtual const aabbox3d<f32>& getBoundingBox() const override { return box; }
+    virtual u32 getMaterialCount() const override { return materials.size(); }
+    virtual SMaterial& getMaterial(u32 i) override { return materials[i]; }
+
+    void setInstanceCount(u32 count);
+    u32 getInstanceCount() const { return (u32)instances.size(); }
+
+    void setInstance(u32 i, const vector3df& pos, const vector3df& rot, const vector3df& scale);
+    void setInstanceColor(u32 i, SColor color);
+
+    void setMerged(bool enable);
+    bool isMerged() const;
+
+private:
+    void markDirty(u32 i);
+    void rebuildBatch(u32 batch);
+    void recalculateBox();
+    void clearBatches();
+
+    IMesh* mesh = nullptr;
+    aabbox3d<f32> box;
+    core::array<SMaterial> materials;
+
+    std::vector<SInstance> instances;
+    std::vector<bool> dirtyBatches;
+    std::vector<SMesh*> batches; // One merged mesh per batch, each with a buffer per source buffer
+    std::vector<bool> oversized; // Source buffers too large for 16 bit merged batches, drawn per instance
+    u32 instancesPerBatch = 1;
+
+    u32 tintedCount = 0; // Instances with a non-white color, these can only be drawn merged
+    bool merged = true;
+    bool boxDirty = true;
+};
+
+class MeshInstanceSet : public Compatible3D {
+public:
+    InstanceSetSceneNode* node = nullptr;
+    std::string meshPath;
+
+    MeshInstanceSet();
+    MeshInstanceSet(const std::string& filePath);
+    MeshInstanceSet(const std::string& filePath, int count);
+
+    bool load(const std::string& filePath);
+    void destroy();
+
+    int getCount();
+    void setCount(int count);
+
+    void setTransform(int i, const Vector3D& pos, const Vector3D& rot, const Vector3D& scale);
+    void setColor(int i, const Vector4D& col);
+    int setTransforms(int start, sol::table packed); // 9 floats per slot: position, rotation, scale
+    int setPositions(int start, sol::table packed); // 3 floats per slot, rotation and scale are reset
+    int setColors(int start, sol::table packed); // 4 floats per slot: r, g, b, a in the 0-255 range
+
+    bool getMerged();
+    void setMerged(bool enable);
+
+    bool loadMaterial(const Material& material, int slot);
+    void exclude();
+
+    bool getVisibility() const;
+    void setVisibility(bool visible);
+
+    Vector3D getPosition();
+    void setPosition(const Vector3D& pos);
+
+    Vector3D getRotation();
+    void setRotation(const Vector3D& rot);
+
+    Vector3D getScale();
+    void setScale(const Vector3D& scale);
+
+    irr::scene::ISceneNode* getNode() const override { return node; }
+};
+
+void bindMeshInstanceSet();
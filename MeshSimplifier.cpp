@@ -0,0 +1,309 @@
+#include "MeshSimplifier.h"
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <tuple>
+#include <cmath>
+
+using namespace irr;
+using namespace scene;
+using namespace core;
+using namespace video;
+
+namespace {
+	// Symmetric 4x4 matrix, upper triangle only
+	struct SQuadric {
+		f64 m[10] = { 0 };
+
+		void addPlane(f64 a, f64 b, f64 c, f64 d) {
+			m[0] += a * a; m[1] += a * b; m[2] += a * c; m[3] += a * d;
+			m[4] += b * b; m[5] += b * c; m[6] += b * d;
+			m[7] += c * c; m[8] += c * d;
+			m[9] += d * d;
+		}
+
+		void add(const SQuadric& o) {
+			for (int i = 0; i < 10; ++i)
+				m[i] += o.m[i];
+		}
+
+		f64 error(const vector3df& p) const {
+			const f64 x = p.X, y = p.Y, z = p.Z;
+			return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+				+ m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+				+ m[7] * z * z + 2 * m[8] * z
+				+ m[9];
+		}
+	};
+
+	struct STriangle {
+		u32 v[3];
+		bool removed = false;
+
+		bool contains(u32 i) const { return v[0] == i || v[1] == i || v[2] == i; }
+	};
+
+	class CBufferSimplifier {
+	public:
+		CBufferSimplifier(const std::vector<vector3df>& p, const u16* indices, u32 indexCount) : positions(p) {
+			const u32 vertexCount = (u32)positions.size();
+			quadrics.resize(vertexCount);
+			locked.resize(vertexCount, false);
+			adjacency.resize(vertexCount);
+
+			for (u32 i = 0; i + 2 < indexCount; i += 3) {
+				STriangle t;
+				t.v[0] = indices[i];
+				t.v[1] = indices[i + 1];
+				t.v[2] = indices[i + 2];
+
+				if (t.v[0] == t.v[1] || t.v[1] == t.v[2] || t.v[0] == t.v[2])
+					continue;
+
+				for (u32 c = 0; c < 3; ++c)
+					adjacency[t.v[c]].push_back((u32)triangles.size());
+				triangles.push_back(t);
+			}
+
+			liveCount = (u32)triangles.size();
+
+			// Errors are squared distances, so work in a normalized space to keep the thresholds meaningful
+			aabbox3d<f32> box(positions.empty() ? vector3df() : positions[0]);
+			for (const vector3df& v : positions)
+				box.addInternalPoint(v);
+			const f32 extent = box.getExtent().getLength();
+			const f32 scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+			for (vector3df& v : positions)
+				v *= scale;
+
+			for (const STriangle& t : triangles) {
+				const vector3df& a = positions[t.v[0]];
+				vector3df n = (positions[t.v[1]] - a).crossProduct(positions[t.v[2]] - a);
+				if (n.getLengthSQ() <= 0.0f)
+					continue;
+				n.normalize();
+
+				const f64 d = -n.dotProduct(a);
+				for (u32 c = 0; c < 3; ++c)
+					quadrics[t.v[c]].addPlane(n.X, n.Y, n.Z, d);
+			}
+
+			lockSeamsAndBorders();
+		}
+
+		void simplify(u32 target) {
+			for (u32 iteration = 0; iteration < 100 && liveCount > target; ++iteration) {
+				const f64 threshold = 0.000000001 * pow(f64(iteration + 3), 7.0);
+				std::vector<bool> touched(positions.size(), false);
+
+				for (u32 t = 0; t < triangles.size() && liveCount > target; ++t) {
+					if (triangles[t].removed)
+						continue;
+
+					for (u32 e = 0; e < 3; ++e) {
+						const u32 a = triangles[t].v[e];
+						const u32 b = triangles[t].v[(e + 1) % 3];
+						if (touched[a] || touched[b])
+							continue;
+
+						SQuadric q = quadrics[a];
+						q.add(quadrics[b]);
+
+						// Half edge collapse, try removing either end
+						const f64 errorA = locked[a] ? -1.0 : q.error(positions[b]);
+						const f64 errorB = locked[b] ? -1.0 : q.error(positions[a]);
+
+						u32 remove, keep;
+						f64 error;
+						if (errorA >= 0.0 && (errorB < 0.0 || errorA <= errorB)) {
+							remove = a; keep = b; error = errorA;
+						}
+						else if (errorB >= 0.0) {
+							remove = b; keep = a; error = errorB;
+						}
+						else
+							continue;
+
+						if (error > threshold || flips(remove, keep))
+							continue;
+
+						collapse(remove, keep);
+						touched[remove] = touched[keep] = true;
+						break;
+					}
+				}
+			}
+		}
+
+		std::vector<STriangle> triangles;
+
+	private:
+		void lockSeamsAndBorders() {
+			// Vertices sharing a position carry different UVs or normals, moving them would tear the surface
+			std::map<std::tuple<f32, f32, f32>, u32> welded;
+			std::vector<u32> weld(positions.size());
+			std::vector<u32> weldCount;
+			for (u32 i = 0; i < positions.size(); ++i) {
+				auto key = std::make_tuple(positions[i].X, positions[i].Y, positions[i].Z);
+				auto it = welded.find(key);
+				if (it == welded.end()) {
+					it = welded.insert(std::make_pair(key, (u32)weldCount.size())).first;
+					weldCount.push_back(0);
+				}
+				weld[i] = it->second;
+				++weldCount[it->second];
+			}
+
+			for (u32 i = 0; i < positions.size(); ++i)
+				locked[i] = weldCount[weld[i]] > 1;
+
+			// Edges used by a single triangle are open borders
+			std::unordered_map<u64, u32> edges;
+			for (const STriangle& t : triangles) {
+				for (u32 e = 0; e < 3; ++e) {
+					u64 a = weld[t.v[e]], b = weld[t.v[(e + 1) % 3]];
+					if (a > b)
+						std::swap(a, b);
+					++edges[(a << 32) | b];
+				}
+			}
+
+			for (const STriangle& t : triangles) {
+				for (u32 e = 0; e < 3; ++e) {
+					u64 a = weld[t.v[e]], b = weld[t.v[(e + 1) % 3]];
+					if (a > b)
+						std::swap(a, b);
+					if (edges[(a << 32) | b] == 1)
+						locked[t.v[e]] = locked[t.v[(e + 1) % 3]] = true;
+				}
+			}
+		}
+
+		// Rejects collapses that turn a remaining triangle over or squash it flat
+		bool flips(u32 remove, u32 keep) const {
+			for (u32 t : adjacency[remove]) {
+				const STriangle& tri = triangles[t];
+				if (tri.removed || tri.contains(keep))
+					continue;
+
+				vector3df before[3], after[3];
+				for (u32 c = 0; c < 3; ++c) {
+					before[c] = positions[tri.v[c]];
+					after[c] = tri.v[c] == remove ? positions[keep] : before[c];
+				}
+
+				vector3df n0 = (before[1] - before[0]).crossProduct(before[2] - before[0]);
+				vector3df n1 = (after[1] - after[0]).crossProduct(after[2] - after[0]);
+				if (n1.getLengthSQ() <= 0.0f)
+					return true;
+
+				n0.normalize();
+				n1.normalize();
+				if (n0.dotProduct(n1) < 0.2f)
+					return true;
+			}
+
+			return false;
+		}
+
+		void collapse(u32 remove, u32 keep) {
+			for (u32 t : adjacency[remove]) {
+				STriangle& tri = triangles[t];
+				if (tri.removed)
+					continue;
+
+				if (tri.contains(keep)) {
+					tri.removed = true;
+					--liveCount;
+					continue;
+				}
+
+				for (u32 c = 0; c < 3; ++c) {
+					if (tri.v[c] == remove)
+						tri.v[c] = keep;
+				}
+				adjacency[keep].push_back(t);
+			}
+
+			adjacency[remove].clear();
+			quadrics[keep].add(quadrics[remove]);
+		}
+
+		std::vector<vector3df> positions;
+		std::vector<SQuadric> quadrics;
+		std::vector<bool> locked;
+		std::vector<std::vector<u32>> adjacency;
+		u32 liveCount = 0;
+	};
+
+	template <class T>
+	IMeshBuffer* simplifyBuffer(IMeshBuffer* src, f32 ratio) {
+		const T* vertices = static_cast<const T*>(src->getVertices());
+		const u32 vertexCount = src->getVertexCount();
+
+		std::vector<vector3df> positions(vertexCount);
+		for (u32 i = 0; i < vertexCount; ++i)
+			positions[i] = vertices[i].Pos;
+
+		CBufferSimplifier simplifier(positions, src->getIndices(), src->getIndexCount());
+		simplifier.simplify(core::max_(1u, (u32)(src->getIndexCount() / 3 * ratio)));
+
+		CMeshBuffer<T>* buffer = new CMeshBuffer<T>();
+		buffer->Material = src->getMaterial();
+
+		std::vector<s32> remap(vertexCount, -1);
+		for (const STriangle& t : simplifier.triangles) {
+			if (t.removed)
+				continue;
+
+			for (u32 c = 0; c < 3; ++c) {
+				if (remap[t.v[c]] < 0) {
+					remap[t.v[c]] = (s32)buffer->Vertices.size();
+					buffer->Vertices.push_back(vertices[t.v[c]]);
+				}
+				buffer->Indices.push_back((u16)remap[t.v[c]]);
+			}
+		}
+
+		buffer->recalculateBoundingBox();
+		buffer->setHardwareMappingHint(src->getHardwareMappingHint_Vertex());
+		return buffer;
+	}
+}
+
+IMesh* createSimplifiedMesh(IMesh* mesh, f32 ratio) {
+	if (!mesh)
+		return nullptr;
+
+	ratio = core::clamp(ratio, 0.0f, 1.0f);
+	SMesh* result = new SMesh();
+
+	for (u32 i = 0; i < mesh->getMeshBufferCount(); ++i) {
+		IMeshBuffer* src = mesh->getMeshBuffer(i);
+
+		IMeshBuffer* buffer = nullptr;
+		if (src->getIndexType() == EIT_16BIT && src->getIndexCount() >= 3) {
+			switch (src->getVertexType()) {
+			case EVT_2TCOORDS:
+				buffer = simplifyBuffer<S3DVertex2TCoords>(src, ratio);
+				break;
+			case EVT_TANGENTS:
+				buffer = simplifyBuffer<S3DVertexTangents>(src, ratio);
+				break;
+			default:
+				buffer = simplifyBuffer<S3DVertex>(src, ratio);
+				break;
+			}
+		}
+
+		if (buffer) {
+			result->addMeshBuffer(buffer);
+			buffer->drop();
+		}
+		else
+			result->addMeshBuffer(src);
+	}
+
+	result->recalculateBoundingBox();
+	return result;
+}
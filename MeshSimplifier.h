@@ -0,0 +1,9 @@
+#pragma once
+
+#include "irrlicht.h"
+
+// Quadric error metric edge collapse. Vertices are only ever collapsed onto one of their neighbours,
+// so the surviving vertices keep their original attributes. UV/normal seams and open borders are locked.
+// Returns a new mesh holding roughly ratio of the original triangles, the caller is responsible for dropping it.
+// Buffers with 32 bit indices are shared with the source mesh unchanged.
+irr::scene::IMesh* createSimplifiedMesh(irr::scene::IMesh* mesh, irr::f32 ratio);
@@ -154,8 +154,14 @@ void netBodyServer(NetworkHandler* n, IrrHandling* m) {
 
 		if (n->getPeer() && n->getHost()) {
 			lock.lock();
-			if (enet_host_service(n->getHost(), &event, 1000) > 0)
-				m->addEventTask(true, event);
+			if (enet_host_service(n->getHost(), &event, 1000) > 0) {
+				// The wait for the first event is idle time, the phase covers receiving and dispatching everything
+				// that arrived with it
+				ScopedPhase phase("Server receive");
+				do {
+					m->addEventTask(true, event);
+				} while (enet_host_service(n->getHost(), &event, 0) > 0);
+			}
 			lock.unlock();
 		}
 	}
@@ -175,8 +181,14 @@ void netBodyClient(NetworkHandler* n, IrrHandling* m) {
 
 		if (n->getPeer() && n->clientTrulyConnected) {
 			lock.lock();
-			if (enet_host_service(n->getClient(), &event, 1000) > 0)
-				m->addEventTask(false, event);
+			if (enet_host_service(n->getClient(), &event, 1000) > 0) {
+				// The wait for the first event is idle time, the phase covers receiving and dispatching everything
+				// that arrived with it
+				ScopedPhase phase("Client receive");
+				do {
+					m->addEventTask(false, event);
+				} while (enet_host_service(n->getClient(), &event, 0) > 0);
+			}
 			lock.unlock();
 		}
 		else if (!n->clientTrulyConnected) {
@@ -366,7 +378,7 @@ void NetworkHandler::connectClient(std::string ad, int port, int channels) {
 			if (doVerbose) dConsole.sendMsg("Networking WARNING: Failed to create peer connection", MESSAGE_TYPE::NETWORK_VERBOSE);
 
 			sol::protected_function f = (*lua)["NetworkClient"]["OnConnectFail"];
-			irrNetHandler->addLuaTask(f, sol::table());
+			irrNetHandler->addLuaTask(f);
 			return;
 		}
 		else {
@@ -377,13 +389,13 @@ void NetworkHandler::connectClient(std::string ad, int port, int channels) {
 				clientTrulyConnected = true;
 
 				sol::protected_function f = (*lua)["NetworkClient"]["OnConnect"];
-				irrNetHandler->addLuaTask(f, sol::table());
+				irrNetHandler->addLuaTask(f);
 			}
 			else {
 				if (doVerbose) dConsole.sendMsg("Client failed to connect to server", MESSAGE_TYPE::NETWORK_VERBOSE);
 
 				sol::protected_function f = (*lua)["NetworkClient"]["OnConnectFail"];
-				irrNetHandler->addLuaTask(f, sol::table());
+				irrNetHandler->addLuaTask(f);
 			}
 		}
 	});
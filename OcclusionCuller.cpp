@@ -0,0 +1,366 @@
+#include "OcclusionCuller.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+using namespace irr;
+using namespace scene;
+using namespace core;
+
+namespace {
+	const u32 BAND_HEIGHT = 16;
+	const f32 NEAR_W = 0.001f;
+
+	// Projects to buffer space, x/y in pixels and z in 0..1, returns false for points behind the camera
+	bool project(const matrix4& m, const vector3df& p, f32 width, f32 height, f32* out) {
+		f32 clip[4];
+		m.transformVect(clip, p);
+		if (clip[3] < NEAR_W)
+			return false;
+
+		const f32 invW = 1.0f / clip[3];
+		out[0] = (clip[0] * invW * 0.5f + 0.5f) * width;
+		out[1] = (0.5f - clip[1] * invW * 0.5f) * height;
+		out[2] = clip[2] * invW;
+		return true;
+	}
+}
+
+OcclusionCuller::OcclusionCuller(u32 w, u32 h) : width((w + 3) & ~3u), height(h), nextBand(0) {
+	bandCount = (height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+	depth.resize(width * height, 1.0f);
+
+	const int workerCount = core::clamp<int>((int)std::thread::hardware_concurrency() - 1, 0, 3);
+	for (int i = 0; i < workerCount; ++i)
+		workers.push_back(std::thread(&OcclusionCuller::workerBody, this));
+}
+
+OcclusionCuller::~OcclusionCuller() {
+	shutdown();
+	clearOccluders();
+}
+
+void OcclusionCuller::shutdown() {
+	{
+		std::lock_guard<std::mutex> guard(bandLock);
+		finished = true;
+	}
+	bandWake.notify_all();
+
+	for (std::thread& t : workers) {
+		if (t.joinable())
+			t.join();
+	}
+	workers.clear();
+}
+
+void OcclusionCuller::endFrame() {
+	occludedCount = frameOccluded;
+	testedCount = frameTested;
+	frameOccluded = 0;
+	frameTested = 0;
+}
+
+void OcclusionCuller::addOccluder(ISceneNode* node) {
+	if (node && occluders.insert(node).second)
+		node->grab();
+}
+
+void OcclusionCuller::removeOccluder(ISceneNode* node) {
+	if (occluders.erase(node))
+		node->drop();
+}
+
+bool OcclusionCuller::isOccluder(ISceneNode* node) const {
+	return occluders.find(node) != occluders.end();
+}
+
+void OcclusionCuller::clearOccluders() {
+	restore();
+
+	for (ISceneNode* node : occluders)
+		node->drop();
+	occluders.clear();
+}
+
+void OcclusionCuller::cull(ICameraSceneNode* camera) {
+	if (!enabled || !camera || occluders.empty())
+		return;
+
+	// Only referenced from here, the owning mesh was destroyed
+	for (auto it = occluders.begin(); it != occluders.end();) {
+		if ((*it)->getReferenceCount() == 1) {
+			(*it)->drop();
+			it = occluders.erase(it);
+		}
+		else
+			++it;
+	}
+
+	// Cameras only rebuild their view matrix while rendering, so build it from the current transform
+	camera->updateAbsolutePosition();
+	matrix4 view;
+	view.buildCameraLookAtMatrixLH(camera->getAbsolutePosition(), camera->getTarget(), camera->getUpVector());
+	const matrix4 viewProjection = camera->getProjectionMatrix() * view;
+
+	triangles.clear();
+	for (ISceneNode* node : occluders) {
+		if (node->isVisible() && node->getParent())
+			collectTriangles(node, viewProjection);
+	}
+
+	if (triangles.empty())
+		return;
+
+	const __m128 far4 = _mm_set1_ps(1.0f);
+	for (u32 i = 0; i < depth.size(); i += 4)
+		_mm_storeu_ps(&depth[i], far4);
+
+	rasterizeBands();
+	testNodes(camera->getSceneManager()->getRootSceneNode(), viewProjection);
+}
+
+void OcclusionCuller::restore() {
+	for (ISceneNode* node : hidden)
+		node->setVisible(true);
+	hidden.clear();
+}
+
+void OcclusionCuller::collectTriangles(ISceneNode* node, const matrix4& viewProjection) {
+	IMesh* mesh = nullptr;
+	if (node->getType() == ESNT_MESH)
+		mesh = static_cast<IMeshSceneNode*>(node)->getMesh();
+	else if (node->getType() == ESNT_ANIMATED_MESH) {
+		IAnimatedMeshSceneNode* animated = static_cast<IAnimatedMeshSceneNode*>(node);
+		mesh = animated->getMesh() ? animated->getMesh()->getMesh((s32)animated->getFrameNr()) : nullptr;
+	}
+
+	if (!mesh)
+		return;
+
+	const matrix4 transform = viewProjection * node->getAbsoluteTransformation();
+	std::vector<f32> screen;
+	std::vector<bool> valid;
+
+	for (u32 b = 0; b < mesh->getMeshBufferCount(); ++b) {
+		IMeshBuffer* mb = mesh->getMeshBuffer(b);
+		const u32 vertexCount = mb->getVertexCount();
+
+		screen.resize(vertexCount * 3);
+		valid.resize(vertexCount);
+		for (u32 i = 0; i < vertexCount; ++i)
+			valid[i] = project(transform, mb->getPosition(i), (f32)width, (f32)height, &screen[i * 3]);
+
+		const u32 indexCount = mb->getIndexCount();
+		const u16* indices16 = mb->getIndexType() == video::EIT_16BIT ? mb->getIndices() : nullptr;
+		const u32* indices32 = mb->getIndexType() == video::EIT_32BIT ? reinterpret_cast<const u32*>(mb->getIndices()) : nullptr;
+
+		for (u32 i = 0; i + 2 < indexCount; i += 3) {
+			const u32 a = indices16 ? indices16[i] : indices32[i];
+			const u32 c = indices16 ? indices16[i + 1] : indices32[i + 1];
+			const u32 d = indices16 ? indices16[i + 2] : indices32[i + 2];
+
+			// Triangles crossing the near plane are dropped, losing occluder area is always safe
+			if (valid[a] && valid[c] && valid[d])
+				setupTriangle(&screen[a * 3], &screen[c * 3], &screen[d * 3]);
+		}
+	}
+}
+
+void OcclusionCuller::setupTriangle(const f32* v0, const f32* v1, const f32* v2) {
+	f32 area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v1[1] - v0[1]) * (v2[0] - v0[0]);
+	if (fabsf(area) < 0.000001f)
+		return;
+
+	// Both windings occlude
+	if (area < 0.0f) {
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	STriangle t;
+	t.minX = core::max_<s32>(0, (s32)floorf(core::min_(v0[0], v1[0], v2[0])));
+	t.maxX = core::min_<s32>((s32)width - 1, (s32)ceilf(core::max_(v0[0], v1[0], v2[0])));
+	t.minY = core::max_<s32>(0, (s32)floorf(core::min_(v0[1], v1[1], v2[1])));
+	t.maxY = core::min_<s32>((s32)height - 1, (s32)ceilf(core::max_(v0[1], v1[1], v2[1])));
+	if (t.minX > t.maxX || t.minY > t.maxY)
+		return;
+
+	// Edge i is opposite vertex i, so its function is that vertex's barycentric weight times the area
+	const f32* v[3] = { v0, v1, v2 };
+	for (u32 e = 0; e < 3; ++e) {
+		const f32* a = v[(e + 1) % 3];
+		const f32* b = v[(e + 2) % 3];
+		t.edgeA[e] = -(b[1] - a[1]);
+		t.edgeB[e] = b[0] - a[0];
+		t.edgeC[e] = -(t.edgeA[e] * a[0] + t.edgeB[e] * a[1]);
+	}
+
+	const f32 invArea = 1.0f / area;
+	t.zA = (t.edgeA[0] * v0[2] + t.edgeA[1] * v1[2] + t.edgeA[2] * v2[2]) * invArea;
+	t.zB = (t.edgeB[0] * v0[2] + t.edgeB[1] * v1[2] + t.edgeB[2] * v2[2]) * invArea;
+	t.zC = (t.edgeC[0] * v0[2] + t.edgeC[1] * v1[2] + t.edgeC[2] * v2[2]) * invArea;
+
+	triangles.push_back(t);
+}
+
+void OcclusionCuller::rasterizeBand(u32 band) {
+	const s32 bandTop = (s32)(band * BAND_HEIGHT);
+	const s32 bandBottom = core::min_<s32>((s32)height, bandTop + (s32)BAND_HEIGHT) - 1;
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+
+	for (const STriangle& t : triangles) {
+		const s32 top = core::max_(t.minY, bandTop);
+		const s32 bottom = core::min_(t.maxY, bandBottom);
+		if (top > bottom)
+			continue;
+
+		const __m128 a0 = _mm_set1_ps(t.edgeA[0]), a1 = _mm_set1_ps(t.edgeA[1]), a2 = _mm_set1_ps(t.edgeA[2]);
+		const __m128 zA = _mm_set1_ps(t.zA);
+		const s32 left = t.minX & ~3;
+
+		for (s32 y = top; y <= bottom; ++y) {
+			const f32 fy = y + 0.5f;
+			const __m128 r0 = _mm_set1_ps(t.edgeB[0] * fy + t.edgeC[0]);
+			const __m128 r1 = _mm_set1_ps(t.edgeB[1] * fy + t.edgeC[1]);
+			const __m128 r2 = _mm_set1_ps(t.edgeB[2] * fy + t.edgeC[2]);
+			const __m128 rz = _mm_set1_ps(t.zB * fy + t.zC);
+			f32* row = &depth[y * width];
+
+			// Width is a multiple of 4, so every 4 wide step stays inside the row
+			for (s32 x = left; x <= t.maxX; x += 4) {
+				const __m128 px = _mm_add_ps(_mm_set1_ps((f32)x), offsets);
+				const __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+				const __m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+				const __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+				const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				const __m128 z = _mm_add_ps(_mm_mul_ps(zA, px), rz);
+				const __m128 old = _mm_loadu_ps(row + x);
+				const __m128 nearest = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+		}
+	}
+}
+
+void OcclusionCuller::rasterizeBands() {
+	if (workers.empty()) {
+		for (u32 b = 0; b < bandCount; ++b)
+			rasterizeBand(b);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(bandLock);
+		nextBand = 0;
+		bandsFinished = 0;
+		++generation;
+	}
+	bandWake.notify_all();
+
+	// The main thread takes bands too instead of idling
+	drainBands();
+
+	std::unique_lock<std::mutex> guard(bandLock);
+	bandDone.wait(guard, [this] { return bandsFinished >= bandCount; });
+}
+
+void OcclusionCuller::drainBands() {
+	u32 band;
+	while ((band = nextBand++) < bandCount) {
+		rasterizeBand(band);
+
+		std::lock_guard<std::mutex> guard(bandLock);
+		if (++bandsFinished >= bandCount)
+			bandDone.notify_one();
+	}
+}
+
+void OcclusionCuller::workerBody() {
+	u32 seen = 0;
+
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(bandLock);
+			bandWake.wait(guard, [this, seen] { return finished || generation != seen; });
+			if (finished)
+				return;
+
+			seen = generation;
+		}
+
+		drainBands();
+	}
+}
+
+bool OcclusionCuller::testBox(const aabbox3d<f32>& box, const matrix4& viewProjection) const {
+	vector3df corners[8];
+	box.getEdges(corners);
+
+	f32 minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minZ = FLT_MAX;
+	for (u32 i = 0; i < 8; ++i) {
+		f32 p[3];
+		if (!project(viewProjection, corners[i], (f32)width, (f32)height, p))
+			return true; // Crosses the near plane
+
+		minX = core::min_(minX, p[0]);
+		maxX = core::max_(maxX, p[0]);
+		minY = core::min_(minY, p[1]);
+		maxY = core::max_(maxY, p[1]);
+		minZ = core::min_(minZ, p[2]);
+	}
+
+	const s32 left = core::max_<s32>(0, (s32)floorf(minX));
+	const s32 right = core::min_<s32>((s32)width - 1, (s32)ceilf(maxX));
+	const s32 top = core::max_<s32>(0, (s32)floorf(minY));
+	const s32 bottom = core::min_<s32>((s32)height - 1, (s32)ceilf(maxY));
+	if (left > right || top > bottom)
+		return true; // Off screen, left to frustum culling
+
+	// Visible as soon as any covered texel is not strictly nearer than the box
+	const __m128 z = _mm_set1_ps(minZ);
+	for (s32 y = top; y <= bottom; ++y) {
+		const f32* row = &depth[y * width];
+		s32 x = left;
+
+		for (; x + 3 <= right; x += 4) {
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), z)) != 0)
+				return true;
+		}
+
+		for (; x <= right; ++x) {
+			if (row[x] >= minZ)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+void OcclusionCuller::testNodes(ISceneNode* node, const matrix4& viewProjection) {
+	for (ISceneNode* child : node->getChildren()) {
+		if (!child->isVisible())
+			continue;
+
+		const ESCENE_NODE_TYPE type = child->getType();
+		const bool testable = (type == ESNT_MESH || type == ESNT_ANIMATED_MESH) && child->getChildren().empty() &&
+			child->getAutomaticCulling() != EAC_OFF && !isOccluder(child);
+
+		if (!testable) {
+			testNodes(child, viewProjection);
+			continue;
+		}
+
+		++frameTested;
+		if (!testBox(child->getTransformedBoundingBox(), viewProjection)) {
+			child->setVisible(false);
+			hidden.push_back(child);
+			++frameOccluded;
+		}
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <irrlicht.h>
+#include <vector>
+#include <unordered_set>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+// Software occlusion culling. Occluder meshes are rasterized into a small CPU depth buffer, split into
+// horizontal bands shared between worker threads, and mesh nodes whose screen bounds are fully behind it
+// are hidden for the view. Only camera and node transforms are used, so it also runs on the null driver.
+// Views render their shadow maps before culling, hidden nodes only drop out of the receiver and scene passes.
+class OcclusionCuller
+{
+public:
+	OcclusionCuller(irr::u32 width = 320, irr::u32 height = 192);
+	~OcclusionCuller();
+
+	void addOccluder(irr::scene::ISceneNode* node);
+	void removeOccluder(irr::scene::ISceneNode* node);
+	bool isOccluder(irr::scene::ISceneNode* node) const;
+	void clearOccluders();
+
+	void cull(irr::scene::ICameraSceneNode* camera); // Hide nodes occluded from this camera
+	void restore(); // Show the nodes hidden by the last cull again
+	void endFrame(); // Publish the counts summed over this frame's views
+	void shutdown(); // Join the raster threads, culling keeps working on the calling thread
+
+	// Summed over every view of the last finished frame
+	int getOccludedCount() const { return occludedCount; }
+	int getTestedCount() const { return testedCount; }
+	int getOccluderTriangleCount() const { return (int)triangles.size(); }
+
+	bool enabled = true;
+private:
+	// Screen space triangle with edge functions and depth plane set up for the rasterizer
+	struct STriangle {
+		irr::f32 edgeA[3], edgeB[3], edgeC[3];
+		irr::f32 zA, zB, zC;
+		irr::s32 minX, maxX, minY, maxY;
+	};
+
+	void collectTriangles(irr::scene::ISceneNode* node, const irr::core::matrix4& viewProjection);
+	void setupTriangle(const irr::f32* v0, const irr::f32* v1, const irr::f32* v2);
+	void rasterizeBand(irr::u32 band);
+	void rasterizeBands();
+	bool testBox(const irr::core::aabbox3d<irr::f32>& box, const irr::core::matrix4& viewProjection) const;
+	void testNodes(irr::scene::ISceneNode* node, const irr::core::matrix4& viewProjection);
+
+	void workerBody();
+	void drainBands();
+
+	irr::u32 width;
+	irr::u32 height;
+	irr::u32 bandCount;
+	std::vector<irr::f32> depth;
+
+	std::unordered_set<irr::scene::ISceneNode*> occluders; // Grabbed
+	std::vector<irr::scene::ISceneNode*> hidden;
+	std::vector<STriangle> triangles;
+
+	int occludedCount = 0;
+	int testedCount = 0;
+	int frameOccluded = 0; // Running totals of the frame in progress
+	int frameTested = 0;
+
+	std::vector<std::thread> workers;
+	std::mutex bandLock;
+	std::condition_variable bandWake;
+	std::condition_variable bandDone;
+	std::atomic<irr::u32> nextBand;
+	irr::u32 bandsFinished = 0;
+	irr::u32 generation = 0;
+	bool finished = false;
+};
@@ -284,8 +284,10 @@ void ParticleSystem::emitOnce(int amount) {
 }
 
 void ParticleSystem::loadMaterial(const Material& mat) {
-	if (ps)
+	if (ps) {
 		ps->getMaterial(0) = mat.mat;
+		effects->markShadowNodeMaterialsChanged(ps);
+	}
 }
 
 bool ParticleSystem::getDebug() {
@@ -311,8 +313,10 @@ void ParticleSystem::setVisible(bool enable) {
 }
 
 void ParticleSystem::destroy() {
-	if (ps)
+	if (ps) {
+		transformStore->remove(ps);
 		ps->remove();
+	}
 }
 
 void bindParticleSystem() {
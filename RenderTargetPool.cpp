@@ -0,0 +1,194 @@
+#include "RenderTargetPool.h"
+
+using namespace irr;
+using namespace video;
+
+RenderTargetPool::RenderTargetPool(IVideoDriver* d) : driver(d) {}
+
+RenderTargetPool::~RenderTargetPool() {
+	for (u32 i = entries.size(); i > 0; --i)
+		evict(i - 1);
+}
+
+RenderTargetPool::SEntry* RenderTargetPool::find(const core::dimension2du& size, ECOLOR_FORMAT format, const void* owner) {
+	SEntry* match = nullptr;
+
+	for (SEntry& e : entries) {
+		if (e.inUse || e.size != size || e.format != format)
+			continue;
+
+		// Same owner keeps whatever it rendered last time
+		if (owner && e.owner == owner)
+			return &e;
+
+		if (!match || e.lastUsed > match->lastUsed)
+			match = &e;
+	}
+
+	return match;
+}
+
+ITexture* RenderTargetPool::acquire(const core::dimension2du& size, ECOLOR_FORMAT format, const void* owner) {
+	if (!driver || size.getArea() == 0 || !driver->queryFeature(EVDF_RENDER_TO_TARGET))
+		return nullptr;
+
+	SEntry* e = find(size, format, owner);
+	if (e) {
+		++stats.reuses;
+	}
+	else {
+		core::stringc name = core::stringc("LIME_RTT_") + core::stringc(nextName++);
+		ITexture* texture = driver->addRenderTargetTexture(size, name, format);
+		if (!texture)
+			return nullptr;
+
+		SEntry entry;
+		entry.texture = texture;
+		entry.size = size;
+		entry.format = format;
+		entries.push_back(entry);
+		e = &entries.back();
+
+		++stats.allocations;
+		++stats.allocated;
+		stats.bytes += getBytes(*e);
+	}
+
+	e->owner = owner;
+	e->inUse = true;
+	e->frameLease = false;
+	e->lastUsed = frame;
+	++stats.inUse;
+
+	return e->texture;
+}
+
+ITexture* RenderTargetPool::acquireForFrame(const core::dimension2du& size, ECOLOR_FORMAT format, const void* owner) {
+	ITexture* texture = acquire(size, format, owner);
+
+	for (SEntry& e : entries) {
+		if (e.texture == texture) {
+			e.frameLease = true;
+			break;
+		}
+	}
+
+	return texture;
+}
+
+ITexture* RenderTargetPool::acquireOwned(const core::dimension2du& size, ECOLOR_FORMAT format, const void* owner) {
+	if (!owner)
+		return nullptr;
+
+	for (SEntry& e : entries) {
+		if (!e.inUse || e.frameLease || e.owner != owner)
+			continue;
+
+		if (e.size == size && e.format == format) {
+			e.lastUsed = frame;
+			return e.texture;
+		}
+
+		// Resized, the old target goes back to the pool
+		release(e.texture);
+		break;
+	}
+
+	return acquire(size, format, owner);
+}
+
+void RenderTargetPool::releaseOwner(const void* owner) {
+	if (!owner)
+		return;
+
+	for (SEntry& e : entries) {
+		if (e.inUse && !e.frameLease && e.owner == owner) {
+			release(e.texture);
+			return;
+		}
+	}
+}
+
+void RenderTargetPool::release(ITexture* texture) {
+	if (!texture)
+		return;
+
+	for (SEntry& e : entries) {
+		if (e.texture == texture && e.inUse) {
+			e.inUse = false;
+			e.frameLease = false;
+			e.lastUsed = frame;
+			--stats.inUse;
+			return;
+		}
+	}
+}
+
+void RenderTargetPool::endFrame() {
+	u32 freeCount = 0;
+
+	for (SEntry& e : entries) {
+		if (e.inUse && e.frameLease) {
+			e.inUse = false;
+			e.frameLease = false;
+			--stats.inUse;
+		}
+
+		if (!e.inUse)
+			++freeCount;
+	}
+
+	// Idle targets first, then least recently used until under the free limit
+	for (u32 i = entries.size(); i > 0; --i) {
+		const SEntry& e = entries[i - 1];
+		if (!e.inUse && frame - e.lastUsed > maxIdleFrames) {
+			evict(i - 1);
+			--freeCount;
+		}
+	}
+
+	while (freeCount > maxFreeTargets) {
+		s32 oldest = -1;
+		for (u32 i = 0; i < entries.size(); ++i) {
+			if (!entries[i].inUse && (oldest < 0 || entries[i].lastUsed < entries[oldest].lastUsed))
+				oldest = (s32)i;
+		}
+
+		if (oldest < 0)
+			break;
+
+		evict((u32)oldest);
+		--freeCount;
+	}
+
+	++frame;
+}
+
+void RenderTargetPool::clear() {
+	for (u32 i = entries.size(); i > 0; --i) {
+		if (!entries[i - 1].inUse)
+			evict(i - 1);
+	}
+}
+
+void RenderTargetPool::evict(u32 index) {
+	SEntry& e = entries[index];
+
+	if (e.inUse)
+		--stats.inUse;
+
+	--stats.allocated;
+	stats.bytes -= getBytes(e);
+	++stats.evictions;
+
+	driver->removeTexture(e.texture);
+
+	entries[index] = entries.back();
+	entries.pop_back();
+}
+
+u32 RenderTargetPool::getBytes(const SEntry& e) {
+	const ECOLOR_FORMAT format = e.format == ECF_UNKNOWN && e.texture ? e.texture->getColorFormat() : e.format;
+	const u32 bits = IImage::getBitsPerPixelFromFormat(format);
+	return e.size.getArea() * (bits ? bits : 32) / 8;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <irrlicht.h>
+#include <vector>
+
+struct RenderTargetStats {
+	irr::u32 allocated = 0; // Targets currently owned by the pool
+	irr::u32 inUse = 0;
+	irr::u32 allocations = 0; // Lifetime counters
+	irr::u32 reuses = 0;
+	irr::u32 evictions = 0;
+	irr::u32 bytes = 0; // Approximate memory held by allocated targets
+};
+
+// Shares render target textures between users instead of creating a new one per request. Targets are
+// keyed by size and color format, a free target last used by the same owner is preferred so its contents
+// survive between frames. Frame leases are returned by endFrame, free targets are evicted least recently used first.
+class RenderTargetPool
+{
+public:
+	RenderTargetPool(irr::video::IVideoDriver* driver);
+	~RenderTargetPool();
+
+	// Held until release is called
+	irr::video::ITexture* acquire(const irr::core::dimension2du& size,
+		irr::video::ECOLOR_FORMAT format = irr::video::ECF_UNKNOWN, const void* owner = nullptr);
+
+	// Held until the end of the current frame
+	irr::video::ITexture* acquireForFrame(const irr::core::dimension2du& size,
+		irr::video::ECOLOR_FORMAT format = irr::video::ECF_UNKNOWN, const void* owner = nullptr);
+
+	// Held by the owner until releaseOwner, asking again at the same size and format returns the same target
+	irr::video::ITexture* acquireOwned(const irr::core::dimension2du& size,
+		irr::video::ECOLOR_FORMAT format, const void* owner);
+
+	void release(irr::video::ITexture* texture);
+	void releaseOwner(const void* owner); // Releases the target held through acquireOwned
+
+	void endFrame(); // Returns frame leases and evicts stale free targets
+	void clear(); // Removes every free target
+
+	const RenderTargetStats& getStats() const { return stats; }
+
+	irr::u32 maxFreeTargets = 8; // Free targets kept around for reuse
+	irr::u32 maxIdleFrames = 300; // Free targets unused for longer are evicted
+private:
+	struct SEntry {
+		irr::video::ITexture* texture = nullptr;
+		irr::core::dimension2du size;
+		irr::video::ECOLOR_FORMAT format = irr::video::ECF_UNKNOWN;
+		const void* owner = nullptr;
+		irr::u32 lastUsed = 0;
+		bool inUse = false;
+		bool frameLease = false;
+	};
+
+	SEntry* find(const irr::core::dimension2du& size, irr::video::ECOLOR_FORMAT format, const void* owner);
+	void evict(irr::u32 index);
+	static irr::u32 getBytes(const SEntry& e);
+
+	irr::video::IVideoDriver* driver;
+	std::vector<SEntry> entries;
+	RenderTargetStats stats;
+	irr::u32 frame = 0;
+	irr::u32 nextName = 0;
+};
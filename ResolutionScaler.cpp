@@ -0,0 +1,78 @@
+#include "ResolutionScaler.h"
+#include "XEffects.h"
+
+using namespace irr;
+
+ResolutionScaler::ResolutionScaler(EffectHandler* e) : effects(e) {}
+
+void ResolutionScaler::setEnabled(bool enable) {
+	enabled = enable;
+	overCount = underCount = cooldown = 0;
+
+	// Back to full resolution on the next update
+	if (!enabled)
+		scale = 1.0f;
+}
+
+void ResolutionScaler::update(f32 frameMs, f32 budgetMs, const core::dimension2du& screenSize) {
+	if (!effects || screenSize.getArea() == 0)
+		return;
+
+	if (!enabled) {
+		if (appliedSize.getArea() != 0 && appliedSize != screenSize) {
+			scale = 1.0f;
+			apply(screenSize);
+		}
+		appliedSize = core::dimension2du();
+		return;
+	}
+
+	if (targetMs > 0.0f)
+		budgetMs = targetMs;
+
+	smoothedMs = smoothedMs == 0.0f ? frameMs : smoothedMs + (frameMs - smoothedMs) * 0.1f;
+
+	if (budgetMs > 0.0f) {
+		if (smoothedMs > budgetMs) {
+			++overCount;
+			underCount = 0;
+		}
+		else if (smoothedMs < budgetMs * upThreshold) {
+			++underCount;
+			overCount = 0;
+		}
+		else {
+			overCount = underCount = 0;
+		}
+
+		if (cooldown > 0) {
+			--cooldown;
+		}
+		else if (overCount >= downFrames && scale > minScale) {
+			scale = core::max_(scale - step, minScale);
+			overCount = 0;
+			cooldown = cooldownFrames;
+		}
+		else if (underCount >= upFrames && scale < maxScale) {
+			scale = core::min_(scale + step, maxScale);
+			underCount = 0;
+			cooldown = cooldownFrames;
+		}
+	}
+
+	scale = core::clamp(scale, minScale, maxScale);
+
+	// Also follows window resizes
+	if (getTargetSize(screenSize) != appliedSize)
+		apply(screenSize);
+}
+
+core::dimension2du ResolutionScaler::getTargetSize(const core::dimension2du& screenSize) const {
+	return core::dimension2du(core::max_((u32)(screenSize.Width * scale + 0.5f), 1u),
+		core::max_((u32)(screenSize.Height * scale + 0.5f), 1u));
+}
+
+void ResolutionScaler::apply(const core::dimension2du& screenSize) {
+	appliedSize = getTargetSize(screenSize);
+	effects->setScreenRenderTargetResolution(appliedSize);
+}
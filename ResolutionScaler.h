@@ -0,0 +1,46 @@
+#pragma once
+
+#include <irrlicht.h>
+
+class EffectHandler;
+
+// Scales the scene render target between minScale and maxScale of the window so frames fit a time budget.
+// Frame times are smoothed, and the scale only moves a step after the budget has been missed (or comfortably
+// met) for a run of frames, so it settles instead of flipping around the limit. Render targets are rebuilt
+// on every change, cooldownFrames keeps those rebuilds apart. The effect handler's final pass stretches the
+// smaller target over the window.
+class ResolutionScaler
+{
+public:
+	ResolutionScaler(EffectHandler* effects);
+
+	// Call once per frame with the time spent on it, sleeping excluded. A budget of 0 leaves the scale alone.
+	void update(irr::f32 frameMs, irr::f32 budgetMs, const irr::core::dimension2du& screenSize);
+
+	void setEnabled(bool enable);
+	bool isEnabled() const { return enabled; }
+
+	irr::f32 getScale() const { return scale; }
+	irr::f32 getSmoothedFrameTime() const { return smoothedMs; }
+
+	irr::f32 minScale = 0.5f;
+	irr::f32 maxScale = 1.0f;
+	irr::f32 step = 0.1f;
+	irr::f32 targetMs = 0.0f; // Overrides the budget passed to update when above 0
+	irr::f32 upThreshold = 0.75f; // Fraction of the budget frames must fit in before the scale goes back up
+	irr::u32 downFrames = 8; // Frames over budget before stepping down
+	irr::u32 upFrames = 60; // Frames under upThreshold before stepping up
+	irr::u32 cooldownFrames = 30;
+private:
+	irr::core::dimension2du getTargetSize(const irr::core::dimension2du& screenSize) const;
+	void apply(const irr::core::dimension2du& screenSize);
+
+	EffectHandler* effects;
+	irr::core::dimension2du appliedSize;
+	irr::f32 scale = 1.0f;
+	irr::f32 smoothedMs = 0.0f;
+	irr::u32 overCount = 0;
+	irr::u32 underCount = 0;
+	irr::u32 cooldown = 0;
+	bool enabled = false;
+};
@@ -0,0 +1,244 @@
+#include "Scheduler.h"
+#include "DebugConsole.h"
+
+using namespace irr;
+
+void TimerWheel::add(u32 id, u32 token, u64 due) {
+	SEntry e = { id, token, due };
+	place(e);
+	++count;
+}
+
+void TimerWheel::place(const SEntry& e) {
+	// Never in the slot being fired right now, that one is only looked at again a full turn later
+	const u64 due = core::max_(e.due, current + 1);
+	const u64 delta = due - current;
+
+	for (u32 level = 0; level < LEVELS; ++level) {
+		if (delta < (1ull << (BITS * (level + 1)))) {
+			slots[level][(due >> (BITS * level)) & (SLOTS - 1)].push_back(e);
+			return;
+		}
+	}
+
+	// Past the top level, parked in the furthest slot and placed again once it cascades down
+	const u32 top = LEVELS - 1;
+	const u64 furthest = current + (1ull << (BITS * LEVELS)) - 1;
+	slots[top][(furthest >> (BITS * top)) & (SLOTS - 1)].push_back(e);
+}
+
+void TimerWheel::advance(u64 to, std::vector<SEntry>& fired) {
+	// Nothing to visit, skip the empty ticks
+	if (count == 0) {
+		current = core::max_(current, to);
+		return;
+	}
+
+	while (current < to) {
+		++current;
+
+		// A level wrapped, spread the next slot of the level above over the ones below
+		for (u32 level = 1; level < LEVELS; ++level) {
+			if (current & ((1ull << (BITS * level)) - 1))
+				break;
+
+			cascading.clear();
+			cascading.swap(slots[level][(current >> (BITS * level)) & (SLOTS - 1)]);
+			for (const SEntry& e : cascading)
+				place(e);
+		}
+
+		std::vector<SEntry>& slot = slots[0][current & (SLOTS - 1)];
+		for (const SEntry& e : slot) {
+			if (e.due > current) {
+				place(e); // Came from the overflow parking slot
+				continue;
+			}
+
+			fired.push_back(e);
+			--count;
+		}
+		slot.clear();
+
+		if (count == 0) {
+			current = to;
+			break;
+		}
+	}
+}
+
+void TimerWheel::clear() {
+	for (u32 level = 0; level < LEVELS; ++level)
+		for (u32 slot = 0; slot < SLOTS; ++slot)
+			slots[level][slot].clear();
+
+	count = 0;
+}
+
+
+int Scheduler::spawn(sol::function function, const std::vector<sol::object>& args) {
+	if (!function.valid())
+		return -1;
+
+	u32 id;
+	if (!freeTasks.empty()) {
+		id = freeTasks.back();
+		freeTasks.pop_back();
+	}
+	else {
+		id = (u32)tasks.size();
+		tasks.push_back(STask());
+	}
+
+	STask& task = tasks[id];
+	task.thread = sol::thread::create(sol::main_thread(function.lua_state(), function.lua_state()));
+	task.routine = sol::coroutine(task.thread.thread_state(), function);
+	task.alive = true;
+	++task.token;
+
+	threads[task.thread.thread_state()] = id;
+
+	resume(id, &args);
+	return (int)id;
+}
+
+void Scheduler::cancel(int id) {
+	if (id >= 0 && id < (int)tasks.size() && tasks[id].alive)
+		release((u32)id);
+}
+
+void Scheduler::clear() {
+	for (u32 i = 0; i < tasks.size(); ++i)
+		if (tasks[i].alive)
+			release(i);
+
+	timeWheel.clear();
+	frameWheel.clear();
+	waitingUntil.clear();
+}
+
+Scheduler::STask* Scheduler::find(lua_State* thread, u32& id) {
+	auto it = threads.find(thread);
+	if (it == threads.end())
+		return nullptr;
+
+	id = it->second;
+	return &tasks[id];
+}
+
+bool Scheduler::sleep(lua_State* thread, f32 ms) {
+	u32 id;
+	STask* task = find(thread, id);
+	if (!task)
+		return false;
+
+	timeWheel.add(id, ++task->token, timeWheel.getCurrent() + (u64)core::max_(core::ceil32(ms), 0));
+	return true;
+}
+
+bool Scheduler::sleepFrames(lua_State* thread, u32 frames) {
+	u32 id;
+	STask* task = find(thread, id);
+	if (!task)
+		return false;
+
+	frameWheel.add(id, ++task->token, frameWheel.getCurrent() + core::max_(frames, 1u));
+	return true;
+}
+
+bool Scheduler::sleepUntil(lua_State* thread, sol::main_protected_function predicate) {
+	u32 id;
+	STask* task = find(thread, id);
+	if (!task)
+		return false;
+
+	task->until = predicate;
+
+	TimerWheel::SEntry e = { id, ++task->token, 0 };
+	waitingUntil.push_back(e);
+	return true;
+}
+
+void Scheduler::update(u32 nowMs) {
+	if (!started) {
+		started = true;
+		lastTime = nowMs;
+	}
+
+	due.clear();
+	timeWheel.advance(timeWheel.getCurrent() + (nowMs - lastTime), due);
+	frameWheel.advance(frameWheel.getCurrent() + 1, due);
+	lastTime = nowMs;
+
+	for (size_t i = 0; i < waitingUntil.size();) {
+		const TimerWheel::SEntry e = waitingUntil[i];
+
+		bool ready = !tasks[e.id].alive || tasks[e.id].token != e.token;
+		if (!ready) {
+			// Copied, the predicate may spawn coroutines and move the task list
+			sol::main_protected_function until = tasks[e.id].until;
+			sol::protected_function_result result = until();
+			if (!result.valid()) {
+				sol::error err = result;
+				dConsole.sendMsg(std::string(err.what()).c_str(), MESSAGE_TYPE::WARNING);
+				release(e.id);
+				ready = true;
+			}
+			else
+				ready = result.get<bool>();
+
+			if (ready)
+				due.push_back(e);
+		}
+
+		if (ready) {
+			waitingUntil[i] = waitingUntil.back();
+			waitingUntil.pop_back();
+		}
+		else
+			++i;
+	}
+
+	// Resumed coroutines may wait again, which only adds to the wheels and the predicate list
+	for (size_t i = 0; i < due.size(); ++i) {
+		const TimerWheel::SEntry e = due[i];
+		if (tasks[e.id].alive && tasks[e.id].token == e.token)
+			resume(e.id);
+	}
+}
+
+void Scheduler::resume(u32 id, const std::vector<sol::object>* args) {
+	// Holds the references while the task may be cancelled and its slot reused from inside the coroutine
+	sol::thread thread = tasks[id].thread;
+	sol::coroutine routine = tasks[id].routine;
+
+	tasks[id].until = sol::main_protected_function();
+
+	sol::protected_function_result result = args ? routine(sol::as_args(*args)) : routine();
+
+	if (!result.valid()) {
+		sol::error err = result;
+		dConsole.sendMsg(std::string(err.what()).c_str(), MESSAGE_TYPE::WARNING);
+	}
+	else if (result.status() == sol::call_status::yielded) {
+		// Still waiting on something, or cancelled while running
+		return;
+	}
+
+	// Finished or failed, unless the coroutine was cancelled and the slot given to another one meanwhile
+	if (tasks[id].alive && tasks[id].thread.thread_state() == thread.thread_state())
+		release(id);
+}
+
+void Scheduler::release(u32 id) {
+	STask& task = tasks[id];
+	threads.erase(task.thread.thread_state());
+
+	task.alive = false;
+	++task.token; // Anything still in the wheels for it is skipped
+	task.until = sol::main_protected_function();
+	task.routine = sol::coroutine();
+	task.thread = sol::thread();
+
+	freeTasks.push_back(id);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <irrlicht.h>
+#include <sol/sol.hpp>
+#include <vector>
+#include <unordered_map>
+
+// Hierarchical timing wheel of LEVELS levels with SLOTS slots each. Entries sit in the slot of the level whose
+// range covers their delay, advancing a tick only looks at one slot of the lowest level, plus one slot of a
+// higher level whenever the level below it wraps. The cost of a tick does not depend on how many entries wait.
+class TimerWheel
+{
+public:
+	struct SEntry {
+		irr::u32 id;
+		irr::u32 token; // Lets the owner ignore entries it cancelled without searching the wheel
+		irr::u64 due;
+	};
+
+	static const irr::u32 BITS = 6;
+	static const irr::u32 SLOTS = 1 << BITS;
+	static const irr::u32 LEVELS = 4;
+
+	// Due ticks that already passed fire on the next advance
+	void add(irr::u32 id, irr::u32 token, irr::u64 due);
+
+	// Steps to the given tick, appending every entry that became due
+	void advance(irr::u64 to, std::vector<SEntry>& fired);
+
+	void clear();
+
+	irr::u64 getCurrent() const { return current; }
+	irr::u32 getCount() const { return count; }
+private:
+	void place(const SEntry& e);
+
+	std::vector<SEntry> slots[LEVELS][SLOTS];
+	std::vector<SEntry> cascading;
+	irr::u64 current = 0;
+	irr::u32 count = 0;
+};
+
+// Runs Lua coroutines started with Lime.Spawn. Lime.Wait and Lime.WaitFrames park the running coroutine in a
+// timer wheel (milliseconds and frames), Lime.WaitUntil polls a predicate once per frame. Only coroutines that
+// are due get resumed in update.
+class Scheduler
+{
+public:
+	// Starts the function as a coroutine right away, returns its id
+	int spawn(sol::function function, const std::vector<sol::object>& args);
+	void cancel(int id);
+	void clear();
+
+	// Park the coroutine running on the given Lua thread, false when it was not started by spawn. The
+	// caller yields afterwards
+	bool sleep(lua_State* thread, irr::f32 ms);
+	bool sleepFrames(lua_State* thread, irr::u32 frames);
+	bool sleepUntil(lua_State* thread, sol::main_protected_function predicate);
+
+	// Call once per frame with the device time
+	void update(irr::u32 nowMs);
+
+	irr::u32 getCount() const { return (irr::u32)threads.size(); }
+private:
+	// Threads are created from, and predicates referenced on, the main state. A task spawned from inside
+	// another one must not be tied to the parent coroutine, which can finish and be collected first
+	struct STask {
+		sol::thread thread;
+		sol::coroutine routine;
+		sol::main_protected_function until;
+		irr::u32 token = 0;
+		bool alive = false;
+	};
+
+	STask* find(lua_State* thread, irr::u32& id);
+	void resume(irr::u32 id, const std::vector<sol::object>* args = nullptr);
+	void release(irr::u32 id);
+
+	std::vector<STask> tasks;
+	std::vector<irr::u32> freeTasks;
+	std::unordered_map<lua_State*, irr::u32> threads;
+
+	TimerWheel timeWheel; // Ticks are milliseconds
+	TimerWheel frameWheel; // Ticks are frames
+	std::vector<TimerWheel::SEntry> waitingUntil;
+	std::vector<TimerWheel::SEntry> due;
+
+	irr::u32 lastTime = 0;
+	bool started = false;
+};
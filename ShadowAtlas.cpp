@@ -0,0 +1,114 @@
+#include "ShadowAtlas.h"
+
+using namespace irr;
+using namespace video;
+
+namespace
+{
+	/// Texels left around every tile for PCF offsets and the VSM blur.
+	const s32 TILE_GUTTER = 2;
+
+	/// Gathers every second bit of a Z-order index.
+	u32 compactBits(u32 v)
+	{
+		v &= 0x55555555;
+		v = (v | (v >> 1)) & 0x33333333;
+		v = (v | (v >> 2)) & 0x0f0f0f0f;
+		v = (v | (v >> 4)) & 0x00ff00ff;
+		v = (v | (v >> 8)) & 0x0000ffff;
+		return v;
+	}
+}
+
+
+void SShadowTile::set(const core::rect<s32>& rect, const core::dimension2du& textureSize, bool flipV)
+{
+	viewPort = rect;
+
+	const f32 u0 = (f32)rect.UpperLeftCorner.X / (f32)textureSize.Width;
+	const f32 v0 = (f32)rect.UpperLeftCorner.Y / (f32)textureSize.Height;
+	const f32 su = (f32)rect.getWidth() / (f32)textureSize.Width;
+	const f32 sv = (f32)rect.getHeight() / (f32)textureSize.Height;
+
+	// Scales and offsets normalized device coordinates so [-1, 1] lands on the tile.
+	bias.makeIdentity();
+	bias[0] = su;
+	bias[5] = sv;
+	bias[12] = 2.0f * u0 + su - 1.0f;
+	bias[13] = 1.0f - 2.0f * v0 - sv;
+
+	tileRect[0] = u0;
+	tileRect[1] = flipV ? 1.0f - v0 - sv : v0;
+	tileRect[2] = u0 + su;
+	tileRect[3] = flipV ? 1.0f - v0 : v0 + sv;
+
+	valid = true;
+}
+
+
+ShadowAtlas::ShadowAtlas(IVideoDriver* driverIn, const core::stringc& name, u32 sizeIn,
+	ECOLOR_FORMAT format, u32 minTileSizeIn)
+	: driver(driverIn), texture(0), size(roundUpPowerOfTwo(sizeIn)),
+	minTileSize(roundUpPowerOfTwo(minTileSizeIn)), used(0), lastTileSize(0)
+{
+	if (driver->queryFeature(EVDF_RENDER_TO_TARGET))
+		texture = driver->addRenderTargetTexture(core::dimension2du(size, size), name, format);
+}
+
+
+ShadowAtlas::~ShadowAtlas()
+{
+	if (texture)
+		driver->removeTexture(texture);
+}
+
+
+void ShadowAtlas::reset()
+{
+	used = 0;
+	lastTileSize = 0;
+}
+
+
+bool ShadowAtlas::allocate(u32 tileSize, SShadowTile& tile)
+{
+	tile.valid = false;
+
+	if (!texture)
+		return false;
+
+	tileSize = core::clamp(roundUpPowerOfTwo(tileSize), minTileSize, getMaxTileSize());
+
+	// Growing tiles would break the alignment the Z-order placement relies on.
+	if (lastTileSize && tileSize > lastTileSize)
+		tileSize = lastTileSize;
+
+	const u32 span = tileSize / minTileSize;
+	const u32 area = span * span;
+	const u32 capacity = (size / minTileSize) * (size / minTileSize);
+
+	if (used + area > capacity)
+		return false;
+
+	const s32 x = (s32)(compactBits(used) * minTileSize);
+	const s32 y = (s32)(compactBits(used >> 1) * minTileSize);
+
+	used += area;
+	lastTileSize = tileSize;
+
+	const core::rect<s32> rect(x + TILE_GUTTER, y + TILE_GUTTER,
+		x + (s32)tileSize - TILE_GUTTER, y + (s32)tileSize - TILE_GUTTER);
+
+	tile.set(rect, texture->getSize(), driver->getDriverType() == EDT_OPENGL);
+	return true;
+}
+
+
+u32 ShadowAtlas::roundUpPowerOfTwo(u32 value)
+{
+	u32 result = 1;
+	while (result < value)
+		result <<= 1;
+
+	return result;
+}
@@ -0,0 +1,67 @@
+#ifndef H_XEFFECTS_SHADOW_ATLAS
+#define H_XEFFECTS_SHADOW_ATLAS
+
+#include <irrlicht.h>
+
+/// A rectangle of a shared shadow map texture, with the matrix that maps a light's clip space into it.
+struct SShadowTile
+{
+	/// Sets up the tile for a viewport in a texture of the given size. OpenGL render targets start at
+	/// the bottom, so the texture coordinate rectangle is flipped there.
+	void set(const irr::core::rect<irr::s32>& rect, const irr::core::dimension2du& textureSize, bool flipV);
+
+	irr::core::rect<irr::s32> viewPort;
+	irr::core::matrix4 bias; /// Applied after the light's projection matrix
+	irr::f32 tileRect[4]; /// Tile in shadow map texture coordinates, for the receive shader
+	bool valid = false;
+};
+
+/// Packs square power of two tiles into one render target. Tiles are allocated largest first after each
+/// reset, which lets them be placed along a Z-order curve without any gaps or free lists.
+class ShadowAtlas
+{
+public:
+	ShadowAtlas(irr::video::IVideoDriver* driver, const irr::core::stringc& name, irr::u32 size,
+		irr::video::ECOLOR_FORMAT format, irr::u32 minTileSize = 64);
+	~ShadowAtlas();
+
+	/// Frees every tile, the texture contents are left alone.
+	void reset();
+
+	/// Allocates a tile of the given size, rounded up to a power of two. Sizes must not grow between
+	/// resets. A few texels around the tile are left unused so filtering does not sample its neighbours.
+	bool allocate(irr::u32 size, SShadowTile& tile);
+
+	irr::video::ITexture* getTexture() const
+	{
+		return texture;
+	}
+
+	irr::u32 getSize() const
+	{
+		return size;
+	}
+
+	irr::u32 getMinTileSize() const
+	{
+		return minTileSize;
+	}
+
+	/// Largest tile the atlas hands out, so no single light takes the whole texture.
+	irr::u32 getMaxTileSize() const
+	{
+		return size / 2;
+	}
+
+	static irr::u32 roundUpPowerOfTwo(irr::u32 value);
+
+private:
+	irr::video::IVideoDriver* driver;
+	irr::video::ITexture* texture;
+	irr::u32 size;
+	irr::u32 minTileSize;
+	irr::u32 used; /// Allocated area in minimum sized tiles
+	irr::u32 lastTileSize;
+};
+
+#endif
@@ -0,0 +1,336 @@
+#include "StaticBatch.h"
+#include "StaticMesh.h"
+#include <tuple>
+
+using namespace irr;
+using namespace scene;
+using namespace core;
+using namespace video;
+
+namespace {
+	std::map<int, SBakedBatch*> bakedBatches;
+	int nextBatchID = 0;
+
+	// Shadow registration of a source, moved onto its cell while baked (hidden nodes still render in the shadow passes)
+	struct SShadowInfo {
+		bool registered = false;
+		E_SHADOW_MODE mode = ESM_EXCLUDE;
+		E_FILTER_TYPE filter = EFT_NONE;
+	};
+
+	struct SBuildGroup {
+		SMaterial material;
+		E_VERTEX_TYPE type;
+		IMeshBuffer* buffer;
+	};
+
+	struct SBuildCell {
+		SMesh* mesh = nullptr;
+		IMetaTriangleSelector* selector = nullptr;
+		std::vector<SBuildGroup> groups;
+		std::vector<int> sources;
+		SShadowInfo shadow;
+	};
+
+	// Cell grid coordinates plus the shadow registration, since XEffects registers whole nodes
+	typedef std::tuple<s32, s32, s32, bool, s32, s32> CellKey;
+
+	IMeshBuffer* createBuffer(E_VERTEX_TYPE type) {
+		switch (type) {
+		case EVT_2TCOORDS:
+			return new SMeshBufferLightMap();
+		case EVT_TANGENTS:
+			return new SMeshBufferTangents();
+		default:
+			return new SMeshBuffer();
+		}
+	}
+
+	template <class T>
+	void transformVertex(T& v, const matrix4& transform, const matrix4& normalTransform) {
+		transform.transformVect(v.Pos);
+		normalTransform.rotateVect(v.Normal);
+		v.Normal.normalize();
+	}
+
+	template <>
+	void transformVertex<S3DVertexTangents>(S3DVertexTangents& v, const matrix4& transform, const matrix4& normalTransform) {
+		transform.transformVect(v.Pos);
+		normalTransform.rotateVect(v.Normal);
+		v.Normal.normalize();
+		transform.rotateVect(v.Tangent);
+		v.Tangent.normalize();
+		transform.rotateVect(v.Binormal);
+		v.Binormal.normalize();
+	}
+
+	template <class T>
+	void appendBuffer(IMeshBuffer* dst, IMeshBuffer* src, const matrix4& transform, const matrix4& normalTransform) {
+		CMeshBuffer<T>* target = static_cast<CMeshBuffer<T>*>(dst);
+		const T* vertices = static_cast<const T*>(src->getVertices());
+		const u16* indices = src->getIndices();
+		const u16 base = (u16)target->Vertices.size();
+
+		target->Vertices.reallocate(target->Vertices.size() + src->getVertexCount());
+		for (u32 i = 0; i < src->getVertexCount(); ++i) {
+			T v = vertices[i];
+			transformVertex(v, transform, normalTransform);
+			target->Vertices.push_back(v);
+		}
+
+		target->Indices.reallocate(target->Indices.size() + src->getIndexCount());
+		for (u32 i = 0; i < src->getIndexCount(); ++i)
+			target->Indices.push_back(base + indices[i]);
+	}
+
+	// Sources that cannot be merged into 16 bit buffers are left as they are
+	bool canBake(IMesh* mesh) {
+		if (!mesh || mesh->getMeshBufferCount() == 0)
+			return false;
+
+		for (u32 i = 0; i < mesh->getMeshBufferCount(); ++i) {
+			IMeshBuffer* mb = mesh->getMeshBuffer(i);
+			if (mb->getIndexType() != EIT_16BIT || mb->getVertexCount() > 65535)
+				return false;
+		}
+
+		return true;
+	}
+
+	void addToCell(SBuildCell& cell, IMesh* mesh, ISceneNode* node) {
+		const matrix4& transform = node->getAbsoluteTransformation();
+		matrix4 normalTransform;
+		transform.getInverse(normalTransform);
+		normalTransform = normalTransform.getTransposed();
+
+		for (u32 i = 0; i < mesh->getMeshBufferCount(); ++i) {
+			IMeshBuffer* src = mesh->getMeshBuffer(i);
+			if (src->getIndexCount() == 0)
+				continue;
+
+			const SMaterial& material = i < node->getMaterialCount() ? node->getMaterial(i) : src->getMaterial();
+			const E_VERTEX_TYPE type = src->getVertexType();
+
+			SBuildGroup* group = nullptr;
+			for (SBuildGroup& g : cell.groups) {
+				if (g.type == type && g.material == material && g.buffer->getVertexCount() + src->getVertexCount() <= 65535) {
+					group = &g;
+					break;
+				}
+			}
+
+			if (!group) {
+				IMeshBuffer* buffer = createBuffer(type);
+				buffer->getMaterial() = material;
+				buffer->setHardwareMappingHint(EHM_STATIC);
+				cell.mesh->addMeshBuffer(buffer);
+				buffer->drop();
+
+				cell.groups.push_back({ material, type, buffer });
+				group = &cell.groups.back();
+			}
+
+			switch (type) {
+			case EVT_2TCOORDS:
+				appendBuffer<S3DVertex2TCoords>(group->buffer, src, transform, normalTransform);
+				break;
+			case EVT_TANGENTS:
+				appendBuffer<S3DVertexTangents>(group->buffer, src, transform, normalTransform);
+				break;
+			default:
+				appendBuffer<S3DVertex>(group->buffer, src, transform, normalTransform);
+				break;
+			}
+		}
+	}
+
+	void restoreShadow(ISceneNode* node, const SShadowInfo& info) {
+		if (!info.registered)
+			return;
+
+		if (info.mode == ESM_EXCLUDE)
+			effects->excludeNodeFromLightingCalculations(node);
+		else
+			effects->addShadowToNode(node, info.filter, info.mode);
+	}
+
+	SBakedBatch* findBatch(int id) {
+		auto it = bakedBatches.find(id);
+		return it != bakedBatches.end() ? it->second : nullptr;
+	}
+}
+
+StaticBatch::StaticBatch() {}
+
+void StaticBatch::unbake() {
+	SBakedBatch* batch = findBatch(id);
+	if (!batch)
+		return;
+
+	for (SBakedBatch::SCell& cell : batch->cells) {
+		effects->removeShadowFromNode(cell.node);
+		cell.node->remove();
+		cell.node->drop();
+	}
+
+	for (SBakedBatch::SSource& source : batch->sources) {
+		source.node->setVisible(source.wasVisible);
+		restoreShadow(source.node, { source.hadShadow, source.shadowMode, source.filterType });
+		source.node->drop();
+	}
+
+	bakedBatches.erase(id);
+	delete batch;
+	id = -1;
+}
+
+bool StaticBatch::isBaked() const {
+	return findBatch(id) != nullptr;
+}
+
+int StaticBatch::getCellCount() const {
+	SBakedBatch* batch = findBatch(id);
+	return batch ? (int)batch->cells.size() : 0;
+}
+
+int StaticBatch::getSourceCount() const {
+	SBakedBatch* batch = findBatch(id);
+	return batch ? (int)batch->sources.size() : 0;
+}
+
+StaticBatch bakeStatic(sol::table meshes, sol::optional<float> cellSize) {
+	const f32 size = cellSize && *cellSize > 0 ? *cellSize : 256.0f;
+
+	SBakedBatch* batch = new SBakedBatch();
+	std::map<CellKey, SBuildCell> buildCells;
+
+	for (auto& kv : meshes) {
+		sol::optional<StaticMesh&> m = kv.second.as<sol::optional<StaticMesh&>>();
+		if (!m || !m->meshNode)
+			continue;
+
+		IAnimatedMeshSceneNode* node = m->meshNode;
+		IMesh* mesh = node->getMesh() ? node->getMesh()->getMesh((s32)node->getFrameNr()) : nullptr;
+		if (!canBake(mesh)) {
+			dConsole.sendMsg(("BakeStatic: skipping mesh " + m->meshPath + " (no 16 bit geometry to merge)").c_str(), MESSAGE_TYPE::WARNING);
+			continue;
+		}
+
+		// The same node listed twice would be merged twice
+		bool duplicate = false;
+		for (const SBakedBatch::SSource& s : batch->sources)
+			duplicate |= s.node == node;
+		if (duplicate)
+			continue;
+
+		node->updateAbsolutePosition();
+
+		SBakedBatch::SSource source;
+		source.node = node;
+		source.box = node->getTransformedBoundingBox();
+		source.wasVisible = node->isVisible();
+		source.collision = node->getTriangleSelector() != nullptr;
+		source.hadShadow = effects->getShadowNodeInfo(node, source.shadowMode, source.filterType);
+
+		const vector3df center = source.box.getCenter();
+		CellKey key((s32)floorf(center.X / size), (s32)floorf(center.Y / size), (s32)floorf(center.Z / size),
+			source.hadShadow, (s32)source.shadowMode, (s32)source.filterType);
+
+		SBuildCell& cell = buildCells[key];
+		if (!cell.mesh) {
+			cell.mesh = new SMesh();
+			cell.shadow = { source.hadShadow, source.shadowMode, source.filterType };
+		}
+
+		addToCell(cell, mesh, node);
+
+		// Raypicks go through the sources' own selectors, which are already in world space
+		if (source.collision) {
+			if (!cell.selector)
+				cell.selector = smgr->createMetaTriangleSelector();
+			cell.selector->addTriangleSelector(node->getTriangleSelector());
+		}
+
+		cell.sources.push_back((int)batch->sources.size());
+
+		node->grab();
+		node->setVisible(false);
+		if (source.hadShadow)
+			effects->removeShadowFromNode(node);
+
+		batch->sources.push_back(source);
+	}
+
+	for (auto& kv : buildCells) {
+		SBuildCell& build = kv.second;
+		build.mesh->recalculateBoundingBox();
+
+		SBakedBatch::SCell cell;
+		cell.node = smgr->addMeshSceneNode(build.mesh, nullptr, -1);
+		cell.node->grab();
+		cell.sources = build.sources;
+		build.mesh->drop();
+
+		if (build.selector) {
+			cell.node->setTriangleSelector(build.selector);
+			build.selector->drop();
+		}
+
+		restoreShadow(cell.node, build.shadow);
+		batch->cells.push_back(cell);
+	}
+
+	if (batch->sources.empty()) {
+		delete batch;
+		return StaticBatch();
+	}
+
+	int id = nextBatchID++;
+	bakedBatches[id] = batch;
+	return StaticBatch(id);
+}
+
+int getBakedSourceID(ISceneNode* node, const vector3df& hit) {
+	if (!node)
+		return -1;
+
+	for (auto& kv : bakedBatches) {
+		for (const SBakedBatch::SCell& cell : kv.second->cells) {
+			if (cell.node != node)
+				continue;
+
+			// Smallest source box containing the hit, boxes are grown slightly so surface hits still land inside
+			const SBakedBatch::SSource* best = nullptr;
+			f32 bestVolume = 0.0f;
+			for (int i : cell.sources) {
+				const SBakedBatch::SSource& source = kv.second->sources[i];
+				if (!source.collision)
+					continue;
+
+				aabbox3d<f32> box = source.box;
+				box.MinEdge -= vector3df(0.01f);
+				box.MaxEdge += vector3df(0.01f);
+
+				if (box.isPointInside(hit) && (!best || box.getVolume() < bestVolume)) {
+					best = &source;
+					bestVolume = box.getVolume();
+				}
+			}
+
+			return best ? best->node->getID() : -1;
+		}
+	}
+
+	return node->getID();
+}
+
+void bindStaticBatch() {
+	sol::usertype<StaticBatch> bindType = lua->new_usertype<StaticBatch>("StaticBatch",
+		sol::constructors<StaticBatch()>(),
+
+		"baked", sol::property(&StaticBatch::isBaked),
+		"cellCount", sol::property(&StaticBatch::getCellCount),
+		"sourceCount", sol::property(&StaticBatch::getSourceCount));
+
+	bindType["unbake"] = &StaticBatch::unbake;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "irrlicht.h"
+#include "IrrManagers.h"
+#include "LuaLime.h"
+#include <vector>
+#include <map>
+
+// Merged geometry of a set of non-moving StaticMesh nodes. Buffers are grouped by material and shadow
+// mode and split into a grid of cells, so every cell is one scene node that can still be frustum culled.
+struct SBakedBatch {
+	struct SSource {
+		irr::scene::ISceneNode* node = nullptr;
+		irr::core::aabbox3d<irr::f32> box;
+		bool wasVisible = true;
+		bool collision = false;
+
+		bool hadShadow = false; // Shadow registration, restored when unbaked
+		E_SHADOW_MODE shadowMode = ESM_EXCLUDE;
+		E_FILTER_TYPE filterType = EFT_NONE;
+	};
+
+	struct SCell {
+		irr::scene::IMeshSceneNode* node = nullptr;
+		std::vector<int> sources; // Indices into sources for raypick lookups
+	};
+
+	std::vector<SSource> sources;
+	std::vector<SCell> cells;
+};
+
+class StaticBatch {
+public:
+	int id = -1;
+
+	StaticBatch();
+	StaticBatch(int i) : id(i) {}
+
+	void unbake();
+	bool isBaked() const;
+	int getCellCount() const;
+	int getSourceCount() const;
+};
+
+StaticBatch bakeStatic(sol::table meshes, sol::optional<float> cellSize);
+
+// Returns the ID of the baked source mesh that was hit if the node is a baked cell, otherwise the node's own ID.
+int getBakedSourceID(irr::scene::ISceneNode* node, const irr::core::vector3df& hit);
+
+void bindStaticBatch();
@@ -1,5 +1,7 @@
 #include "StaticMesh.h"
+#include "MeshSimplifier.h"
 #include <filesystem>
+#include <algorithm>
 
 StaticMesh::StaticMesh() : meshNode(nullptr), selector(nullptr), collisionEnabled(false),
 vColor(), shadow(ESM_EXCLUDE), hadShadow(false) {
@@ -67,6 +69,9 @@ bool StaticMesh::fullLoadMesh(const std::string& filePath, bool doTangents) {
 
 void StaticMesh::deload() {
     if (meshNode) {
+        lodManager->clear(meshNode);
+        occlusionCuller->removeOccluder(meshNode);
+        transformStore->remove(meshNode);
         effects->removeShadowFromNode(meshNode);
         meshNode->remove();
         meshNode = nullptr;
@@ -136,6 +141,7 @@ bool StaticMesh::loadMaterial(const Material& material, int slot) {
 
     meshNode->getMaterial(slot) = material.mat;
     //meshNode->getMaterial(slot).Lighting = false;
+    effects->markShadowNodeMaterialsChanged(meshNode);
 
     return true;
 }
@@ -247,6 +253,7 @@ sol::table StaticMesh::getBoneInfoByName(const std::string& name) {
 void StaticMesh::normalizeNormals(bool enable) {
     if (meshNode) {
         meshNode->setMaterialFlag(irr::video::EMF_NORMALIZE_NORMALS, enable);
+        effects->markShadowNodeMaterialsChanged(meshNode);
     }
 }
 
@@ -340,6 +347,98 @@ void StaticMesh::setAutomaticCulling(bool enable) {
     meshNode->setAutomaticCulling(enable ? EAC_BOX : EAC_OFF);
 }
 
+bool StaticMesh::setLODs(sol::table levels) {
+    if (!meshNode) return false;
+
+    lodManager->clear(meshNode);
+
+    std::vector<SLODLevel> chain;
+    chain.push_back({ meshNode->getMesh(), 0.0f });
+
+    for (auto& kv : levels) {
+        sol::optional<sol::table> entry = kv.second.as<sol::optional<sol::table>>();
+        if (!entry) continue;
+
+        std::string path = (*entry)[1].get_or(std::string());
+        float distance = (*entry)[2].get_or(0.0f);
+
+        irr::scene::IAnimatedMesh* mesh = smgr->getMesh(path.c_str());
+        if (!mesh) {
+            dConsole.sendMsg(("Mesh: could not load LOD " + path).c_str(), MESSAGE_TYPE::WARNING);
+            continue;
+        }
+
+        chain.push_back({ mesh, distance });
+    }
+
+    std::sort(chain.begin() + 1, chain.end(), [](const SLODLevel& a, const SLODLevel& b) { return a.distance < b.distance; });
+    lodManager->setLevels(meshNode, chain);
+
+    return chain.size() > 1;
+}
+
+bool StaticMesh::generateLODs(int levels, float distanceStep, sol::optional<float> ratio) {
+    if (!meshNode || levels <= 0) return false;
+
+    lodManager->clear(meshNode);
+
+    const float keep = ratio ? irr::core::clamp(*ratio, 0.05f, 0.95f) : 0.5f;
+    std::vector<SLODLevel> chain;
+    std::vector<irr::scene::IAnimatedMesh*> created;
+    chain.push_back({ meshNode->getMesh(), 0.0f });
+
+    irr::scene::IMesh* current = meshNode->getMesh()->getMesh(0);
+    for (int i = 1; i <= levels; ++i) {
+        // Simplified levels are shared through the mesh cache when the source mesh came from a file
+        std::string name = meshPath.empty() ? std::string() : meshPath + "#lod" + std::to_string(i) + "_" + std::to_string(keep);
+        irr::scene::IAnimatedMesh* lod = name.empty() ? nullptr : smgr->getMeshCache()->getMeshByName(name.c_str());
+
+        if (!lod) {
+            irr::scene::IMesh* simplified = createSimplifiedMesh(current, keep);
+            if (!simplified) break;
+
+            irr::scene::SAnimatedMesh* animated = new irr::scene::SAnimatedMesh(simplified);
+            simplified->drop();
+
+            if (!name.empty())
+                smgr->getMeshCache()->addMesh(name.c_str(), animated);
+            created.push_back(animated);
+            lod = animated;
+        }
+
+        chain.push_back({ lod, distanceStep * i });
+        current = lod->getMesh(0);
+    }
+
+    lodManager->setLevels(meshNode, chain);
+    for (irr::scene::IAnimatedMesh* m : created)
+        m->drop();
+
+    return chain.size() > 1;
+}
+
+void StaticMesh::clearLODs() {
+    if (meshNode)
+        lodManager->clear(meshNode);
+}
+
+int StaticMesh::getLODLevel() {
+    return meshNode ? lodManager->getLevel(meshNode) : 0;
+}
+
+bool StaticMesh::getOccluder() {
+    return meshNode ? occlusionCuller->isOccluder(meshNode) : false;
+}
+
+void StaticMesh::setOccluder(bool enable) {
+    if (!meshNode) return;
+
+    if (enable)
+        occlusionCuller->addOccluder(meshNode);
+    else
+        occlusionCuller->removeOccluder(meshNode);
+}
+
 void bindStaticMesh() {
     sol::usertype<StaticMesh> bindType = lua->new_usertype<StaticMesh>("Mesh",
         sol::constructors<StaticMesh(), StaticMesh(const std::string & filePath), StaticMesh(const StaticMesh & other)>(),
@@ -355,7 +454,9 @@ void bindStaticMesh() {
         "frame", sol::property(&StaticMesh::getFrame, &StaticMesh::setFrame),
         "debug", sol::property(&StaticMesh::getDebug, &StaticMesh::setDebug),
         "vertexColor", sol::property(&StaticMesh::getVColor, &StaticMesh::setVColor),
-        "shadows", sol::property(&StaticMesh::getShadows, &StaticMesh::setShadows));
+        "shadows", sol::property(&StaticMesh::getShadows, &StaticMesh::setShadows),
+        "lodLevel", sol::property(&StaticMesh::getLODLevel),
+        "occluder", sol::property(&StaticMesh::getOccluder, &StaticMesh::setOccluder));
 
     bindType["load"] = &StaticMesh::loadMesh;
     bindType["loadWithTangents"] = &StaticMesh::loadMeshWithTangents;
@@ -375,4 +476,9 @@ void bindStaticMesh() {
     bindType["ignoreLighting"] = &StaticMesh::exclude;
     bindType["writeToFile"] = &StaticMesh::writeToFile;
     bindType["setAutomaticCulling"] = &StaticMesh::setAutomaticCulling;
+    bindType["setLODs"] = &StaticMesh::setLODs;
+    bindType["generateLODs"] = &StaticMesh::generateLODs;
+    bindType["clearLODs"] = &StaticMesh::clearLODs;
+    bindType["setOccluder"] = &StaticMesh::setOccluder;
+    bindType["LoadAsync"] = &loadMeshAsync;
 }
\ No newline at end of file
@@ -90,6 +90,14 @@ public:
 
     void setAutomaticCulling(bool enable);
 
+    bool setLODs(sol::table levels);
+    bool generateLODs(int levels, float distanceStep, sol::optional<float> ratio);
+    void clearLODs();
+    int getLODLevel();
+
+    bool getOccluder();
+    void setOccluder(bool enable);
+
     irr::scene::ISceneNode* getNode() const override { return meshNode; }
 };
 
@@ -25,6 +25,7 @@ Text3D::Text3D(const std::string& tx, const Vector3D& pos, const Vector4D& col)
 Text3D::Text3D(const std::string& tx, const std::string& fontName) : Text3D(tx, Vector3D(), Vector4D(255, 255, 255, 255), fontName) {}
 
 void Text3D::destroy() {
+	transformStore->remove(text);
 	text->remove();
 }
 
@@ -19,6 +19,7 @@
  */
 
 #include "TextArea.h"
+#include "IrrManagers.h"
 
 #include <algorithm>
 #include "CGUIFont.h"
@@ -65,6 +66,10 @@ TextArea::~TextArea() {
 		backgroundTexture->drop();
 	}
 
+	if (texture && renderTargetPool) {
+		renderTargetPool->release(texture);
+	}
+
 	clear();
 }
 
@@ -406,7 +411,12 @@ void TextArea::updateRenderTargetTexture() {
 	if (driver->queryFeature(video::EVDF_RENDER_TO_TARGET)) {
 		core::dimension2du dimension = core::dimension2du(RelativeRect.getWidth() + (borderSize * 2), RelativeRect.getHeight() + (borderSize * 2));
 		if (!texture || (texture && texture->getOriginalSize() != dimension)) {
-			texture = driver->addRenderTargetTexture(dimension, "RTT", video::ECF_A8R8G8B8);
+			if (renderTargetPool) {
+				renderTargetPool->release(texture);
+				texture = renderTargetPool->acquire(dimension, video::ECF_A8R8G8B8, this);
+			} else {
+				texture = driver->addRenderTargetTexture(dimension, "RTT", video::ECF_A8R8G8B8);
+			}
 		}
 	}
 
@@ -118,4 +118,5 @@ void bindTexture() {
 	bind_type["appendFromFile"] = &Texture::appendFromFile;
 	bind_type["clear"] = &Texture::createEmpty;
 	bind_type["getPixel"] = &Texture::getPixel;
+	bind_type["LoadAsync"] = &loadTextureAsync;
 }
\ No newline at end of file
@@ -24,6 +24,7 @@ void Trail::make() {
 
 void Trail::destroy() {
 	if (t) {
+		transformStore->remove(empty);
 		t->remove();
 		empty->remove();
 	}
@@ -128,6 +129,7 @@ bool Trail::loadMaterial(const Material& material) {
 
 	t->getMaterial(0) = material.mat;
 	t->getMaterial(0).Lighting = false;
+	effects->markShadowNodeMaterialsChanged(t);
 
 	return true;
 }
@@ -0,0 +1,135 @@
+#include "TransformStore.h"
+#include "IrrManagers.h"
+
+using namespace irr;
+using namespace scene;
+
+namespace {
+	// False once the node or any of its ancestors was taken out of the scene
+	bool inScene(ISceneNode* node) {
+		while (node->getParent())
+			node = node->getParent();
+
+		return smgr && node == smgr->getRootSceneNode();
+	}
+
+	void store(f32* out, const core::vector3df& v) {
+		out[0] = v.X;
+		out[1] = v.Y;
+		out[2] = v.Z;
+	}
+
+	core::vector3df load(const f32* in) {
+		return core::vector3df(in[0], in[1], in[2]);
+	}
+}
+
+TransformStore::TransformStore() {}
+
+TransformStore::~TransformStore() {
+	clear();
+}
+
+bool TransformStore::reserve(u32 capacity) {
+	if (!lookup.empty())
+		return false;
+
+	entries.assign(capacity, STransformEntry());
+	nodes.assign(capacity, nullptr);
+
+	// Handed out lowest first
+	freeSlots.clear();
+	for (u32 i = capacity; i > 0; --i)
+		freeSlots.push_back(i - 1);
+
+	highest = 0;
+	return true;
+}
+
+int TransformStore::add(ISceneNode* node) {
+	if (!node)
+		return -1;
+
+	auto it = lookup.find(node);
+	if (it != lookup.end())
+		return (int)it->second;
+
+	if (freeSlots.empty())
+		return -1;
+
+	const u32 slot = freeSlots.back();
+	freeSlots.pop_back();
+
+	node->grab();
+	nodes[slot] = node;
+	lookup[node] = slot;
+	highest = core::max_(highest, slot + 1);
+
+	STransformEntry& e = entries[slot];
+	store(e.position, node->getPosition());
+	store(e.rotation, node->getRotation());
+	store(e.scale, node->getScale());
+	e.dirty = 0;
+
+	return (int)slot;
+}
+
+void TransformStore::remove(ISceneNode* node) {
+	auto it = lookup.find(node);
+	if (it != lookup.end())
+		release(it->second);
+}
+
+void TransformStore::clear() {
+	for (u32 i = 0; i < highest; ++i)
+		if (nodes[i])
+			release(i);
+
+	highest = 0;
+}
+
+void TransformStore::release(u32 slot) {
+	ISceneNode* node = nodes[slot];
+	lookup.erase(node);
+	nodes[slot] = nullptr;
+	entries[slot].dirty = 0;
+	freeSlots.push_back(slot);
+
+	node->drop();
+}
+
+void TransformStore::pull() {
+	for (u32 i = 0; i < highest; ++i) {
+		ISceneNode* node = nodes[i];
+		if (!node)
+			continue;
+
+		// Objects release their slot when destroyed, this catches nodes removed some other way (World.Clear, a removed parent)
+		if (node->getReferenceCount() == 1 || !inScene(node)) {
+			release(i);
+			continue;
+		}
+
+		// Written outside the update (input or network callbacks), keep it for the next push
+		STransformEntry& e = entries[i];
+		if (e.dirty)
+			continue;
+
+		store(e.position, node->getPosition());
+		store(e.rotation, node->getRotation());
+		store(e.scale, node->getScale());
+	}
+}
+
+void TransformStore::push() {
+	for (u32 i = 0; i < highest; ++i) {
+		STransformEntry& e = entries[i];
+		if (!e.dirty || !nodes[i])
+			continue;
+
+		nodes[i]->setPosition(load(e.position));
+		nodes[i]->setRotation(load(e.rotation));
+		nodes[i]->setScale(load(e.scale));
+		e.dirty = 0;
+	}
+}
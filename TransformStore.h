@@ -0,0 +1,46 @@
+#pragma once
+
+#include <irrlicht.h>
+#include <vector>
+#include <unordered_map>
+
+// One node's local transform. The layout is mirrored by the LimeTransform cdef in limeffi.lua, keep them in step.
+struct STransformEntry {
+	irr::f32 position[3];
+	irr::f32 rotation[3];
+	irr::f32 scale[3];
+	irr::u32 dirty; // Set by scripts after writing, the entry is applied to the node and cleared once per frame
+};
+
+// Fixed size array of node transforms that LuaJIT scripts can map through the ffi and read or write directly.
+// pull copies every node's transform into its entry before the update, push applies the dirty ones afterwards.
+// The array never moves once reserved, so the pointer handed to Lua stays valid until the store is reset.
+class TransformStore
+{
+public:
+	TransformStore();
+	~TransformStore();
+
+	// Only allowed while no nodes are added, returns false otherwise
+	bool reserve(irr::u32 capacity);
+
+	// Returns the node's slot (already added nodes keep theirs), -1 when the store is full. Nodes are grabbed
+	int add(irr::scene::ISceneNode* node);
+	void remove(irr::scene::ISceneNode* node);
+	void clear();
+
+	void pull();
+	void push();
+
+	STransformEntry* getData() { return entries.empty() ? nullptr : entries.data(); }
+	irr::u32 getCapacity() const { return (irr::u32)entries.size(); }
+	irr::u32 getCount() const { return (irr::u32)lookup.size(); }
+private:
+	void release(irr::u32 slot);
+
+	std::vector<STransformEntry> entries;
+	std::vector<irr::scene::ISceneNode*> nodes; // Parallel to entries, null for free slots
+	std::vector<irr::u32> freeSlots;
+	std::unordered_map<irr::scene::ISceneNode*, irr::u32> lookup;
+	irr::u32 highest = 0; // One past the highest slot in use, bounds the per frame loops
+};
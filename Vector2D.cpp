@@ -102,8 +102,9 @@ std::string Vector2D::toString() const {
 }
 
 // Lua binding
-void bindVector2D() {
-    sol::usertype<Vector2D> bindType = lua->new_usertype<Vector2D>("Vector2D",
+void bindVector2D(lua_State* state) {
+    sol::state_view view(state ? state : lua->lua_state());
+    sol::usertype<Vector2D> bindType = view.new_usertype<Vector2D>("Vector2D",
         sol::constructors<Vector2D(), Vector2D(float, float), Vector2D(float)>(),
         sol::meta_function::addition, &Vector2D::operator+,
         sol::meta_function::subtraction, &Vector2D::operator-,
@@ -31,4 +31,7 @@ public:
     std::string toString() const;
 };
 
-void bindVector2D();
\ No newline at end of file
+struct lua_State;
+
+// Binds into the main state by default, job workers bind their own states
+void bindVector2D(lua_State* state = nullptr);
\ No newline at end of file
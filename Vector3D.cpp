@@ -24,6 +24,49 @@ Vector3D Vector3D::operator/(float scalar) const {
     return Vector3D(x / scalar, y / scalar, z / scalar);
 }
 
+// In place operations
+void Vector3D::set(float nx, float ny, float nz) {
+    x = nx;
+    y = ny;
+    z = nz;
+}
+
+void Vector3D::copy(const Vector3D& other) {
+    set(other.x, other.y, other.z);
+}
+
+void Vector3D::addInPlace(const Vector3D& other) {
+    x += other.x;
+    y += other.y;
+    z += other.z;
+}
+
+void Vector3D::subtractInPlace(const Vector3D& other) {
+    x -= other.x;
+    y -= other.y;
+    z -= other.z;
+}
+
+void Vector3D::multiplyInPlace(float scalar) {
+    x *= scalar;
+    y *= scalar;
+    z *= scalar;
+}
+
+void Vector3D::divideInPlace(float scalar) {
+    x /= scalar;
+    y /= scalar;
+    z /= scalar;
+}
+
+void Vector3D::normalizeInPlace() {
+    float len = length();
+    if (len > 0)
+        divideInPlace(len);
+    else
+        set(0.0f, 0.0f, 0.0f);
+}
+
 // Length
 float Vector3D::length() const {
     return std::sqrt(x * x + y * y + z * z);
@@ -136,8 +179,9 @@ std::string Vector3D::toString() const {
 }
 
 // Lua binding
-void bindVector3D() {
-    sol::usertype<Vector3D> bindType = lua->new_usertype<Vector3D>("Vector3D",
+void bindVector3D(lua_State* state) {
+    sol::state_view view(state ? state : lua->lua_state());
+    sol::usertype<Vector3D> bindType = view.new_usertype<Vector3D>("Vector3D",
         sol::constructors<Vector3D(), Vector3D(float, float, float), Vector3D(float)>(),
         sol::meta_function::addition, &Vector3D::operator+,
         sol::meta_function::subtraction, &Vector3D::operator-,
@@ -159,4 +203,11 @@ void bindVector3D() {
     bindType["rotate"] = &Vector3D::rotate;
     bindType["angle"] = &Vector3D::angle;
     bindType["toStr"] = &Vector3D::toString;
+    bindType["set"] = &Vector3D::set;
+    bindType["copy"] = &Vector3D::copy;
+    bindType["addInPlace"] = &Vector3D::addInPlace;
+    bindType["subtractInPlace"] = &Vector3D::subtractInPlace;
+    bindType["multiplyInPlace"] = &Vector3D::multiplyInPlace;
+    bindType["divideInPlace"] = &Vector3D::divideInPlace;
+    bindType["normalizeInPlace"] = &Vector3D::normalizeInPlace;
 }
\ No newline at end of file
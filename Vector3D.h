@@ -17,6 +17,15 @@ public:
     Vector3D operator*(float scalar) const;
     Vector3D operator/(float scalar) const;
 
+    // In place forms, these change this vector instead of returning a new one
+    void set(float x, float y, float z);
+    void copy(const Vector3D& other);
+    void addInPlace(const Vector3D& other);
+    void subtractInPlace(const Vector3D& other);
+    void multiplyInPlace(float scalar);
+    void divideInPlace(float scalar);
+    void normalizeInPlace();
+
     float length() const;
     Vector3D normalize() const;
     Vector3D normalizeRange(float min, float max) const;
@@ -33,4 +42,7 @@ public:
     std::string toString() const;
 };
 
-void bindVector3D();
\ No newline at end of file
+struct lua_State;
+
+// Binds into the main state by default, job workers bind their own states
+void bindVector3D(lua_State* state = nullptr);
\ No newline at end of file
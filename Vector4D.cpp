@@ -39,8 +39,9 @@ std::string Vector4D::toString() const {
 }
 
 // Lua binding
-void bindVector4D() {
-    sol::usertype<Vector4D> bindType = lua->new_usertype<Vector4D>("Vector4D",
+void bindVector4D(lua_State* state) {
+    sol::state_view view(state ? state : lua->lua_state());
+    sol::usertype<Vector4D> bindType = view.new_usertype<Vector4D>("Vector4D",
         sol::constructors<Vector4D(), Vector4D(float, float, float, float), Vector4D(float)>(),
         sol::meta_function::addition, &Vector4D::operator+,
         sol::meta_function::subtraction, &Vector4D::operator-,
@@ -8,6 +8,7 @@
 #include "Camera3D.h"
 #include "DebugVisual.h"
 #include "Sound.h"
+#include "StaticBatch.h"
 
 typedef unsigned int u32;
 
@@ -27,6 +28,115 @@ namespace Warden {
 		dConsole.sendMsg(title.c_str(), (MESSAGE_TYPE)intensity);
 	}
 
+	// Coroutines, extra arguments are passed to the function. Returns an id for CancelTask
+	int spawnTask(sol::function f, sol::variadic_args va) {
+		if (!scheduler)
+			return -1;
+
+		std::vector<sol::object> args(va.begin(), va.end());
+		return scheduler->spawn(f, args);
+	}
+
+	void cancelTask(int id) {
+		if (scheduler)
+			scheduler->cancel(id);
+	}
+
+	// Records timed frame phases from every thread until StopTrace, which writes a Chrome trace_event file
+	bool startTrace(sol::optional<int> eventsPerThread) {
+		return frameTimer.startTrace((u32)core::max_(eventsPerThread.value_or(65536), 1));
+	}
+
+	bool stopTrace(const std::string& path) {
+		return frameTimer.stopTrace(path);
+	}
+
+	// Frame time and the time spent in each phase, in milliseconds
+	sol::table getFrameStats() {
+		sol::table stats = lua->create_table();
+		stats["frame"] = frameTimer.getFrameMs();
+		stats["averageFrame"] = frameTimer.getAverageFrameMs();
+
+		sol::table phases = lua->create_table();
+		for (const FrameTimer::SPhase& p : frameTimer.getPhases()) {
+			sol::table phase = lua->create_table();
+			phase["last"] = p.lastMs;
+			phase["average"] = p.averageMs;
+			phases[p.name] = phase;
+		}
+		stats["phases"] = phases;
+		stats["luaHeapKB"] = gcPacer ? gcPacer->getHeapKB(lua->lua_state()) : 0;
+
+		return stats;
+	}
+
+	// Collects Lua garbage in the idle time of each frame instead of whenever allocations trigger it, on by default
+	void setGCPacing(bool enable) {
+		if (gcPacer)
+			gcPacer->setEnabled(enable);
+	}
+
+	// Percentages as in collectgarbage("setpause") and ("setstepmul"), 0 keeps the current value. minimumMs is
+	// spent collecting every frame once the heap is past the pause, times how far past it is, even without idle
+	// time. hardLimit is the multiple of the pause threshold at which a full collection runs
+	void setGCParameters(int pause, int stepMul, sol::optional<float> minimumMs, sol::optional<float> hardLimit) {
+		if (!gcPacer)
+			return;
+
+		gcPacer->setParameters(lua->lua_state(), pause, stepMul);
+		if (minimumMs)
+			gcPacer->minimumMs = core::max_(*minimumMs, 0.0f);
+		if (hardLimit)
+			gcPacer->hardLimit = core::max_(*hardLimit, 1.0f);
+	}
+
+	// Samples Lua call stacks until StopProfiler, which writes them as collapsed stacks for flame graphs
+	bool startProfiler(sol::optional<int> intervalMs) {
+		return luaProfiler && luaProfiler->start(lua->lua_state(), intervalMs.value_or(10));
+	}
+
+	bool stopProfiler(sol::optional<std::string> path) {
+		return luaProfiler && luaProfiler->stop(path.value_or(std::string()));
+	}
+
+	// Runs the script on a worker state with args as ..., the callback gets its return values (or nil and the
+	// error) on the main thread. Returns the job id
+	int runJob(const std::string& path, sol::object args, sol::function callback) {
+		if (!jobPool)
+			return -1;
+
+		return jobPool->run(path, args, callback);
+	}
+
+	int getPendingJobCount() {
+		return jobPool ? jobPool->getPendingCount() : 0;
+	}
+
+	// The waits are raw Lua functions since they yield the calling coroutine
+	int waitTime(lua_State* L) {
+		if (!scheduler || !scheduler->sleep(L, (float)luaL_optnumber(L, 1, 0)))
+			return luaL_error(L, "Lime.Wait can only be called from a coroutine started with Lime.Spawn");
+
+		return lua_yield(L, 0);
+	}
+
+	int waitFrames(lua_State* L) {
+		const int frames = (int)luaL_optinteger(L, 1, 1);
+		if (!scheduler || !scheduler->sleepFrames(L, frames > 0 ? frames : 1))
+			return luaL_error(L, "Lime.WaitFrames can only be called from a coroutine started with Lime.Spawn");
+
+		return lua_yield(L, 0);
+	}
+
+	int waitUntil(lua_State* L) {
+		luaL_checktype(L, 1, LUA_TFUNCTION);
+		// Referenced on the main state, it is called from there while this coroutine is suspended
+		if (!scheduler || !scheduler->sleepUntil(L, sol::main_protected_function(L, 1)))
+			return luaL_error(L, "Lime.WaitUntil can only be called from a coroutine started with Lime.Spawn");
+
+		return lua_yield(L, 0);
+	}
+
 	// Get/set window caption
 	std::string getTitle() {
 		return caption;
@@ -275,7 +385,7 @@ namespace Warden {
 			Vector3D normal = Vector3D(hitTriangle.getNormal().X, hitTriangle.getNormal().Y, hitTriangle.getNormal().Z);
 			video::SMaterial material = pickedNode->getMaterial(0);
 			Vector3D hit = Vector3D(hitPosition.X, hitPosition.Y, hitPosition.Z);
-			result["ID"] = pickedNode->getID();
+			result["ID"] = getBakedSourceID(pickedNode, hitPosition);
 			result["normal"] = normal;
 			result["materialID"] = material.ID;
 			result["hitPosition"] = hit;
@@ -317,7 +427,7 @@ namespace Warden {
 			Vector3D normal = Vector3D(hitTriangle.getNormal().X, hitTriangle.getNormal().Y, hitTriangle.getNormal().Z);
 			video::SMaterial material = pickedNode->getMaterial(0);
 			Vector3D hit = Vector3D(hitPosition.X, hitPosition.Y, hitPosition.Z);
-			result["ID"] = pickedNode->getID();
+			result["ID"] = getBakedSourceID(pickedNode, hitPosition);
 			result["normal"] = normal;
 			result["materialID"] = material.ID;
 			result["hitPosition"] = hit;
@@ -463,6 +573,122 @@ namespace Warden {
 			irrHandler->defaultExclude = enable;
 	}
 
+	void setLODHysteresis(float fraction) {
+		if (lodManager)
+			lodManager->hysteresis = core::clamp(fraction, 0.0f, 0.9f);
+	}
+
+	void setOcclusionCulling(bool enable) {
+		if (occlusionCuller)
+			occlusionCuller->enabled = enable;
+	}
+
+	// Nodes hidden by occlusion culling, summed over every view of the last frame
+	int getOccludedCount() {
+		return occlusionCuller ? occlusionCuller->getOccludedCount() : 0;
+	}
+
+	sol::table getRenderTargetStats() {
+		sol::table result = lua->create_table();
+		if (renderTargetPool) {
+			const RenderTargetStats& stats = renderTargetPool->getStats();
+			result["allocated"] = stats.allocated;
+			result["inUse"] = stats.inUse;
+			result["allocations"] = stats.allocations;
+			result["reuses"] = stats.reuses;
+			result["evictions"] = stats.evictions;
+			result["bytes"] = stats.bytes;
+		}
+		return result;
+	}
+
+	// Merges non-moving meshes into per-material buffers split into cells of cellSize units
+	StaticBatch bakeStaticMeshes(sol::table meshes, sol::optional<float> cellSize) {
+		if (!device || !effects)
+			return StaticBatch();
+
+		return bakeStatic(meshes, cellSize);
+	}
+
+	// Sizes the transform buffer scripts map through the ffi (see limeffi.lua). Fails while objects hold slots
+	bool enableTransformBuffer(int capacity) {
+		if (!transformStore || capacity < 0)
+			return false;
+
+		return transformStore->reserve((irr::u32)capacity);
+	}
+
+	// Address and capacity of the transform buffer, the address is nil until a capacity is set
+	std::tuple<void*, int> getTransformBuffer() {
+		if (!transformStore)
+			return std::make_tuple(nullptr, 0);
+
+		return std::make_tuple((void*)transformStore->getData(), (int)transformStore->getCapacity());
+	}
+
+	// Zero based index of the object's entry in the transform buffer, -1 when it is full or not enabled
+	int getTransformSlot(Compatible3D* object) {
+		if (!transformStore || !object)
+			return -1;
+
+		return transformStore->add(object->getNode());
+	}
+
+	void releaseTransformSlot(Compatible3D* object) {
+		if (transformStore && object && object->getNode())
+			transformStore->remove(object->getNode());
+	}
+
+	// Sets transforms for a list of objects in one call. Each packed table holds x, y, z per object in the same order as
+	// the objects, nil leaves that component alone. Applied right away, so reading a property afterwards or setting one
+	// later in the same frame behaves as with plain property writes. Only the scene node is moved, so lights and
+	// cameras should still be set through their properties. Returns the number of objects set
+	int setTransforms(sol::table objects, sol::optional<sol::table> positions, sol::optional<sol::table> rotations, sol::optional<sol::table> scales) {
+		if (!device)
+			return 0;
+
+		const sol::table* packed[3] = {
+			positions ? &*positions : nullptr,
+			rotations ? &*rotations : nullptr,
+			scales ? &*scales : nullptr
+		};
+
+		const int count = (int)objects.size();
+
+		int set = 0;
+		for (int i = 1; i <= count; ++i) {
+			sol::optional<Compatible3D*> object = objects.raw_get<sol::optional<Compatible3D*>>(i);
+			irr::scene::ISceneNode* node = object && *object ? (*object)->getNode() : nullptr;
+			if (!node)
+				continue;
+
+			const int base = (i - 1) * 3;
+			for (int type = 0; type < 3; ++type) {
+				if (!packed[type])
+					continue;
+
+				const sol::table& t = *packed[type];
+				const core::vector3df v(t.raw_get<float>(base + 1), t.raw_get<float>(base + 2), t.raw_get<float>(base + 3));
+
+				switch (type) {
+				case 0:
+					node->setPosition(v);
+					break;
+				case 1:
+					node->setRotation(v);
+					break;
+				default:
+					node->setScale(v);
+					break;
+				}
+			}
+
+			++set;
+		}
+
+		return set;
+	}
+
 	// Sound
 	int play2DSound(const std::string& filePath, bool loop = false) {
 		return soundManager->play2DSound(filePath, loop);
@@ -619,20 +845,34 @@ namespace Warden {
 		if (!cur)
 			cur = mainCamera;
 
-		if (device && cur && driver->queryFeature(video::EVDF_RENDER_TO_TARGET)) {
-			tx = driver->addRenderTargetTexture(core::dimension2d<u32>(size.x, size.y), "RTT1");
+		// Each camera keeps its own target until it is destroyed or ReleaseRenderTexture is called, so the
+		// returned texture stays valid and calling this every frame reuses the same target
+		if (device && cur)
+			tx = renderTargetPool->acquireOwned(core::dimension2du(size.x, size.y), video::ECF_UNKNOWN, cur);
 
+		if (tx) {
 			driver->beginScene(true, true, irrHandler->backgroundColor);
 
+			transformStore->push();
+
 			irrHandler->setCameraMatrix(cur);
 
 			smgr->setActiveCamera(cur);
+			lodManager->update(cur);
+
+			// Shadow maps go first, casters hidden by the culler still cast
+			if (!irrHandler->legacyDrawing)
+				effects->updateShadowMaps();
+
+			occlusionCuller->cull(cur);
 
 			if (irrHandler->legacyDrawing) {
 				driver->setRenderTarget(tx, true, true, irrHandler->backgroundColor);
 				smgr->drawAll();
 			} else
-				effects->update();
+				effects->update(tx);
+
+			occlusionCuller->restore();
 
 			if (renderGUI)
 				guienv->drawAll();
@@ -642,15 +882,32 @@ namespace Warden {
 		smgr->setActiveCamera(mainCamera);
 		driver->setRenderTarget(0, true, true, irrHandler->backgroundColor);
 
-		Texture tex = Texture();
+		// An empty path skips the placeholder texture the default constructor creates
+		Texture tex = Texture(std::string());
 		tex.texture = tx;
 		tex.path = "Render Target Texture";
 
 		return tex;
 	}
 
+	// Returns the camera's render texture to the pool, textures GetRenderTexture gave out for it become invalid
+	void releaseCameraOutput(const Camera3D& c) {
+		if (renderTargetPool)
+			renderTargetPool->releaseOwner(c.camera ? c.camera : mainCamera);
+	}
+
 	void clearScene(bool includeModels) {
 		if (smgr && device) {
+			lodManager->clearAll();
+			occlusionCuller->clearOccluders();
+			transformStore->clear();
+
+			// Cameras go with the scene, so do the render textures they held
+			core::array<scene::ISceneNode*> cameras;
+			smgr->getSceneNodesFromType(scene::ESNT_CAMERA, cameras);
+			for (u32 i = 0; i < cameras.size(); ++i)
+				renderTargetPool->releaseOwner(cameras[i]);
+
 			smgr->clear();
 			if (includeModels)
 				smgr->getMeshCache()->clear();
@@ -662,9 +919,29 @@ namespace Warden {
 			guienv->clear();
 	}
 
-	void addPPX(std::string path) {
+	// Scale divides the resolution the effect runs at (1, 2 or 4), fromScene reads the scene instead of the previous effect
+	int addPPX(std::string path, sol::optional<int> scale, sol::optional<bool> fromScene) {
+		if (!effects)
+			return -1;
+
+		return effects->addPostProcessingEffectFromFile(path.c_str(), nullptr, scale.value_or(1) < 1 ? 1 : scale.value_or(1),
+			fromScene.value_or(false) ? EPPI_SCENE : EPPI_PREVIOUS);
+	}
+
+	void setPPXScale(int effect, int scale) {
+		if (effects)
+			effects->setPostProcessingEffectScale(effect, scale < 1 ? 1 : scale);
+	}
+
+	void setPPXFromScene(int effect, bool fromScene) {
+		if (effects)
+			effects->setPostProcessingEffectInput(effect, fromScene ? EPPI_SCENE : EPPI_PREVIOUS);
+	}
+
+	// Draw adjacent POST_STAGE effects as one fused pass
+	void setPPXFusion(bool enable) {
 		if (effects)
-			effects->addPostProcessingEffectFromFile(path.c_str());
+			effects->setPostProcessingFusion(enable);
 	}
 
 	void setDefaultShadowFiltering(int i) {
@@ -698,6 +975,40 @@ namespace Warden {
 			irrHandler->defaultShadowResolution = i;
 	}
 
+	// Size of the shared spot/point light shadow atlases, 0 gives every light its own map
+	void setShadowAtlasSize(int size) {
+		if (effects)
+			effects->setShadowAtlasSize(size < 0 ? 0 : size);
+	}
+
+	// Shade atlas lights together in one pass instead of one pass per light
+	void setMultiLightShading(bool enable) {
+		if (effects)
+			effects->setMultiLightShading(enable);
+	}
+
+	// Scale the scene resolution between minScale and maxScale of the window to hold the frame time target
+	void setDynamicResolution(bool enable, sol::optional<float> minScale, sol::optional<float> maxScale) {
+		if (!resolutionScaler)
+			return;
+
+		resolutionScaler->minScale = core::clamp(minScale.value_or(resolutionScaler->minScale), 0.25f, 1.0f);
+		resolutionScaler->maxScale = core::clamp(maxScale.value_or(resolutionScaler->maxScale), resolutionScaler->minScale, 1.0f);
+		resolutionScaler->setEnabled(enable);
+	}
+
+	// Milliseconds per frame, 0 follows the frame rate limit
+	void setFrameTimeTarget(float ms) {
+		if (resolutionScaler)
+			resolutionScaler->targetMs = ms < 0.0f ? 0.0f : ms;
+	}
+
+	float getResolutionScale() {
+		if (resolutionScaler)
+			return resolutionScaler->getScale();
+		return 1.0f;
+	}
+
 	// 2D
 	void setBilinearFiltering(bool enable) {
 		if (device) {
@@ -741,6 +1052,15 @@ namespace Warden {
 		return tex != nullptr;
 	}
 
+	void setStreamingBudget(float ms) {
+		if (assetStreamer)
+			assetStreamer->uploadBudget = ms > 0.0f ? ms : 0.0f;
+	}
+
+	int getPendingLoadCount() {
+		return assetStreamer ? assetStreamer->getPendingCount() : 0;
+	}
+
 	bool unloadMesh(std::string filePath) {
 		irr::scene::IMesh* mesh = smgr->getMesh(filePath.c_str());
 		if (mesh) {
@@ -887,6 +1207,20 @@ void bindWarden() {
 		application["SetResizable"] = &Warden::makeResizable;
 		application["GetElapsedTime"] = &Warden::getElapsedTime;
 		application["Log"] = &Warden::logConsole;
+		application["Spawn"] = &Warden::spawnTask;
+		application["CancelTask"] = &Warden::cancelTask;
+		application["Wait"] = &Warden::waitTime;
+		application["WaitFrames"] = &Warden::waitFrames;
+		application["WaitUntil"] = &Warden::waitUntil;
+		application["RunJob"] = &Warden::runJob;
+		application["StartProfiler"] = &Warden::startProfiler;
+		application["StartTrace"] = &Warden::startTrace;
+		application["StopTrace"] = &Warden::stopTrace;
+		application["GetFrameStats"] = &Warden::getFrameStats;
+		application["SetGCPacing"] = &Warden::setGCPacing;
+		application["SetGCParameters"] = &Warden::setGCParameters;
+		application["StopProfiler"] = &Warden::stopProfiler;
+		application["GetPendingJobCount"] = &Warden::getPendingJobCount;
 		application["AddArchiveToMemory"] = &Warden::addArchive;
 		application["SetShowConsole"] = &Warden::showConsole;
 		application["SetWriteConsole"] = &Warden::writeConsoleOutput;
@@ -917,13 +1251,34 @@ void bindWarden() {
 		world["ConvertToScreenPosition"] = &Warden::toScreenPosition;
 		world["SetShadows"] = &Warden::setShadows;
 		world["GetRenderTexture"] = &Warden::renderCameraOutput;
+		world["ReleaseRenderTexture"] = &Warden::releaseCameraOutput;
+		world["GetRenderTargetStats"] = &Warden::getRenderTargetStats;
 		world["Clear"] = &Warden::clearScene;
 		world["AddPostProcessingEffect"] = &Warden::addPPX;
+		world["SetPostProcessingScale"] = &Warden::setPPXScale;
+		world["SetPostProcessingFromScene"] = &Warden::setPPXFromScene;
+		world["SetPostProcessingFusion"] = &Warden::setPPXFusion;
 		world["SetDefaultShadowFiltering"] = &Warden::setDefaultShadowFiltering;
 		world["SetDefaultShadowResolution"] = &Warden::setDefaultShadowResolution;
+		world["SetShadowAtlasSize"] = &Warden::setShadowAtlasSize;
+		world["SetMultiLightShading"] = &Warden::setMultiLightShading;
+		world["SetDynamicResolution"] = &Warden::setDynamicResolution;
+		world["SetFrameTimeTarget"] = &Warden::setFrameTimeTarget;
+		world["GetResolutionScale"] = &Warden::getResolutionScale;
 		world["SetDefaultLightingExclusion"] = &Warden::defaultExclude;
+		world["BakeStatic"] = &Warden::bakeStaticMeshes;
+		world["SetTransforms"] = &Warden::setTransforms;
+		world["EnableTransformBuffer"] = &Warden::enableTransformBuffer;
+		world["GetTransformBuffer"] = &Warden::getTransformBuffer;
+		world["GetTransformSlot"] = &Warden::getTransformSlot;
+		world["ReleaseTransformSlot"] = &Warden::releaseTransformSlot;
+		world["SetLODHysteresis"] = &Warden::setLODHysteresis;
+		world["SetOcclusionCulling"] = &Warden::setOcclusionCulling;
+		world["GetOccludedCount"] = &Warden::getOccludedCount;
 		world["PreloadMesh"] = &Warden::preloadMesh;
 		world["PreloadTexture"] = &Warden::preloadTexture;
+		world["SetStreamingBudget"] = &Warden::setStreamingBudget;
+		world["GetPendingLoadCount"] = &Warden::getPendingLoadCount;
 		world["UnloadMesh"] = &Warden::unloadMesh;
 		world["UnloadTexture"] = &Warden::unloadTexture;
 		world["SetLegacyDrawing"] = &Warden::setLegacyDrawing;
@@ -79,7 +79,10 @@ void Water::createRaw() {
 
 void Water::destroy() {
     if (shadow) effects->removeShadowFromNode(water);
-    if (water) water->remove();
+    if (water) {
+        transformStore->remove(water);
+        water->remove();
+    }
 }
 
 float Water::getHeight() {
@@ -144,6 +147,7 @@ void Water::setScale(const Vector3D& scale) {
 void Water::loadMaterial(const Material& m) {
     material = m.mat;
     water->getMaterial(0) = material;
+    effects->markShadowNodeMaterialsChanged(water);
 }
 
 Vector2D Water::getTileSize() {
@@ -0,0 +1,54 @@
+-- Compares moving objects one property at a time against one World.SetTransforms call.
+--
+--   local bench = require("bench.settransforms")
+--   function Lime.OnStart()
+--       bench.run(10000, 60)
+--   end
+--
+-- Every round moves and turns all objects once, the average time per round of each method goes to the console.
+
+local bench = {}
+
+local function report(name, seconds, rounds)
+    Lime.Log(string.format("%-28s %8.3f ms per round", name, seconds * 1000 / rounds), 0)
+end
+
+function bench.run(count, rounds)
+    count = count or 10000
+    rounds = rounds or 60
+
+    local objects = {}
+    for i = 1, count do
+        objects[i] = Empty.new()
+    end
+
+    -- Properties, one Vector3D and one call per component
+    local start = os.clock()
+    for r = 1, rounds do
+        for i = 1, count do
+            local o = objects[i]
+            o.position = Vector3D.new(i, r, 0)
+            o.rotation = Vector3D.new(0, r, 0)
+        end
+    end
+    report("properties", os.clock() - start, rounds)
+
+    -- Packed tables, refilled every round like a script streaming simulation results would
+    local positions, rotations = {}, {}
+    start = os.clock()
+    for r = 1, rounds do
+        for i = 1, count do
+            local k = (i - 1) * 3
+            positions[k + 1], positions[k + 2], positions[k + 3] = i, r, 0
+            rotations[k + 1], rotations[k + 2], rotations[k + 3] = 0, r, 0
+        end
+        World.SetTransforms(objects, positions, rotations)
+    end
+    report("World.SetTransforms", os.clock() - start, rounds)
+
+    for i = 1, count do
+        objects[i]:destroy()
+    end
+end
+
+return bench
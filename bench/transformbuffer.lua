@@ -0,0 +1,60 @@
+-- Compares moving objects through properties against writing their entries in the ffi transform buffer.
+--
+--   local bench = require("bench.transformbuffer")
+--   function Lime.OnStart()
+--       bench.run(10000, 60)
+--   end
+--
+-- Needs LuaJIT and a free transform buffer, the average time per round of each method goes to the console.
+-- Buffer writes are applied after Lime.OnUpdate, so that cost is only in the frame time, not in these numbers.
+
+local limeffi = require("limeffi")
+
+local bench = {}
+
+local function report(name, seconds, rounds)
+    Lime.Log(string.format("%-28s %8.3f ms per round", name, seconds * 1000 / rounds), 0)
+end
+
+function bench.run(count, rounds)
+    count = count or 10000
+    rounds = rounds or 60
+
+    local transforms = limeffi.open(count)
+
+    local objects, slots = {}, {}
+    for i = 1, count do
+        objects[i] = Empty.new()
+        slots[i] = World.GetTransformSlot(objects[i])
+    end
+
+    -- Properties, one Vector3D and one call per component
+    local start = os.clock()
+    for r = 1, rounds do
+        for i = 1, count do
+            local o = objects[i]
+            o.position = Vector3D.new(i, r, 0)
+            o.rotation = Vector3D.new(0, r, 0)
+        end
+    end
+    report("properties", os.clock() - start, rounds)
+
+    -- Plain stores into the mapped array, no calls into the engine at all
+    start = os.clock()
+    for r = 1, rounds do
+        for i = 1, count do
+            local t = transforms[slots[i]]
+            t.position[0], t.position[1], t.position[2] = i, r, 0
+            t.rotation[0], t.rotation[1], t.rotation[2] = 0, r, 0
+            t.dirty = 1
+        end
+    end
+    report("ffi transform buffer", os.clock() - start, rounds)
+
+    for i = 1, count do
+        World.ReleaseTransformSlot(objects[i])
+        objects[i]:destroy()
+    end
+end
+
+return bench
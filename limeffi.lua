@@ -0,0 +1,42 @@
+-- Direct access to engine transforms through the LuaJIT ffi.
+--
+--   local limeffi = require("limeffi")
+--   local transforms = limeffi.open(4096)
+--   local slot = World.GetTransformSlot(mesh)
+--   local t = transforms[slot]
+--   t.position[1] = t.position[1] + 1 -- x, y, z are 0, 1, 2
+--   t.dirty = 1
+--
+-- Entries are refreshed from the scene before Lime.OnUpdate runs and dirty entries are applied after it, so
+-- a written transform shows up the same frame. Only the scene node is moved, use properties for lights.
+-- Slots of removed objects are freed, drop the index along with the object.
+
+local ffi = require("ffi")
+
+ffi.cdef[[
+typedef struct {
+    float position[3];
+    float rotation[3];
+    float scale[3];
+    uint32_t dirty;
+} LimeTransform;
+]]
+
+local limeffi = {}
+
+-- Sets the buffer capacity when given (only possible before any slot is taken) and returns the entry array
+-- and its capacity. The array is only valid until World.EnableTransformBuffer is called again.
+function limeffi.open(capacity)
+    if capacity and not World.EnableTransformBuffer(capacity) then
+        error("limeffi.open: the transform buffer can only be resized while no slots are in use", 2)
+    end
+
+    local address, count = World.GetTransformBuffer()
+    if address == nil then
+        error("limeffi.open: no transform buffer, pass a capacity first", 2)
+    end
+
+    return ffi.cast("LimeTransform*", address), count
+end
+
+return limeffi